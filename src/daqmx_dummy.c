@@ -1,6 +1,7 @@
 /* This is a dummy file whose job is to allow ni4462_test.c to be compiled successfully on systems (notably 64-bit ones) where libnidaqmx isn't available. 
    It doesn't "do" anything useful. Copyright Richard Neill <ni4462 at richardneill dot org>, 2011-2012. Free Software released under the GNU GPL v3+. 
    Note that most of the functions merely print a dummy message, and return success. Returned data should be validly formatted, but it's garbage.
+   For realistic timing, set DAQMX_DUMMY_REALTIME=1 in the environment: see the simulator, below. For silence (eg benchmarking), set DAQMX_DUMMY_QUIET=1.
 */
 
 /* Constants used by DAQmx */
@@ -22,8 +23,12 @@
 #define DAQmx_Val_Rising		789
 #define DAQmx_Val_RSE			790
 #define DAQmx_Val_Task_Commit		791
+#define DAQmx_Val_Task_Unreserve	794
 #define DAQmx_Val_Volts			792
 #define DAQmx_Val_WaitInfinitely	793
+#define DAQmx_Val_CurrReadPos		795
+#define DAQmx_Val_FirstSample		796
+#define DAQmx_Val_GroupByChannel	797
 
 /* Task Handle. DAQmx passes around something which presumably refers to some internal struct. As we will always "succeed" and always return dummy data, this can be a simple int here.  */
 typedef int 		TaskHandle;
@@ -35,6 +40,7 @@ typedef int64_t		int64;
 typedef uint64_t	uInt64;
 typedef int		bool32;
 typedef double		float64;
+typedef float		float32;
 
 /* Globals */
 bool32	will_read_all_available = FALSE;
@@ -48,18 +54,143 @@ int32 	settings_edge = DAQmx_Val_Falling;
 int32 	settings_lfear = TRUE;
 float64 settings_rate = 200000;
 int	settings_num_channels = 1;
+int	dummy_quiet = -1;		/* -1: not yet looked at the environment */
+
+/* Every call prints its arguments to stderr, unless DAQMX_DUMMY_QUIET=1 in the environment. (Quiet mode is for benchmarking: see 'make bench') */
+int is_dummy_quiet(){
+	char *env;
+	if (dummy_quiet == -1){
+		env = getenv ("DAQMX_DUMMY_QUIET");
+		dummy_quiet = (env && atoi (env));
+	}
+	return dummy_quiet;
+}
+#define dummy_eprintf(...)	do { if (!is_dummy_quiet()) { fprintf(stderr, __VA_ARGS__); } } while (0)
+
+
+/* Real-time simulator. With DAQMX_DUMMY_REALTIME=1 in the environment, the reads behave like the card's, so that the read loops, grouping and output paths
+   can be tested (and timed) without one. Samples are produced at the sample rate, on the wall clock, from StartTask (or, if a trigger is configured and
+   DAQMX_DUMMY_TRIGGER_HZ is set, from the next simulated trigger pulse). A read of N samples sleeps until they exist; DAQmx_Val_Auto returns what's there now.
+   In continuous mode, the unread samples are held in a circular buffer of DAQmxGetBufInputBufSize samples; if the reader falls further behind than that,
+   the reads fail with -200279, as the card's do. (The buffer is virtual: the data are generated from the sample index when read.) Reads are silent here. */
+#define SIM_ERR_PAST_END		-200278		/* DAQmxErrorSamplesWillNeverBeAvailable (read past the final sample) */
+#define SIM_ERR_OVERFLOW		-200279		/* DAQmxErrorSamplesNoLongerAvailable (overwritten: the buffer overflowed) */
+#define SIM_ERR_TIMEOUT			-200284		/* DAQmxErrorSamplesNotYetAvailable */
+#define SIM_ERR_BUF_TOO_SMALL		-200229		/* DAQmxErrorReadBufferTooSmall */
+
+int	sim_realtime = -1;		/* -1: not yet looked at the environment */
+int	sim_running = 0, sim_overflowed = 0, sim_triggered = 0;
+int32	sim_timing = DAQmx_Val_FiniteSamps;
+uInt64	sim_samples = 0;		/* Finite: samples in the task. Continuous: requested buffer size */
+uInt64	sim_read = 0;			/* Samples read so far (per channel), since StartTask. (This is the read position: it includes any skipped by ReadOffset) */
+int32	sim_relative_to = DAQmx_Val_CurrReadPos, sim_offset = 0;	/* Read position properties: each read starts at (relative_to + offset) */
+double	sim_t0 = 0, sim_trigger_hz = 0;	/* Time of the first sample (CLOCK_MONOTONIC, s); simulated trigger rate */
+
+/* Where sample i of channel c goes, in a read of n samples: interleaved (GroupByScanNumber), or channel-major (GroupByChannel) */
+#define sim_idx(fillmode, n, i, c)	( ((fillmode) == DAQmx_Val_GroupByChannel) ? ((c) * (n) + (i)) : (settings_num_channels * (i) + (c)) )
+
+/* Is the simulator on? */
+int sim_rt(){
+	char *env;
+	if (sim_realtime == -1){
+		env = getenv ("DAQMX_DUMMY_REALTIME");
+		sim_realtime = (env && atoi (env));
+		env = getenv ("DAQMX_DUMMY_TRIGGER_HZ");
+		sim_trigger_hz = env ? atof (env) : 0;
+		if (sim_realtime){
+			dummy_eprintf ("Dummy: real-time simulator enabled. (Simulated trigger: %s)\n", (sim_trigger_hz > 0) ? getenv ("DAQMX_DUMMY_TRIGGER_HZ") : "immediate");
+		}
+	}
+	return sim_realtime;
+}
+double sim_now(){
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+void sim_sleep_until (double t){
+	struct timespec ts;
+	ts.tv_sec = (time_t)t;
+	ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+		;
+	}
+}
+/* Input buffer size: finite tasks hold the whole acquisition; continuous ones use NI's default for the rate, or the requested size if that's bigger. */
+uInt64 sim_bufsize(){
+	uInt64 def = (settings_rate <= 100) ? 1000 : ( (settings_rate <= 10000) ? 10000 : ( (settings_rate <= 1000000) ? 100000 : 1000000 ) );
+	if (sim_timing == DAQmx_Val_FiniteSamps){
+		return sim_samples;
+	}
+	return (sim_samples > def) ? sim_samples : def;
+}
+/* Samples produced so far (per channel) */
+uInt64 sim_produced(){
+	double t = sim_now() - sim_t0;
+	uInt64 n = (t > 0) ? (uInt64)(t * settings_rate) : 0;
+	return ( (sim_timing == DAQmx_Val_FiniteSamps) && (n > sim_samples) ) ? sim_samples : n;
+}
+void sim_start(){
+	double t = sim_now();
+	sim_running = 1;  sim_read = 0;  sim_overflowed = 0;
+	sim_t0 = (sim_triggered && (sim_trigger_hz > 0)) ? (ceil (t * sim_trigger_hz) / sim_trigger_hz) : t;
+}
+/* A read: decide how many samples, wait for them, and account for them. The caller fills in the data: samples [*first, *first + *numread). */
+int sim_do_read (int32 numrequested, float64 timeout, uInt32 size, int32 *numread, uInt64 *first){
+	uInt64 want, avail, max = size / settings_num_channels;
+	double t_ready;
+	*numread = 0;
+	if (!sim_running){		/* Like the card: a read implicitly starts the task. */
+		sim_start();
+	}
+	if (sim_offset != 0){		/* ReadOffset: the read starts here, not at the read position. (Skip, or rewind.) */
+		sim_read = (sim_relative_to == DAQmx_Val_FirstSample) ? (uInt64)sim_offset : (sim_read + sim_offset);
+	}
+	avail = (sim_produced() > sim_read) ? (sim_produced() - sim_read) : 0;
+	if ( sim_overflowed || ( (sim_timing != DAQmx_Val_FiniteSamps) && (avail > sim_bufsize()) ) ){
+		sim_overflowed = 1;	/* (Sticky, until the task is restarted) */
+		return SIM_ERR_OVERFLOW;
+	}
+	if (numrequested == DAQmx_Val_Auto){
+		if ( will_read_all_available || (sim_timing != DAQmx_Val_FiniteSamps) ){
+			want = (avail < max) ? avail : max;			/* Whatever is there now: maybe 0. */
+		}else{
+			want = sim_samples - sim_read;				/* Finite: all the rest (blocking) */
+		}
+	}else{
+		want = numrequested;
+	}
+	if (want > max){
+		return SIM_ERR_BUF_TOO_SMALL;
+	}
+	if ( (sim_timing == DAQmx_Val_FiniteSamps) && (sim_read + want > sim_samples) ){
+		return SIM_ERR_PAST_END;
+	}
+	t_ready = sim_t0 + (sim_read + want) / settings_rate;		/* When the last of them will exist */
+	if (t_ready > sim_now()){
+		if ( (timeout != DAQmx_Val_WaitInfinitely) && (timeout >= 0) && (sim_now() + timeout < t_ready) ){
+			sim_sleep_until (sim_now() + timeout);
+			return SIM_ERR_TIMEOUT;
+		}
+		sim_sleep_until (t_ready);
+	}
+	*first = sim_read;
+	*numread = want;
+	sim_read += want;
+	return 0;
+}
 
 
 /* Get error message. */
 int DAQmxGetErrorString(int error, char *error_buf, int size){
-	error_buf = "Dummy error message";
-	fprintf (stderr, "Dummy DAQmxGetErrorString (%d, %s, %d).\n", error, error_buf, size);
+	snprintf (error_buf, size, "Dummy error message%s", (error == SIM_ERR_OVERFLOW) ? ": samples no longer available (input buffer overflow)" : "");
+	dummy_eprintf ("Dummy DAQmxGetErrorString (%d, %s, %d).\n", error, error_buf, size);
 	return (0);
 }
 /* Get extended error message */
 int DAQmxGetExtendedErrorInfo(char *error_buf, int size){
 	error_buf = "Dummy error message (long version)";
-	fprintf (stderr, "Dummy DAQmxGetExtendedErrorInfo (%s, %d).\n", error_buf, size);
+	dummy_eprintf ("Dummy DAQmxGetExtendedErrorInfo (%s, %d).\n", error_buf, size);
 	return (0);
 }
 /* Did it fail? */
@@ -70,196 +201,235 @@ int DAQmxFailed(int error){
 
 /* Task control */
 int DAQmxCreateTask( char *name, TaskHandle *taskHandle){
-	fprintf (stderr, "Dummy DAQmxCreateTask (%s, %d).\n", name, *taskHandle);
+	static TaskHandle next_handle = 1;		/* Distinct handles, so that a caller juggling several tasks can be debugged. */
+	*taskHandle = next_handle++;
+	settings_num_channels = 0;			/* (The task's channels are then added, by DAQmxCreateAIVoltageChan) */
+	dummy_eprintf ("Dummy DAQmxCreateTask (%s, %d).\n", name, *taskHandle);
 	return (0);
 }
 int  DAQmxStartTask(TaskHandle taskHandle){
-	fprintf (stderr, "Dummy DAQmxStartTask (%d).\n", taskHandle);
+	dummy_eprintf ("Dummy DAQmxStartTask (%d).\n", taskHandle);
+	if (sim_rt()){
+		sim_start();
+	}
 	return (0);
 }
 int  DAQmxStopTask(TaskHandle taskHandle){
-	fprintf (stderr, "Dummy DAQmxStopTask (%d).\n", taskHandle);
+	dummy_eprintf ("Dummy DAQmxStopTask (%d).\n", taskHandle);
+	sim_running = 0;
 	return (0);
 }	
 int  DAQmxClearTask(TaskHandle taskHandle){
-	fprintf (stderr, "Dummy DAQmxClearTask (%d).\n", taskHandle);
+	dummy_eprintf ("Dummy DAQmxClearTask (%d).\n", taskHandle);
 	return (0);
 }
 int DAQmxTaskControl(TaskHandle taskHandle, int32 control){
-	fprintf (stderr, "Dummy DAQmxTaskControl (%d, %d).\n", taskHandle, control);
+	dummy_eprintf ("Dummy DAQmxTaskControl (%d, %d).\n", taskHandle, control);
 	return (0);
 }
 
 
 /* Get information about the system */
 int DAQmxGetDevProductNum(char *device, uInt32 *data){
-	fprintf (stderr, "Dummy DAQmxGetDevProductNum (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxGetDevProductNum (%s).\n", device);
 	*data = 0x11223344;
 	return (0);
 }
 int DAQmxGetDevSerialNum(char *device, uInt32 *data){
-	fprintf (stderr, "Dummy DAQmxGetDevSerialNum (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxGetDevSerialNum (%s).\n", device);
 	*data = 0x12345678;
 	return (0);
 }
 int DAQmxGetSysNIDAQMajorVersion(uInt32 *data){
-	fprintf (stderr, "Dummy DAQmxGetSysNIDAQMajorVersion.\n");
+	dummy_eprintf ("Dummy DAQmxGetSysNIDAQMajorVersion.\n");
 	*data = 0xff;
 	return (0);
 }
 int DAQmxGetSysNIDAQMinorVersion(uInt32 *data){
-	fprintf (stderr, "Dummy DAQmxGetSysNIDAQMinorVersion.\n");
+	dummy_eprintf ("Dummy DAQmxGetSysNIDAQMinorVersion.\n");
 	*data = 0xee;
 	return (0);
 }
 int DAQmxGetExtCalLastDateAndTime (char *device, uInt32 *year, uInt32 *month, uInt32 *day, uInt32 *hour, uInt32 *minute){
-	fprintf (stderr, "Dummy DAQmxGetExtCalLastDateAndTime (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxGetExtCalLastDateAndTime (%s).\n", device);
 	*year=2012; *month=01; *day=02; *hour=03; *minute=04;
 	return (0);
 }
 int DAQmxGetSelfCalLastDateAndTime (char *device, uInt32 *year, uInt32 *month, uInt32 *day, uInt32 *hour, uInt32 *minute){
-	fprintf (stderr, "Dummy DAQmxGetSelfCalLastDateAndTime (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxGetSelfCalLastDateAndTime (%s).\n", device);
 	*year=2013; *month=02; *day=03; *hour=04; *minute=05;
 	return (0);
 }
 
 /* Self Calibrate. */
 int DAQmxSelfCal (char *device){
-	fprintf (stderr, "Dummy DAQmxSelfCal (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxSelfCal (%s).\n", device);
 	return (0);
 }
 
 /* Reset Device. */
 int DAQmxResetDevice (char *device){
-	fprintf (stderr, "Dummy DAQmxResetDevice (%s).\n", device);
+	dummy_eprintf ("Dummy DAQmxResetDevice (%s).\n", device);
 	return (0);
 }
 
 /* Connect terminals */
 int  DAQmxConnectTerms (char *source, char *dest, int modifiers){
-	fprintf (stderr, "Dummy DAQmxConnectTerms (%s, %s, %d).\n", source, dest, modifiers);
+	dummy_eprintf ("Dummy DAQmxConnectTerms (%s, %s, %d).\n", source, dest, modifiers);
 	return(0);
 }
 
 /* Create AI voltage channel */
 int DAQmxCreateAIVoltageChan (TaskHandle taskHandle, char *physicalchannel, char *name, int config, float64 minval, float64 maxval, int units, char* scalename){
-	fprintf (stderr, "Dummy DAQmxCreateAIVoltageChan (%d, %s, %s, %d, %f, %f, %d, %s).\n",  taskHandle, physicalchannel, name, config, minval, maxval, units, scalename);
-	settings_voltage_min = minval;  /* globals */	
+	dummy_eprintf ("Dummy DAQmxCreateAIVoltageChan (%d, %s, %s, %d, %f, %f, %d, %s).\n",  taskHandle, physicalchannel, name, config, minval, maxval, units, scalename);
+	settings_voltage_min = minval;  /* globals (The last call's: the readback is the same for every channel.) */
 	settings_voltage_max = maxval;
-	if (strlen(basename(physicalchannel)) == 3){  /* Eg "ai0" */
-		settings_num_channels = 1;
-	}else if (strlen(basename(physicalchannel)) == 6){
-		fprintf (stderr, "Error: can't count channels in: '%s'\n", basename(physicalchannel));
-		exit (1);
-	}else{
-		char channels[16];	 /* Eg "ai0:3". Ugly. */
-		strncpy (channels, basename(physicalchannel), 16);
-		channels[3] = 0;
-		channels[5] = 0;
-		settings_num_channels = atoi(channels+4) - atoi(channels+2) + 1;
+	char *s = physicalchannel, *ai;		/* Count the channels, and add them to the task's: eg "Dev1/ai0", "Dev1/ai0:3", "Dev1/ai0,Dev1/ai2". */
+	while (s && *s){
+		ai = strstr (s, "ai");
+		if (!ai || (ai[2] < '0') || (ai[2] > '9')){
+			fprintf (stderr, "Error: can't count channels in: '%s'\n", physicalchannel);
+			exit (1);
+		}
+		int a = strtol (ai + 2, &s, 10), b = (*s == ':') ? strtol (s + 1, &s, 10) : a;
+		settings_num_channels += abs (b - a) + 1;
+		s = (*s == ',') ? s + 1 : NULL;
 	}
 	return (0);
 }
 
 /* Get/Set input configuration */
 int DAQmxGetAIMin (TaskHandle taskHandle, char *physicalchannel, float64 *readback_v1){
-	fprintf (stderr, "Dummy DAQmxGetAIMin (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAIMin (%d, %s).\n", taskHandle, physicalchannel); 
 	*readback_v1 = settings_voltage_min; /* global */	
 	return(0);
 }
 int DAQmxGetAIMax (TaskHandle taskHandle, char *physicalchannel, float64 *readback_v2){
-	fprintf (stderr, "Dummy DAQmxGetAIMax (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAIMax (%d, %s).\n", taskHandle, physicalchannel); 
 	*readback_v2 = settings_voltage_max; /* global */	
 	return(0);
 }	
 int DAQmxGetAIGain (TaskHandle taskHandle, char *physicalchannel, float64 *gain){
-	fprintf (stderr, "Dummy DAQmxGetAIGain (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAIGain (%d, %s).\n", taskHandle, physicalchannel); 
 	*gain = settings_gain; /* global */
 	return(0);
 }	
+int DAQmxGetAIDevScalingCoeff (TaskHandle taskHandle, char *physicalchannel, float64 *coeff, uInt32 size){
+	dummy_eprintf ("Dummy DAQmxGetAIDevScalingCoeff (%d, %s, %d).\n", taskHandle, physicalchannel, size);
+	for (uInt32 i=0; i < size; i++){	/* Linear: 0.1 mV per code, so the dummy's int32 reads scale to the same volts as its float64 ones. */
+		coeff[i] = (i == 1) ? 1e-4 : 0;
+	}
+	return(0);
+}
 int DAQmxGetAITermCfg (TaskHandle taskHandle, char *physicalchannel, int32 *mode){
-	fprintf (stderr, "Dummy DAQmxGetAITermCfg (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAITermCfg (%d, %s).\n", taskHandle, physicalchannel); 
 	*mode = settings_mode; /* global */
 	return(0);
 }	
 int DAQmxGetAICoupling (TaskHandle taskHandle, char *physicalchannel, int32 *coupling){
-	fprintf (stderr, "Dummy DAQmxGetAICoupling (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAICoupling (%d, %s).\n", taskHandle, physicalchannel); 
 	*coupling = settings_coupling; /* global */
 	return(0);
 }	
 int DAQmxSetAICoupling (TaskHandle taskHandle, char *physicalchannel, int32 coupling){
-	fprintf (stderr, "Dummy DAQmxGetAICoupling (%d, %s, %d).\n", taskHandle, physicalchannel, coupling); 
+	dummy_eprintf ("Dummy DAQmxGetAICoupling (%d, %s, %d).\n", taskHandle, physicalchannel, coupling); 
 	settings_coupling = coupling; /* global */
 	return(0);
 }	
 int DAQmxCfgDigEdgeStartTrig (TaskHandle taskHandle, char *input, int32 edge){
-	fprintf (stderr, "Dummy DAQmxCfgDigEdgeStartTrig (%d, %s, %d).\n", taskHandle, input, edge); 
+	sim_triggered = 1;
+	dummy_eprintf ("Dummy DAQmxCfgDigEdgeStartTrig (%d, %s, %d).\n", taskHandle, input, edge); 
 	settings_edge = edge; /* global */
 	return(0);
 }	
 int DAQmxCfgDigEdgeRefTrig (TaskHandle taskHandle, char *input, int32 edge, int pretrigger_samples){
-	fprintf (stderr, "Dummy DAQmxCfgDigEdgeRefTrig (%d, %s, %d, %d).\n", taskHandle, input, edge, pretrigger_samples); 
+	sim_triggered = 1;
+	dummy_eprintf ("Dummy DAQmxCfgDigEdgeRefTrig (%d, %s, %d, %d).\n", taskHandle, input, edge, pretrigger_samples); 
 	settings_edge = edge; /* global */
 	return(0);
 }
 int DAQmxCfgSampClkTiming (TaskHandle taskHandle, char *source, float64 rate, int32 edge, int32 mode, uInt64 sampsPerChanToAcquire){
-	fprintf (stderr, "Dummy DAQmxCfgSampClkTiming (%d, %s, %f, %d, %d, %lld).\n", taskHandle, source, rate, edge, mode, (long long)sampsPerChanToAcquire);
+	dummy_eprintf ("Dummy DAQmxCfgSampClkTiming (%d, %s, %f, %d, %d, %lld).\n", taskHandle, (source ? source : "(OnboardClock)"), rate, edge, mode, (long long)sampsPerChanToAcquire);
 	settings_rate = rate;  /* globals */
 	settings_edge = edge;
 	settings_mode = mode;
 	samples_remaining_in_task = sampsPerChanToAcquire;
+	sim_timing = mode;  sim_samples = sampsPerChanToAcquire;
 	return(0);
 }	
 int DAQmxGetSampClkRate (TaskHandle taskHandle, float64 *freq_hz){
-	fprintf (stderr, "Dummy DAQmxGetSampClkRate (%d).\n", taskHandle); 
+	dummy_eprintf ("Dummy DAQmxGetSampClkRate (%d).\n", taskHandle); 
 	*freq_hz = settings_rate; /* global */
 	return(0);
 }	
 int DAQmxGetAIEnhancedAliasRejectionEnable (TaskHandle taskHandle, char *physicalchannel, int32 *lfear){
-	fprintf (stderr, "Dummy DAQmxGetAIEnhancedAliasRejectionEnable (%d, %s).\n", taskHandle, physicalchannel); 
+	dummy_eprintf ("Dummy DAQmxGetAIEnhancedAliasRejectionEnable (%d, %s).\n", taskHandle, physicalchannel); 
 	*lfear = settings_lfear; /* global */
 	return(0);
 }	
 int DAQmxSetAIEnhancedAliasRejectionEnable (TaskHandle taskHandle, char *physicalchannel, int32 lfear){
-	fprintf (stderr, "Dummy DAQmxSetAIEnhancedAliasRejectionEnable (%d, %s, %d).\n", taskHandle, physicalchannel, lfear); 
+	dummy_eprintf ("Dummy DAQmxSetAIEnhancedAliasRejectionEnable (%d, %s, %d).\n", taskHandle, physicalchannel, lfear); 
 	settings_lfear = lfear;
 	return(0);
 }
 int DAQmxSetReadReadAllAvailSamp (TaskHandle taskHandle, bool32 readall){
-	fprintf (stderr, "Dummy DAQmxSetReadReadAllAvailSamp (%d, %d).\n", taskHandle, readall); 
+	dummy_eprintf ("Dummy DAQmxSetReadReadAllAvailSamp (%d, %d).\n", taskHandle, readall); 
 	will_read_all_available = readall;  /* global */
 	return(0);
 }	
 
+int DAQmxSetReadRelativeTo (TaskHandle taskHandle, int32 relative_to){
+	dummy_eprintf ("Dummy DAQmxSetReadRelativeTo (%d, %d).\n", taskHandle, relative_to);
+	sim_relative_to = relative_to;
+	return(0);
+}
+int DAQmxSetReadOffset (TaskHandle taskHandle, int32 offset){
+	dummy_eprintf ("Dummy DAQmxSetReadOffset (%d, %d).\n", taskHandle, offset);
+	sim_offset = offset;
+	return(0);
+}
+
 /* Get other information */
 int DAQmxGetBufInputOnbrdBufSize(TaskHandle taskHandle, uInt32 *onboard_buffer){
-	fprintf (stderr, "Dummy DAQmxGetBufInputOnbrdBufSize (%d).\n", taskHandle);
+	dummy_eprintf ("Dummy DAQmxGetBufInputOnbrdBufSize (%d).\n", taskHandle);
 	*onboard_buffer = 100000;
 	return (0);
 }
 int DAQmxGetBufInputBufSize(TaskHandle taskHandle, uInt32 *input_buffer){
-	fprintf (stderr, "Dummy DAQmxGetBufInputBufSize (%d).\n", taskHandle);
-	*input_buffer = 200000;
+	dummy_eprintf ("Dummy DAQmxGetBufInputBufSize (%d).\n", taskHandle);
+	*input_buffer = sim_rt() ? sim_bufsize() : 200000;
 	return (0);
 }
 /* Check for overload. */
 int DAQmxGetReadOverloadedChansExist (TaskHandle taskHandle, bool32 *overload_occurred){
-	fprintf (stderr, "Dummy DAQmxGetReadOverloadedChansExist (%d).\n", taskHandle);
+	dummy_eprintf ("Dummy DAQmxGetReadOverloadedChansExist (%d).\n", taskHandle);
 	*overload_occurred = FALSE;
 	return (0);
 }
 int DAQmxGetReadOverloadedChans (TaskHandle taskHandle, char *error_buf, int size){
 	error_buf = "Dummy overload error message";
-	fprintf (stderr, "Dummy DAQmxGetReadOverloadedChans (%d, %s, %d).\n", taskHandle, error_buf, size);
+	dummy_eprintf ("Dummy DAQmxGetReadOverloadedChans (%d, %s, %d).\n", taskHandle, error_buf, size);
 	return (0);
 }
 
 
 /* Read (dummy) data */
 int DAQmxReadAnalogF64(TaskHandle taskHandle, int32 numrequested, float64 timeout, bool32 fillmode, float64 *data, uInt32 size, int32 *numread, bool32 *reserved __attribute__ ((unused)) ){
-	int samples_to_fake = 0;
+	int samples_to_fake = 0, ret;
+	uInt64 first;
+	if (sim_rt()){
+		if ( (ret = sim_do_read (numrequested, timeout, size, numread, &first)) ){
+			return (ret);
+		}
+		for (int i=0; i < *numread; i++){
+			for (int c=0; c< settings_num_channels; c++){
+				data[sim_idx (fillmode, *numread, i, c)] = 5 + ((first+i)%10)/10.0 + c/100.0;	/* (The channels differ, so a wrong layout shows) */
+			}
+		}
+		return (0);
+	}
 	if (numrequested < DAQmx_Val_Auto){	/* check for invalid. Can't happen, but squelches spurious compiler warning */
-		fprintf (stderr, "Dummy DAQmxReadAnalogF64 requested invalid %d.\n", numrequested);
+		dummy_eprintf ("Dummy DAQmxReadAnalogF64 requested invalid %d.\n", numrequested);
 		exit (1);
 	}else if (numrequested == DAQmx_Val_Auto){
 		if (will_read_all_available == TRUE){  /* <-- global */
@@ -270,24 +440,39 @@ int DAQmxReadAnalogF64(TaskHandle taskHandle, int32 numrequested, float64 timeou
 	}else{
 		samples_to_fake = numrequested; /* Read the number that were requested (assume the calling function isn't lying) */
 	}
+	if (samples_to_fake > (int)(size / settings_num_channels)){	/* Don't overrun the caller's buffer (eg Auto, in a continuous task, owes "all" of them). */
+		samples_to_fake = size / settings_num_channels;
+	}
 	if (samples_to_fake <= 0){
-		fprintf (stderr, "Dummy DAQmxReadAnalogF64 invalid samples to fake %d.\n", samples_to_fake);
+		dummy_eprintf ("Dummy DAQmxReadAnalogF64 invalid samples to fake %d.\n", samples_to_fake);
 		exit (1);			
 	}
 	samples_remaining_in_task -= samples_to_fake; /* <-- global */
 	*numread = samples_to_fake;
 	for (int i=0; i < samples_to_fake; i++){
 		for (int c=0; c< settings_num_channels; c++){ 
-			data[settings_num_channels*i+c] = 5 + (i%10)/10.0;	/* make up some plausible data. (fillmode is irrelevant, we're making it up either way) */
+			data[sim_idx (fillmode, samples_to_fake, i, c)] = 5 + (i%10)/10.0;	/* make up some plausible data. */
 		}
 	}
-	fprintf (stderr, "Dummy DAQmxReadAnalogF64 (%d, %d, %f, %d, %d), returning %d samples.\n", taskHandle, numrequested, timeout, fillmode, size, (int)samples_to_fake);
+	dummy_eprintf ("Dummy DAQmxReadAnalogF64 (%d, %d, %f, %d, %d), returning %d samples.\n", taskHandle, numrequested, timeout, fillmode, size, (int)samples_to_fake);
 	return (0);
 }
 int DAQmxReadBinaryI32(TaskHandle taskHandle, int32 numrequested, float64 timeout, bool32 fillmode, int32 *data_i, uInt32 size, int32 *numread, bool32 *reserved __attribute__ ((unused)) ){
-	int samples_to_fake = 0;
+	int samples_to_fake = 0, ret;
+	uInt64 first;
+	if (sim_rt()){
+		if ( (ret = sim_do_read (numrequested, timeout, size, numread, &first)) ){
+			return (ret);
+		}
+		for (int i=0; i < *numread; i++){
+			for (int c=0; c< settings_num_channels; c++){
+				data_i[sim_idx (fillmode, *numread, i, c)] = 50000 + 1000 * ((first+i)%10) + 100 * c;
+			}
+		}
+		return (0);
+	}
 	if (numrequested < DAQmx_Val_Auto){	/* check for invalid. Can't happen, but squelches spurious compiler warning */
-		fprintf (stderr, "Dummy DAQmxReadBinaryI32 requested invalid %d.\n", numrequested);
+		dummy_eprintf ("Dummy DAQmxReadBinaryI32 requested invalid %d.\n", numrequested);
 		exit (1);
 	}else if (numrequested == DAQmx_Val_Auto){
 		if (will_read_all_available == TRUE){  /* <-- global */
@@ -295,24 +480,27 @@ int DAQmxReadBinaryI32(TaskHandle taskHandle, int32 numrequested, float64 timeou
 		}else{
 			samples_to_fake = samples_remaining_in_task;	/* Read all the samples remaining that we "owe". */
 			if (samples_to_fake <= 0){
-				fprintf (stderr, "Dummy DAQmxReadBinaryI32 invalid samples to fake %d.\n", samples_to_fake);
+				dummy_eprintf ("Dummy DAQmxReadBinaryI32 invalid samples to fake %d.\n", samples_to_fake);
 				exit (1);			
 			}
 		}
 	}else{
 		samples_to_fake = numrequested; /* Read the number that were requested (assume the calling function isn't lying) */
 	}
+	if (samples_to_fake > (int)(size / settings_num_channels)){	/* Don't overrun the caller's buffer (eg Auto, in a continuous task, owes "all" of them). */
+		samples_to_fake = size / settings_num_channels;
+	}
 	if (samples_to_fake <= 0){
-		fprintf (stderr, "Dummy DAQmxReadAnalogF64 invalid samples to fake %d.\n", samples_to_fake);
+		dummy_eprintf ("Dummy DAQmxReadAnalogF64 invalid samples to fake %d.\n", samples_to_fake);
 		exit (1);			
 	}
 	samples_remaining_in_task -= samples_to_fake; /* <-- global */
 	*numread = samples_to_fake;
 	for (int i=0; i < samples_to_fake; i++){
 		for (int c=0; c< settings_num_channels; c++){ 
-			data_i[settings_num_channels*i+c] = 5000 + (i%10);	/* make up some plausible data  (fillmode is irrelevant, we're making it up either way) */
+			data_i[sim_idx (fillmode, samples_to_fake, i, c)] = 50000 + 1000 * (i%10);	/* make up some plausible data (the same volts as the float64 read) */
 		}
 	}
-	fprintf (stderr, "Dummy DAQmxReadBinaryI32 (%d, %d, %f, %d, %d), returning %d samples.\n", taskHandle, numrequested,  timeout, fillmode, size, (int)samples_to_fake);
+	dummy_eprintf ("Dummy DAQmxReadBinaryI32 (%d, %d, %f, %d, %d), returning %d samples.\n", taskHandle, numrequested,  timeout, fillmode, size, (int)samples_to_fake);
 	return (0);
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 */
 
 /* Headers */
+#define _GNU_SOURCE							/* For sched_setaffinity() (--realtime) */
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
@@ -21,12 +22,21 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <libgen.h>
+#include <pthread.h>
+#ifdef  __AVX2__							/* -march=native: use the 256-bit kernel below iff this CPU has it. */
+  #include <immintrin.h>
+#endif
 
 #ifdef  USE_DUMMY_LIBDAQMX						/* Option to compile in dummy mode, without actually using the real libnidaqm */
   #include "daqmx_dummy.c"
 #else
   #include <NIDAQmx.h>							/* NI's library. Also '-lnidaqmx' */
 #endif
+#include "ni4462_shmring.c"						/* Shared-memory ring (-M). Also '-lrt' */
+#include "ni4462_readsched.c"						/* Read scheduler */
+#include "ni4462_realtime.c"						/* Real-time profile (--realtime) */
+#include "ni4462_fmt.c"							/* Fast ASCII formatting of the data values */
+#include "ni4462_codec.c"						/* Compressed stream of the int32 codes (-o compressed) */
 
 #define LIBDAQMX_TMPDIR		"/tmp/natinst/"				/* Temp dir for NI's lock files. We clean this up below. Caution. */
 #ifndef OnboardClock							/* Bugfix: defined in docs, not in header */
@@ -49,7 +59,8 @@
 #define RTSI6				"RTSI6"				/* Sample clock connection to Pulseblaster */
 
 /* CONFIGURATION CHOICES. */						/* (Experiment with ni4462_test.c, if desired, then set here. */
-#define INPUT_CHANNELS			"ai0:3"				/* All channels. Options: ai0, ai1, ai2, ai3, ai0:3  */
+#define DEFAULT_CHANNELS		"0,1,2,3"			/* All channels. -k: any of 0-3, comma-separated, eg "0,2". (Each may have its own -v range) */
+#define ALL_CHANNELS_HEADER		"ai0:3"				/* The '#channels:' header line for all of them, in order: as it always was, for existing parsers. */
 
 #define VOLTAGE_RANGE_0			0.316				/* Options: 0.316, 1, 3.16, 10, 31.6, 100.  x means [-x,+x]. */
 #define VOLTAGE_RANGE_1			1.0
@@ -86,10 +97,17 @@
 #define DEFAULT_GUARD_POST    	 	1				/* ... from the end ... */
 #define DEFAULT_GUARD_INTERNAL 		1				/* ... internal (between samples) for imaging modes */
 #define DEFAULT_NUM_CDSM  		10				/* Default number for CDS_Multiple. */
+#define DEFAULT_WRITER_DEPTH		4				/* Output queue depth: frames the writer thread may be behind. (0: no writer thread) ... */
+#define WRITER_MAX_BYTES		(64 * 1024 * 1024)		/* ... but by default, no more than 64 MB of payload copies: big frames get fewer slots, or none. */
 
 /* Buffer sizes */
 #define BUFFER_SIZE_TUPLES		25000				/* Max number of data tuples read at a time.  Experimentally, can  be as small as 10, performance is limited below 400; since RAM is plentiful let's say 25k. */
 #define BUFFER_SIZE			(BUFFER_SIZE_TUPLES * DEV_NUM_CH) /* Size of the data buffer for all channels (4 channels wide) */
+#define CONT_BUFFER_SECONDS		1				/* Continuous mode: DAQmx buffer holds at least 1 second of data... */
+#define CONT_BUFFER_FRAMES		4				/* ... and at least 4 frame periods. */
+#define ADC_SCALE_COEFFS		4				/* -I: the device's scaling polynomial, code to volts, has (up to) 4 coefficients */
+#define LAT_SUB_BITS			2				/* Latency histograms (-H): 2^2 = 4 buckets per octave, ie each bucket is <= 19% wide... */
+#define LAT_BUCKETS			(64 << LAT_SUB_BITS)		/* ... over the whole range of a uint64 (ns). */
 
 
 /* Macros */
@@ -113,6 +131,7 @@ int vdebugc = 0;  		/* verbosity limiting debug counter */
 int terminate_loop = 0;		/* for Ctrl-C */
 char *state = "Initialising";
 TaskHandle taskHandle = 0;
+int num_ch = DEV_NUM_CH;		/* Active channels (-k): values per tuple, as read, processed and output. Per-channel arrays use the first num_ch entries. */
 
 
 /* Show help */
@@ -125,33 +144,51 @@ void print_help(char *argv0){
 		"USAGE:  %s  [OPTIONS]  \n"
 		"   -h                print help and exit\n"
 		"   -d                debug: be much more verbose. Also, make warnings fatal.\n"
-		"   -r                dump (prefixed) raw data in output. Prefixed '#='. Guard samples are not skipped here.\n"
-		"   -a   ANALYSIS     analysis mode: Options: raw, lin_reg, cds_multiple, image, image_diff. [default: lin_reg].\n"
+		"   -r                dump (prefixed) raw data in output. Prefixed '#='. Guard samples are not skipped here (unless -S).\n"
+		"   -a   ANALYSIS     analysis mode: Options: raw, raw_stream, lin_reg, cds_multiple, image, image_diff. [default: lin_reg].\n"
 		"   -f   FREQ         sample frequency (Hz). [default: %d].\n"
+		"   -k   CHANNELS     channels (quadrants) to acquire: comma-separated, any of 0-%d, in output order. [default: %s].\n"
 		"   -v   VOLTAGE      set the voltage range (V). [-v_limit, +v_limit]. [Values: %4.2f, %4.2f, %4.2f, %4.2f; default: %4.2f].\n"
+		"                     Either one, for all channels, or one per -k channel, comma-separated (eg -k 0,2 -v 10,0.316).\n"
 		"   -n   NUM          number of samples per frame. [default: %d].\n"
 		"   -m   MAX_FRAMES   maximum number of frames. ('cont' for unlimited). [default: %d].\n"
-		"   -g   GROUPSIZE    group frames with a single trigger per group (reduces task restart-latency). [default: %d]\n"
+		"   -g   GROUPSIZE    group frames with a single trigger per group (reduces task restart-latency). ('cont' for continuous). [default: %d]\n"
 		"   -i   INTERVAL     interval between frames of a given group. (number of samples to skip). [default: %d]\n"
+		"   -j   OFFSET       continuous mode: number of samples to skip after the trigger, before the first frame. [default: 0]\n"
 		"   -x   GUARD_PRE    number of \"guard\" samples to discard from the start of the frame's data. [default: %d].\n"
 		"   -y   GUARD_POST   number to discard from the frame's end. (-x,-y,-z are counted *within* -n NUM). [default: %d].\n"
 		"   -z   GUARD_INT    number of internal guard samples, between each pixel, in the imaging modes. [default: %d].\n"
 		"   -c   NUM_CDS      cds_multiple: number of samples to use for averaging in each side of the CDS_m. [default: %d].\n"
+		"   -o   FORMAT       output format: ascii, binary (float64 payload), binary32 (float32 payload), compressed (raw, raw_stream with -I). [default: ascii].\n"
 		"   -p   PIXELS       image/image_diff: number of pixels (per quadrant). [used as a check on -n,-x,-y,-z].\n"  /* -p is redundant. but required to ensure the operator really understands the maths. */
+		"   -w   DEPTH        output queue depth: frames the writer thread may fall behind. 0 to write inline (no thread). [default: %d, but at most %d MB of frames].\n"
+		"   -W                drop frames (rather than stall the acquisition) when the output queue is full.\n"
+		"   -M   NAME         also publish the raw data and the per-frame results to the shared-memory ring NAME (eg %s). See ni4462_shmread.\n"
+		"   -I                read the raw int32 ADC codes, rather than float64 volts. Sums are exact integers, scaled to volts once per frame.\n"
+		"   -C                read channel-major (each channel contiguous, rather than interleaved tuples), for the vectorised per-channel kernels.\n"
+		"   -S                skip the guard (-x,-y) and interval (-i,-j) samples in the driver (read offset), rather than reading and discarding them.\n"
+		"   -H                record latency histograms: StartTask, StopTask, the gap between them, each read call, and the output phase.\n"
 		"   -T   TRIGFILE     When ready for first ext-trigger, delete this (pre-created) empty file. Other processes can inotifywait().\n"
+		"   --realtime[=CPU][,poll]  real-time profile: mlockall, pre-fault the buffers, pin the acquisition to CPU [default: the last], SCHED_FIFO.\n"
+		"                     With 'poll', busy-poll between reads, rather than sleep. Reports at startup which parts took effect.\n"
 		"\n"
 		"The program takes -n samples (on all channels) in each frame; -m frames in total. Of these n samples, the first -x,\n"
 		"and last -y may be considered \"guard\"-samples and are discarded, (as are internal guards -z in the imaging modes).\n"
 		"Each (ungrouped) frame is independently triggered, the program exits after -m frames (or runs continuously).\n\n"
 		"Because the %s is so slow (~ 1ms) at taskStop...taskStart, we cannot re-trigger quickly. So frames may be grouped (-g) into\n"
 		"a single task, following one another immediately (or skipping -i samples). This avoids the overhead of the task model, but\n"
-		"sacrifices the option of resynchronisation with a trigger pulse. [As the master clock is shared; dead-reckoning is ok.]\n\n"
+		"sacrifices the option of resynchronisation with a trigger pulse. [As the master clock is shared; dead-reckoning is ok.]\n"
+		"With '-g cont', there is a single, continuous task (with a start trigger, not a reference trigger), and no limit on the\n"
+		"group size: frames are sliced out of the stream by sample count, every (n+i) samples after the first -j. No dead time.\n\n"
 		"The sample-frequency and voltage-gain may also be set; overflows in the analog or digital domains are detected.\n"
 		"The analyis modes (-a) are:\n"
 		"\n"
 		"   * RAW mode        : N samples are taken in each frame, and printed. Statistics are also calculated.\n"
+		"   * RAW_STREAM mode : As raw, but the samples are output as they are read, and the statistics follow them (a trailer). So the\n"
+		"                       memory used is one read-chunk, not one frame: for frames of up to %d samples.\n"
 		"   * LIN_REG mode    : In each frame, the gradient is estimated by OLS regression.\n"
-		"   * CDS_M mode      : In each frame, the gradient is estimated by Correlated double-sampling with -c multiple reads.\n"
+		"   * CDS_M mode      : In each frame, the gradient is estimated by Correlated double-sampling with -c multiple reads (Fowler-m).\n"
+		"                       (Both are computed as the dot-product of the frame with a weight-vector, pre-calculated at startup.)\n"
 		"   * IMAGE mode      : An 'image' (of -p pixels) is sampled, discarding internal guards. See dat2cam/cam2tiff.\n"
 		"   * IMAGE_DIFF mode : The images from alternate frames are subtracted (even_frame - odd_frame) and output.\n"
 		"\n"
@@ -159,15 +196,34 @@ void print_help(char *argv0){
 		"                   HW_Trigger is gated by the %s's %s output; so the %s must be in \'reference-trigger\' mode.\n"
 		"COMPENSATION    : Triggering looks \"back in time\", compensate by setting the DelayLine to exactly %d sample-periods.\n"  /* i.e. (TRIGGER_EARLY_BY * sample_interval) */
 		"OUTPUTS         : Stdout receives headers (prefixed '#') and parseable data (tab/newline-delimited). Messages to Stderr.\n"
+		"WRITER THREAD   : Output is formatted and written by a separate thread, so a slow pipe/disk doesn't stall the acquisition (and\n"
+		"                   miss triggers), unless more than -w frames are queued. Queue statistics are printed at exit, and on SigUSR1.\n"
+		"BINARY OUTPUT   : With -o binary, stdout receives a header struct (magic 'NI4462CB'), then for each frame, a fixed record of all\n"
+		"                   the stats, followed by the raw/pixel tuples (if any). Little-endian; see struct bin_header/bin_record.\n"
+		"COMPRESSED      : With -o compressed (and -I), the ascii output is written as a lossless compressed stream: the '#' lines as text,\n"
+		"                   and the raw data as the int32 codes (predicted, and Rice-coded, in independent blocks with CRCs). 'ni4462_decode'\n"
+		"                   gives back exactly the ascii output. Typically a quarter to a half of the size of the int32 codes. See ni4462_codec.c.\n"
+		"INT32 READS     : With -I, the raw ADC codes are read (DAQmxReadBinaryI32: half the bytes of float64), and summed exactly, as\n"
+		"                   integers; the sums are scaled to volts once per frame, with the device's (linear) scaling. Output is in volts, either way.\n"
+		"CHANNEL-MAJOR   : With -C, each read returns one block per channel (DAQmx_Val_GroupByChannel), rather than tuples. The\n"
+		"                   sums then run along each channel, 4 samples per AVX2 vector. Reads stop at the frame's end (nothing carries over).\n"
+		"CHANNELS        : With -k, only those channels are read (one task, each channel with its own -v range): each tuple, and each\n"
+		"                   per-channel output field, then has one value per active channel, in -k order. The header lists them.\n"
+		"SHARED MEMORY   : With -M, every chunk of raw data (as read, including guards) and every frame's bin_record are also published\n"
+		"                   to a ring in /dev/shm, for any number of ni4462_shmread readers. It never blocks: slow readers see overruns.\n"
 		"CONTROL         : Sending Ctrl-C cleanly breaks out of the frame at its end; Ctrl-\\ terminates immediately. SigUSR1 prints state.\n"
 		"MISSED TRIGGERS : A missed-trigger is inferred if the interval between two frames varies by more than a factor than %.3g.\n"  /* Can't truly detect missed trigger pulses; consistency checking is the best we can do. */
 		"TASK OVERHEAD   : The overhead for taskStop...taskStart is checked. Warning if it exceeds %.3g ms.\n"
+		"LATENCY         : With -H, the durations are counted in log-bucketed histograms (4 per octave); the mean, p50, p99, p99.9 and max\n"
+		"                   are printed at exit, and on SigUSR1. (Percentiles are the bucket's upper bound.) Reads that blocked (eg for the trigger) are separate.\n"
+		"REALTIME        : --realtime replaces 'nice -n -20' (and 'nice yes >/dev/null' on another core). Only the acquisition thread is pinned\n"
+		"                   and SCHED_FIFO (priority %d); the writer thread isn't. mlockall and SCHED_FIFO need root (or CAP_IPC_LOCK, CAP_SYS_NICE).\n"
 		"SEE ALSO        : ni4462_test, pb_ni4462_trigger, arduino_delay, dat2cam\n"
 		"\n"
 		,argv0, DEV_NAME, INPUT_COUPLING_STR, TERMINAL_MODE_STR, TRIGGER_EDGE_STR, TRIGGER_EARLY_BY,
-		 argv0, DEFAULT_SAMPLE_HZ, VOLTAGE_RANGE_0, VOLTAGE_RANGE_1, VOLTAGE_RANGE_2, VOLTAGE_RANGE_3, DEFAULT_VOLTAGE_RANGE, DEFAULT_COUNT, DEFAULT_MAXFRAMES, DEFAULT_GROUP_SIZE, DEFAULT_GROUP_INTERVAL,
-		 DEFAULT_GUARD_PRE, DEFAULT_GUARD_POST, DEFAULT_GUARD_INTERNAL, DEFAULT_NUM_CDSM, DEV_NAME,
-		 DEV_TRIGGER_INPUT, DEV_NAME, RTSI6, DEV_NAME, TRIGGER_EARLY_BY, MISSED_TRIGGER_DETECT, SLOW_TASKLOOP_DETECT_MS);
+		 argv0, DEFAULT_SAMPLE_HZ, DEV_NUM_CH - 1, DEFAULT_CHANNELS, VOLTAGE_RANGE_0, VOLTAGE_RANGE_1, VOLTAGE_RANGE_2, VOLTAGE_RANGE_3, DEFAULT_VOLTAGE_RANGE, DEFAULT_COUNT, DEFAULT_MAXFRAMES, DEFAULT_GROUP_SIZE, DEFAULT_GROUP_INTERVAL,
+		 DEFAULT_GUARD_PRE, DEFAULT_GUARD_POST, DEFAULT_GUARD_INTERNAL, DEFAULT_NUM_CDSM, DEFAULT_WRITER_DEPTH, WRITER_MAX_BYTES / (1024 * 1024), SHM_DEFAULT_NAME, DEV_NAME, DEV_SAMPLES_MAX,
+		 DEV_TRIGGER_INPUT, DEV_NAME, RTSI6, DEV_NAME, TRIGGER_EARLY_BY, MISSED_TRIGGER_DETECT, SLOW_TASKLOOP_DETECT_MS, REALTIME_PRIORITY);
 }
 
 /* Error handling: Quit on fatal errors, Print warnings and continue. */
@@ -213,10 +269,1066 @@ double timestamp_diff (struct timeval now, struct timeval then){
 double quadrature_add2 (double a, double b){
 	return (sqrt(fabs( a*a + b*b )));
 }
-double quadrature_add4 (double a, double b, double c, double d){
-	return (sqrt(fabs( a*a + b*b +c*c + d*d)));
+double quadrature_addn (const double *v){		/* (over the active channels) */
+	int c;
+	double s = 0;
+	for (c=0; c < num_ch; c++){
+		s += v[c]*v[c];
+	}
+	return (sqrt(fabs(s)));
+}
+
+
+/* Analysis modes (-a) */
+enum mode { RAW, LINREG, CDS_M, IMAGE, IMAGE_CDS, RAW_STREAM };
+
+
+/* Running sums (per channel) for the statistics of one frame. S_wy is the dot product of the samples with the estimator's weight vector (see build_weights()). */
+struct frame_sums {
+	float64 S_y[DEV_NUM_CH], S_yy[DEV_NUM_CH], S_wy[DEV_NUM_CH];
+	float64 min[DEV_NUM_CH], max[DEV_NUM_CH];
+};
+
+/* Zero the sums at the start of a frame. */
+void frame_sums_reset (struct frame_sums *fs){
+	int c;
+	for (c=0; c < DEV_NUM_CH; c++){
+		fs->S_y[c] = fs->S_yy[c] = fs->S_wy[c] = 0;
+		fs->min[c] = 1e10; fs->max[c] = -1e10;
+	}
+}
+
+/* The sums over x, the sample's position among the num non-guard samples of a frame: S_x, S_xx, and Dx = num * S_xx - S_x^2. The same for every frame.
+ * (Sum in float64: x*x overflows an int beyond 46k samples.) */
+void x_sums (uInt64 num, float64 *S_x, float64 *S_xx, float64 *Dx){
+	uInt64  x;
+	*S_x = *S_xx = 0;
+	for (x=0; x < num; x++){
+		*S_x  += x;
+		*S_xx += (float64)x * x;
+	}
+	*Dx = num * *S_xx - *S_x * *S_x;
+}
+
+/* Linear estimators of the ramp. Because x is known in advance (it's just the sample's position in the frame), any linear estimator of the gradient or delta
+ * is a dot product of the frame's samples with a fixed weight vector, w[x]. Build that vector once, at startup, and the hot loop is then the same, whichever
+ * estimator is used. (Other linear estimators, eg GLS weights for 1/f noise, need only be added here.)
+ *    EST_OLS:    the ordinary least-squares gradient, b-hat:  w[x] = (num * x - S_x) / Dx.
+ * The CDS_m (Fowler-m) delta isn't stored this way: its weights are just (+/-)(1/m) * num/(num-m) over the first and last m samples, and 0 between, so it's
+ * fowler_delta() of the two windows' sums (which CDS_m accumulates anyway). A vector of num weights, mostly 0, would be 128 MB at 16M samples.
+ * Returns a malloc()d array of num weights, or NULL on failure. */
+enum estimator { EST_NONE, EST_OLS };
+
+float64 *build_weights (enum estimator est, uInt64 num, float64 S_x, float64 Dx){
+	uInt64  x;
+	float64 *w;
+
+	w = malloc (num * sizeof (*w));
+	if (w == NULL){
+		return NULL;
+	}
+	for (x=0; x < num; x++){
+		w[x] = (est == EST_OLS) ? (num * (float64)x - S_x) / Dx : 0;
+	}
+	return w;
+}
+
+/* The CDS_m (Fowler-m) delta: mean of the last m samples minus mean of the first m (whose sums are S_y_g2, S_y_g1), scaled up to the whole frame of num. */
+float64 fowler_delta (float64 S_y_g1, float64 S_y_g2, uInt64 num, int m){
+	return (S_y_g2 - S_y_g1) / m * ( (float64)num / (num - m) );
+}
+
+/* Layout of a chunk of data, as read. ld == 0: GroupByScanNumber, i.e. tuples of num_ch interleaved channels: sample i of channel c is data[num_ch*i + c].
+ * ld > 0: GroupByChannel (-C), i.e. channel-major: num_ch blocks of ld samples, and sample i of channel c is data[c*ld + i]. The kernels below take either. */
+#define CHUNK_AT(ld, i)		( (ld) ? (i) : (num_ch * (i)) )		/* Offset of sample (tuple) i: as a pointer into the chunk, it keeps the same ld. */
+#define CHUNK_IDX(ld, i, c)	( (ld) ? ((c)*(ld) + (i)) : (num_ch*(i) + (c)) )	/* Index of sample i of channel c. */
+
+/* Horizontal reductions of the 4 lanes of a vector (AVX2 kernels, channel-major) */
+#ifdef __AVX2__
+float64 hsum_pd (__m256d v){
+	__m128d s = _mm_add_pd (_mm256_castpd256_pd128 (v), _mm256_extractf128_pd (v, 1));
+	return _mm_cvtsd_f64 (_mm_add_sd (s, _mm_unpackhi_pd (s, s)));
+}
+float64 hmin_pd (__m256d v){
+	__m128d s = _mm_min_pd (_mm256_castpd256_pd128 (v), _mm256_extractf128_pd (v, 1));
+	return _mm_cvtsd_f64 (_mm_min_sd (s, _mm_unpackhi_pd (s, s)));
+}
+float64 hmax_pd (__m256d v){
+	__m128d s = _mm_max_pd (_mm256_castpd256_pd128 (v), _mm256_extractf128_pd (v, 1));
+	return _mm_cvtsd_f64 (_mm_max_sd (s, _mm_unpackhi_pd (s, s)));
+}
+#endif
+
+/* Accumulation kernel, one channel at a time: channel c starts at data[c*cstep], and its samples are sstep apart. Channel-major (-C): cstep = ld, sstep = stride;
+ * tuples of fewer than DEV_NUM_CH channels (-k): cstep = 1, sstep = num_ch*stride. A unit-stride channel is vectorised, 4 samples at a time. (See accumulate_sums().) */
+void accumulate_sums_cm (struct frame_sums *fs, const float64 *data, int cstep, int sstep, int count, int px, const float64 *w){
+	int     i, c;
+	const float64 *d;
+	float64 s_y, s_yy, s_wy, mn, mx;
+	for (c=0; c < num_ch; c++){
+		d  = data + (uInt64)c * cstep;
+		s_y = s_yy = s_wy = 0;  mn = fs->min[c];  mx = fs->max[c];
+		i  = 0;
+#ifdef __AVX2__
+		if (sstep == 1){
+			__m256d v, a_y = _mm256_setzero_pd(), a_yy = _mm256_setzero_pd(), a_wy = _mm256_setzero_pd();
+			__m256d a_min = _mm256_set1_pd (mn), a_max = _mm256_set1_pd (mx);
+			for (; i + 4 <= count; i += 4){
+				v     = _mm256_loadu_pd (d + i);
+				a_y   = _mm256_add_pd (a_y,  v);
+				a_yy  = _mm256_add_pd (a_yy, _mm256_mul_pd (v, v));
+				a_min = _mm256_min_pd (v, a_min);
+				a_max = _mm256_max_pd (v, a_max);
+				if (w){
+					a_wy = _mm256_add_pd (a_wy, _mm256_mul_pd (_mm256_loadu_pd (w + px + i), v));
+				}
+			}
+			s_y = hsum_pd (a_y);  s_yy = hsum_pd (a_yy);  s_wy = hsum_pd (a_wy);  mn = hmin_pd (a_min);  mx = hmax_pd (a_max);
+		}
+#endif
+		for (; i < count; i++){
+			s_y  +=  d[sstep * i];
+			s_yy +=  d[sstep * i] * d[sstep * i];
+			mn    =  (d[sstep * i] < mn) ? d[sstep * i] : mn;
+			mx    =  (d[sstep * i] > mx) ? d[sstep * i] : mx;
+			if (w){
+				s_wy += w[px + i] * d[sstep * i];
+			}
+		}
+		fs->S_y[c] += s_y;  fs->S_yy[c] += s_yy;  fs->S_wy[c] += s_wy;  fs->min[c] = mn;  fs->max[c] = mx;
+	}
+}
+
+/* Accumulation kernel: this is where the CPU goes, between triggers. Add 'count' tuples, starting at tuple 'first' of the chunk (layout ld), into the sums.
+ * The tuples are 'stride' tuples apart in data[] (1 for contiguous data; more in the imaging modes, to step over internal guards), and the first one is at x = px.
+ * If w is non-NULL, also accumulate S_wy, the dot product with the weight vector: one FMA per sample per channel. With AVX2, the 4 float64 channels exactly fill
+ * one 256-bit register, so each tuple costs one load; otherwise, fall back to the scalar loop. (Channel-major data, or a subset of the channels, goes to
+ * accumulate_sums_cm().) */
+void accumulate_sums (struct frame_sums *fs, const float64 *data, int ld, int first, int count, int stride, int px, const float64 *w){
+	int     i;
+	if (ld){
+		accumulate_sums_cm (fs, data + first, ld, stride, count, px, w);
+		return;
+	}else if (num_ch != DEV_NUM_CH){
+		accumulate_sums_cm (fs, data + num_ch * first, 1, num_ch * stride, count, px, w);
+		return;
+	}
+	data += DEV_NUM_CH * first;
+#if defined(__AVX2__) && (DEV_NUM_CH == 4)
+	__m256d v;
+	__m256d s_y  = _mm256_loadu_pd (fs->S_y),  s_yy = _mm256_loadu_pd (fs->S_yy), s_wy = _mm256_loadu_pd (fs->S_wy);
+	__m256d v_min = _mm256_loadu_pd (fs->min), v_max = _mm256_loadu_pd (fs->max);
+	for (i=0; i < count; i++){
+		v     =  _mm256_loadu_pd (data + (DEV_NUM_CH * stride * i));
+		s_y   =  _mm256_add_pd (s_y,  v);
+		s_yy  =  _mm256_add_pd (s_yy, _mm256_mul_pd (v, v));
+		v_min =  _mm256_min_pd (v, v_min);	/* (operand order matches the scalar '<' comparison) */
+		v_max =  _mm256_max_pd (v, v_max);
+		if (w){
+#ifdef __FMA__
+			s_wy = _mm256_fmadd_pd (_mm256_set1_pd (w[px + i]), v, s_wy);
+#else
+			s_wy = _mm256_add_pd (s_wy, _mm256_mul_pd (_mm256_set1_pd (w[px + i]), v));
+#endif
+		}
+	}
+	_mm256_storeu_pd (fs->S_y, s_y);   _mm256_storeu_pd (fs->S_yy, s_yy);   _mm256_storeu_pd (fs->S_wy, s_wy);
+	_mm256_storeu_pd (fs->min, v_min); _mm256_storeu_pd (fs->max, v_max);
+#else
+	int     c;
+	const float64 *d;
+	for (i=0; i < count; i++){
+		d  =  data + (DEV_NUM_CH * stride * i);
+		for (c=0; c < DEV_NUM_CH; c++){
+			fs->S_y  [c] +=  d[c];
+			fs->S_yy [c] +=  d[c] * d[c];
+			fs->min  [c]  =  (d[c] < fs->min[c]) ? d[c] : fs->min[c];
+			fs->max  [c]  =  (d[c] > fs->max[c]) ? d[c] : fs->max[c];
+		}
+		if (w){
+			for (c=0; c < DEV_NUM_CH; c++){
+				fs->S_wy [c] +=  w[px + i] * d[c];
+			}
+		}
+	}
+#endif
+}
+
+
+/* Native int32 path (-I): read the raw ADC codes with DAQmxReadBinaryI32 (half the bytes of float64, and no per-sample scaling inside the library), and keep
+ * the sums in integers: exact, however long the frame. Sum of squares: each q*q < 2^62, so accumulate it in 128 bits (two uint64s). Then scale to volts once
+ * per frame, with the device's scaling polynomial, v = c0 + c1*q, which must be linear (checked at startup): Sum(v) = n*c0 + c1*Sum(q), and so on. S_wy stays
+ * float64 (the weights aren't integers), as c1*Sum(w*q) + c0*Sum(w). */
+struct uint128 {
+	uint64_t lo, hi;
+};
+struct frame_sums_i {
+	int64   S_y[DEV_NUM_CH];
+	struct  uint128 S_yy[DEV_NUM_CH];
+	float64 S_wy[DEV_NUM_CH], S_w;
+	int32   min[DEV_NUM_CH], max[DEV_NUM_CH];
+	uInt64  n;				/* Number of tuples summed */
+};
+struct adc_scale {
+	float64 c0[DEV_NUM_CH], c1[DEV_NUM_CH];	/* volts = c0 + c1 * code */
+};
+
+void frame_sums_i_reset (struct frame_sums_i *fs){
+	int c;
+	memset (fs, 0, sizeof (*fs));
+	for (c=0; c < DEV_NUM_CH; c++){
+		fs->min[c] = INT32_MAX; fs->max[c] = INT32_MIN;
+	}
 }
 
+void uint128_add (struct uint128 *a, uint64_t b){
+	a->lo += b;
+	a->hi += (a->lo < b);
+}
+
+/* Accumulation kernel, int32, one channel at a time (as accumulate_sums_cm()): the lanes are 4 samples of one channel, rather than the 4 channels of one sample. */
+void accumulate_sums_i_cm (struct frame_sums_i *fs, const int32 *data, int cstep, int sstep, int count, int px, const float64 *w){
+	int     i, c;
+	const int32 *d;
+	int64   s_y;
+	uint64_t s_yy_lo, s_yy_hi;
+	int32   mn, mx;
+	float64 s_wy;
+	for (c=0; c < num_ch; c++){
+		d  = data + (uInt64)c * cstep;
+		s_y = 0;  s_yy_lo = s_yy_hi = 0;  s_wy = 0;  mn = fs->min[c];  mx = fs->max[c];
+		i  = 0;
+#ifdef __AVX2__
+		if (sstep == 1){
+			__m128i v, a_min = _mm_set1_epi32 (mn), a_max = _mm_set1_epi32 (mx);
+			__m256i v64, sq, a_y = _mm256_setzero_si256(), a_lo = _mm256_setzero_si256(), a_hi = _mm256_setzero_si256(), mask = _mm256_set1_epi64x (0xffffffff);
+			__m256d a_wy = _mm256_setzero_pd();
+			int64   t_y[4], t_lo[4], t_hi[4];
+			int32   t_min[4], t_max[4];
+			int     k;
+			for (; i + 4 <= count; i += 4){
+				v    = _mm_loadu_si128 ((const __m128i *)(d + i));
+				v64  = _mm256_cvtepi32_epi64 (v);
+				sq   = _mm256_mul_epi32 (v64, v64);
+				a_y  = _mm256_add_epi64 (a_y, v64);
+				a_lo = _mm256_add_epi64 (a_lo, _mm256_and_si256 (sq, mask));
+				a_hi = _mm256_add_epi64 (a_hi, _mm256_srli_epi64 (sq, 32));
+				a_min = _mm_min_epi32 (a_min, v);
+				a_max = _mm_max_epi32 (a_max, v);
+				if (w){
+					a_wy = _mm256_add_pd (a_wy, _mm256_mul_pd (_mm256_loadu_pd (w + px + i), _mm256_cvtepi32_pd (v)));
+				}
+			}
+			_mm256_storeu_si256 ((__m256i *)t_y, a_y);  _mm256_storeu_si256 ((__m256i *)t_lo, a_lo);  _mm256_storeu_si256 ((__m256i *)t_hi, a_hi);
+			_mm_storeu_si128 ((__m128i *)t_min, a_min);  _mm_storeu_si128 ((__m128i *)t_max, a_max);
+			for (k=0; k < 4; k++){
+				s_y += t_y[k];  s_yy_lo += t_lo[k];  s_yy_hi += t_hi[k];
+				mn = (t_min[k] < mn) ? t_min[k] : mn;
+				mx = (t_max[k] > mx) ? t_max[k] : mx;
+			}
+			s_wy = hsum_pd (a_wy);
+		}
+#endif
+		for (; i < count; i++){
+			s_y     +=  d[sstep * i];
+			uint128_add (&fs->S_yy[c], (uint64_t)((int64)d[sstep * i] * d[sstep * i]));
+			mn       =  (d[sstep * i] < mn) ? d[sstep * i] : mn;
+			mx       =  (d[sstep * i] > mx) ? d[sstep * i] : mx;
+			if (w){
+				s_wy += w[px + i] * d[sstep * i];
+			}
+		}
+		fs->S_y[c] += s_y;  fs->S_wy[c] += s_wy;  fs->min[c] = mn;  fs->max[c] = mx;
+		uint128_add (&fs->S_yy[c], s_yy_lo);
+		uint128_add (&fs->S_yy[c], s_yy_hi << 32);
+		fs->S_yy[c].hi += s_yy_hi >> 32;
+	}
+	if (w){
+		for (i=0; i < count; i++){
+			fs->S_w += w[px + i];
+		}
+	}
+	fs->n += count;
+}
+
+/* Accumulation kernel, int32 version of accumulate_sums() (same arguments). If w is NULL, S_wy and S_w are untouched. With AVX2, widen the 4 channels to int64:
+ * the sum and the square are then exact in one register each; split each square into its high and low 32 bits, so that their sums can't overflow within a call. */
+void accumulate_sums_i (struct frame_sums_i *fs, const int32 *data, int ld, int first, int count, int stride, int px, const float64 *w){
+	int     i, c;
+	if (ld){
+		accumulate_sums_i_cm (fs, data + first, ld, stride, count, px, w);
+		return;
+	}else if (num_ch != DEV_NUM_CH){
+		accumulate_sums_i_cm (fs, data + num_ch * first, 1, num_ch * stride, count, px, w);
+		return;
+	}
+	data += DEV_NUM_CH * first;
+#if defined(__AVX2__) && (DEV_NUM_CH == 4)
+	__m128i v, v_min = _mm_loadu_si128 ((__m128i *)fs->min), v_max = _mm_loadu_si128 ((__m128i *)fs->max);
+	__m256i v64, sq, s_y = _mm256_setzero_si256(), s_yy_lo = _mm256_setzero_si256(), s_yy_hi = _mm256_setzero_si256(), mask = _mm256_set1_epi64x (0xffffffff);
+	__m256d s_wy = _mm256_loadu_pd (fs->S_wy);
+	int64   t_y[DEV_NUM_CH], t_lo[DEV_NUM_CH], t_hi[DEV_NUM_CH];
+	for (i=0; i < count; i++){
+		v       = _mm_loadu_si128 ((const __m128i *)(data + (DEV_NUM_CH * stride * i)));
+		v64     = _mm256_cvtepi32_epi64 (v);
+		sq      = _mm256_mul_epi32 (v64, v64);
+		s_y     = _mm256_add_epi64 (s_y, v64);
+		s_yy_lo = _mm256_add_epi64 (s_yy_lo, _mm256_and_si256 (sq, mask));
+		s_yy_hi = _mm256_add_epi64 (s_yy_hi, _mm256_srli_epi64 (sq, 32));
+		v_min   = _mm_min_epi32 (v_min, v);
+		v_max   = _mm_max_epi32 (v_max, v);
+		if (w){
+#ifdef __FMA__
+			s_wy = _mm256_fmadd_pd (_mm256_set1_pd (w[px + i]), _mm256_cvtepi32_pd (v), s_wy);
+#else
+			s_wy = _mm256_add_pd (s_wy, _mm256_mul_pd (_mm256_set1_pd (w[px + i]), _mm256_cvtepi32_pd (v)));
+#endif
+			fs->S_w += w[px + i];
+		}
+	}
+	_mm256_storeu_si256 ((__m256i *)t_y, s_y);  _mm256_storeu_si256 ((__m256i *)t_lo, s_yy_lo);  _mm256_storeu_si256 ((__m256i *)t_hi, s_yy_hi);
+	_mm_storeu_si128 ((__m128i *)fs->min, v_min);  _mm_storeu_si128 ((__m128i *)fs->max, v_max);  _mm256_storeu_pd (fs->S_wy, s_wy);
+	for (c=0; c < DEV_NUM_CH; c++){
+		fs->S_y[c] += t_y[c];
+		uint128_add (&fs->S_yy[c], t_lo[c]);
+		uint128_add (&fs->S_yy[c], (uint64_t)t_hi[c] << 32);
+		fs->S_yy[c].hi += (uint64_t)t_hi[c] >> 32;
+	}
+#else
+	const int32 *d;
+	for (i=0; i < count; i++){
+		d  =  data + (DEV_NUM_CH * stride * i);
+		for (c=0; c < DEV_NUM_CH; c++){
+			fs->S_y  [c] +=  d[c];
+			uint128_add (&fs->S_yy[c], (uint64_t)((int64)d[c] * d[c]));
+			fs->min  [c]  =  (d[c] < fs->min[c]) ? d[c] : fs->min[c];
+			fs->max  [c]  =  (d[c] > fs->max[c]) ? d[c] : fs->max[c];
+		}
+		if (w){
+			for (c=0; c < DEV_NUM_CH; c++){
+				fs->S_wy [c] +=  w[px + i] * d[c];
+			}
+			fs->S_w += w[px + i];
+		}
+	}
+#endif
+	fs->n += count;
+}
+
+/* Scale the integer sums to volts, into the float64 sums (so the statistics are then the same, whichever path). */
+void frame_sums_scale (const struct frame_sums_i *fi, const struct adc_scale *sc, struct frame_sums *fs){
+	float64 c0, c1, S_yy;
+	int     c;
+	for (c=0; c < num_ch; c++){
+		c0 = sc->c0[c];  c1 = sc->c1[c];
+		S_yy = ldexp ((float64)fi->S_yy[c].hi, 64) + (float64)fi->S_yy[c].lo;
+		fs->S_y [c] = fi->n * c0 + c1 * fi->S_y[c];
+		fs->S_yy[c] = fi->n * c0 * c0 + 2 * c0 * c1 * fi->S_y[c] + c1 * c1 * S_yy;
+		fs->S_wy[c] = c0 * fi->S_w + c1 * fi->S_wy[c];
+		fs->min [c] = c0 + c1 * ( (c1 >= 0) ? fi->min[c] : fi->max[c] );	/* (A negative gain swaps them) */
+		fs->max [c] = c0 + c1 * ( (c1 >= 0) ? fi->max[c] : fi->min[c] );
+	}
+}
+
+/* Get tuple i of a chunk (layout ld), in volts: from the codes in data_i (-I) if non-NULL, scaled with sc, else from data. */
+void chunk_tuple (const float64 *data, const int32 *data_i, int ld, int i, const struct adc_scale *sc, float64 *v){
+	int c;
+	for (c=0; c < num_ch; c++){
+		v[c] = data_i ? ( sc->c0[c] + sc->c1[c] * data_i[CHUNK_IDX (ld, i, c)] ) : data[CHUNK_IDX (ld, i, c)];
+	}
+}
+
+
+/* Intersect a chunk of data, samples [n_this, n_this + count) of the frame, with the span [start, end) of the frame. If they overlap, set [*lo, *hi) to
+ * the overlap, as indices into the chunk, and return 1. The capture loop uses this to split each chunk into spans, instead of testing every sample. */
+int chunk_span (uInt64 n_this, int count, uInt64 start, uInt64 end, int *lo, int *hi){
+	int64 l = (int64)start - (int64)n_this, h = (int64)end - (int64)n_this;
+	*lo = (l < 0) ? 0 : ( (l > count) ? count : (int)l );
+	*hi = (h < 0) ? 0 : ( (h > count) ? count : (int)h );
+	return (*hi > *lo);
+}
+
+/* CDS kernel: add 'count' contiguous tuples, from tuple 'first' of the chunk (layout ld), into the sum and sum-of-squares for one CDS group. */
+void accumulate_cds (float64 *S_y_g, float64 *S_yy_g, const float64 *data, int ld, int first, int count){
+	int i, c;
+	for (c=0; c < num_ch; c++){
+		for (i=first; i < first + count; i++){
+			S_y_g [c] += data [CHUNK_IDX (ld, i, c)];
+			S_yy_g[c] += data [CHUNK_IDX (ld, i, c)] * data [CHUNK_IDX (ld, i, c)];
+		}
+	}
+}
+
+/* CDS kernel, int32 version: sums into fs (just S_y, S_yy and n). Scale with frame_sums_scale(). */
+void accumulate_cds_i (struct frame_sums_i *fs, const int32 *data, int ld, int first, int count){
+	int i, c;
+	for (c=0; c < num_ch; c++){
+		for (i=first; i < first + count; i++){
+			fs->S_y[c] += data [CHUNK_IDX (ld, i, c)];
+			uint128_add (&fs->S_yy[c], (uint64_t)((int64)data [CHUNK_IDX (ld, i, c)] * data [CHUNK_IDX (ld, i, c)]));
+		}
+	}
+	fs->n += count;
+}
+
+/* Copy kernel: de-interleave 'count' tuples, from tuple 'first' of the chunk (layout ld), 'stride' tuples apart, into dest[c][px ... px+count-1]. (Raw and pixel
+ * arrays). Channel-major data is already de-interleaved: contiguous (stride 1) spans are just a memcpy() per channel. */
+void copy_tuples (float64 **dest, int px, const float64 *data, int ld, int first, int count, int stride){
+	int i, c;
+	for (c=0; c < num_ch; c++){
+		if (ld && (stride == 1)){
+			memcpy (dest[c] + px, data + CHUNK_IDX (ld, first, c), count * sizeof (float64));
+			continue;
+		}
+		for (i=0; i < count; i++){
+			dest[c][px+i] = data [CHUNK_IDX (ld, first + stride * i, c)];
+		}
+	}
+}
+
+
+/* Copy kernel, int32 version: as copy_tuples(), scaling the codes to volts. */
+void copy_tuples_i (float64 **dest, int px, const int32 *data, int ld, int first, int count, int stride, const struct adc_scale *sc){
+	int i, c;
+	for (c=0; c < num_ch; c++){
+		for (i=0; i < count; i++){
+			dest[c][px+i] = sc->c0[c] + sc->c1[c] * data [CHUNK_IDX (ld, first + stride * i, c)];
+		}
+	}
+}
+
+/* Interleave a channel-major chunk (count samples, layout ld) into tuples, at dest: for the shared-memory ring, whose messages are always tuples. */
+void interleave_tuples (void *dest, const void *src, int ld, int count, size_t size){
+	int i, c;
+	for (c=0; c < num_ch; c++){
+		for (i=0; i < count; i++){
+			if (size == sizeof (float64)){
+				((float64 *)dest)[num_ch*i + c] = ((const float64 *)src)[CHUNK_IDX (ld, i, c)];
+			}else{
+				((int32 *)dest)[num_ch*i + c] = ((const int32 *)src)[CHUNK_IDX (ld, i, c)];
+			}
+		}
+	}
+}
+
+
+/* Binary output (-o binary, -o binary32). Instead of the '#' header lines, write one struct bin_header; then, for each frame that would have been output, one
+ * struct bin_record, followed by its payload (if any): payload_rows tuples of num_channels values (raw data, or pixels), as float64 or float32. Both structs are
+ * fixed-layout (no padding), little-endian, and start with their own size, so a reader can check them, and later versions can append fields. The record's
+ * per-channel arrays are always DEV_NUM_CH long: entry k is for the channel channels[k], and entries from num_channels on are zero.
+ * (Version 2 appended channels, voltages and gains to the header: with -k, the tuples' values are the active channels, in that order.) */
+#define BIN_MAGIC		"NI4462CB"					/* 8 bytes, no NUL */
+#define BIN_VERSION		2
+
+struct bin_header {
+	char    magic[8];			/* BIN_MAGIC */
+	uInt32  version;			/* BIN_VERSION */
+	uInt32  header_size;			/* sizeof (struct bin_header) */
+	uInt32  record_size;			/* sizeof (struct bin_record) */
+	uInt32  payload_rows;			/* Number of tuples following each record: 0 (lin_reg, cds_multiple), samples (raw) or pixels (image, image_diff). */
+						/* raw_stream: samples, but they *precede* their record (which is then a trailer). */
+	uInt32  payload_bytes;			/* Size of each payload value: 8 (float64) or 4 (float32) */
+	uInt32  num_channels;			/* Active channels (-k), i.e. values per tuple. [DEV_NUM_CH, by default] */
+	uInt32  mode;				/* 0: raw, 1: lin_reg, 2: cds_multiple, 3: image, 4: image_diff, 5: raw_stream. (Same as mode_name) */
+	int32   num_frames, group_size, group_interval, guard_pre, guard_post, guard_internal, num_pixels, num_cdsm, trigger_compensation;
+	uInt64  samples_per_frame;
+	float64 freq_hz, interval_s, voltage, gain;
+	char    mode_name[16];			/* NUL-terminated */
+	uInt32  channels[DEV_NUM_CH];		/* (v2) The physical channel (0-3) of each value in the tuple; the first num_channels are used. */
+	float64 voltages[DEV_NUM_CH], gains[DEV_NUM_CH];	/* (v2) Each one's range (the coerced minimum, as 'voltage') and gain. */
+};
+
+struct bin_record {
+	int32   frame, overload, missed_trigger, n;	/* n is the number of samples (or pixels) in the stats */
+	float64 endtime;
+	float64 b_Dx[DEV_NUM_CH], a[DEV_NUM_CH], b[DEV_NUM_CH], s[DEV_NUM_CH], se_a[DEV_NUM_CH], se_b[DEV_NUM_CH], r[DEV_NUM_CH];	/* lin_reg */
+	float64 D_cds[DEV_NUM_CH], se_b_cds[DEV_NUM_CH];								/* cds_multiple */
+	float64 mean[DEV_NUM_CH], stdev[DEV_NUM_CH], min[DEV_NUM_CH], max[DEV_NUM_CH];					/* all modes */
+};
+
+/* Write the payload: 'rows' tuples from the per-channel arrays src[c] (minus sub[c], if sub is non-NULL, for image_diff), re-interleaved, as float64 or
+ * float32 (payload_bytes). Convert in chunks, so one fwrite() covers many tuples. Return 0 on success. */
+int write_payload (FILE *f, float64 **src, float64 **sub, int rows, int payload_bytes){
+	static float64 buf64[BUFFER_SIZE];
+	static float32 buf32[BUFFER_SIZE];
+	int i, c, j, len;
+	for (j=0; j < rows; j += BUFFER_SIZE_TUPLES){
+		len = (rows - j < BUFFER_SIZE_TUPLES) ? (rows - j) : BUFFER_SIZE_TUPLES;
+		for (i=0; i < len; i++){
+			for (c=0; c < num_ch; c++){
+				buf64[num_ch*i + c] = sub ? (src[c][j+i] - sub[c][j+i]) : src[c][j+i];
+			}
+		}
+		if (payload_bytes == sizeof (float32)){
+			for (i=0; i < num_ch * len; i++){
+				buf32[i] = buf64[i];
+			}
+			if (fwrite (buf32, sizeof (float32) * num_ch, len, f) != (size_t)len){
+				return -1;
+			}
+		}else if (fwrite (buf64, sizeof (float64) * num_ch, len, f) != (size_t)len){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* Output of one frame: its results, and its payload (raw data or pixels), payload[c][0 ... rows-1], minus sub[c][] if sub is non-NULL. */
+/* raw_stream: either a chunk of the frame's data (chunk is set, and there are 'rows' tuples in payload[]), or the frame's results, with no payload. */
+struct out_slot {
+	struct  bin_record rec;
+	float64 *payload[DEV_NUM_CH], **sub;
+	float64 *own[DEV_NUM_CH];		/* The slot's own buffers (with a writer thread, or for raw_stream), else NULL. */
+	int     chunk, rows;
+};
+
+/* Lock-free single-producer, single-consumer ring of slot pointers. Only the producer writes head, and only the consumer writes tail; each index is published
+ * with a release store and read with an acquire load, so the slot it covers is visible to the other thread. Holds up to size-1 items. */
+struct spsc_ring {
+	struct  out_slot **item;
+	unsigned size;
+	unsigned head __attribute__ ((aligned (64)));	/* (separate cache lines: the two threads don't contend) */
+	unsigned tail __attribute__ ((aligned (64)));
+};
+
+int ring_push (struct spsc_ring *q, struct out_slot *slot){
+	unsigned h = q->head, t = __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+	if ( (h + 1) % q->size == t){
+		return 0;	/* full */
+	}
+	q->item[h] = slot;
+	__atomic_store_n (&q->head, (h + 1) % q->size, __ATOMIC_RELEASE);
+	return 1;
+}
+
+struct out_slot *ring_pop (struct spsc_ring *q){
+	struct  out_slot *slot;
+	unsigned t = q->tail, h = __atomic_load_n (&q->head, __ATOMIC_ACQUIRE);
+	if (t == h){
+		return NULL;	/* empty */
+	}
+	slot = q->item[t];
+	__atomic_store_n (&q->tail, (t + 1) % q->size, __ATOMIC_RELEASE);
+	return slot;
+}
+
+unsigned ring_count (struct spsc_ring *q){
+	return ( __atomic_load_n (&q->head, __ATOMIC_ACQUIRE) + q->size - __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE) ) % q->size;
+}
+
+/* The output: where and how to write frames, and (if depth > 0) the writer thread. The acquisition thread takes an empty slot, fills it, and queues it on 'full';
+ * the writer thread writes it out, and returns it on 'empty'. So the acquisition loop never waits for stdio, unless all 'depth' slots are in use: then it either
+ * blocks until one is free, or (with drop) discards the frame. */
+struct output {
+	FILE   *f;
+	enum    mode mode;
+	int     payload_bytes;			/* 0 for ascii; else binary, and the size of each payload value. */
+	int     rows;				/* Payload tuples per frame. (raw_stream: the most per chunk) */
+	int     stream;				/* raw_stream: the data goes out in chunks as it's read, then each frame's record, as a trailer. */
+	int     depth, drop;			/* Queue depth (0: no thread, write inline); drop frames rather than block, if the queue is full? */
+	struct  out_slot *slots;
+	struct  spsc_ring full, empty;
+	pthread_t thread;
+	pthread_mutex_t lock;			/* Only for sleeping: the writer waits on 'work' while full is empty, a blocked acquisition thread on 'room'. */
+	pthread_cond_t  work, room;
+	int     done;
+	unsigned long written, dropped, blocked;
+	unsigned max_queued;
+	struct  fmtbuf *fb;			/* ascii: the data rows' text, one frame (or chunk) at a time. (Only the writer uses it) */
+	struct  codec *z;			/* -o compressed: the stream, or NULL. The payloads are then codes, not volts. */
+	FILE   *zf;				/* ... and the '#' lines go to zf (a memory stream), then into the stream, as text */
+	char   *ztext;
+	size_t  zsize;
+};
+
+/* Ascii output: print the active channels' values v[c], each times k1, then k2, in format fmt, separated by sep. */
+void print_vals (FILE *outfile, const char *sep, const char *fmt, const float64 *v, float64 k1, float64 k2){
+	int c;
+	for (c=0; c < num_ch; c++){
+		outprintf ("%s", c ? sep : "");
+		outprintf (fmt, v[c] * k1 * k2);
+	}
+}
+
+/* Their sum. */
+float64 sum_vals (const float64 *v){
+	int c;
+	float64 s = 0;
+	for (c=0; c < num_ch; c++){
+		s += v[c];
+	}
+	return s;
+}
+
+/* Ascii output: print row i of the per-channel arrays p[c] (minus q[c], if q is non-NULL), one tab-separated column per channel ("%.9f"), into fb. */
+void print_row (struct fmtbuf *fb, float64 **p, float64 **q, int i){
+	int c;
+	for (c=0; c < num_ch; c++){
+		fmt_f (fb, q ? (p[c][i] - q[c][i]) : p[c][i], 9, (c < num_ch - 1) ? '\t' : '\n');
+	}
+}
+
+/* Compressed output: append 'rows' tuples from the per-channel arrays src[c] (the codes, as float64), re-interleaved, to the stream. Return 0 on success. */
+int write_codes (struct codec *z, float64 **src, int rows){
+	static int32 buf[BUFFER_SIZE];
+	int i, c, j, len;
+	for (j=0; j < rows; j += BUFFER_SIZE_TUPLES){
+		len = (rows - j < BUFFER_SIZE_TUPLES) ? (rows - j) : BUFFER_SIZE_TUPLES;
+		for (i=0; i < len; i++){
+			for (c=0; c < num_ch; c++){
+				buf[num_ch*i + c] = src[c][j+i];
+			}
+		}
+		if (codec_put (z, buf, len, num_ch, 1)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Compressed output: move the '#' lines written so far (to o->zf) into the stream, as text. */
+void output_text (struct output *o){
+	long n;
+	fflush (o->zf);
+	if ( (n = ftell (o->zf)) > 0){
+		if (codec_text (o->z, o->ztext, n)){
+			feprintf ("Fatal error: couldn't write output: %s\n", strerror(errno));
+		}
+		fseek (o->zf, 0, SEEK_SET);
+	}
+}
+
+/* Write one frame's output, ascii or binary, according to the mode. */
+void output_frame (struct output *o, struct out_slot *slot){
+	int     i;
+	FILE   *outfile = o->z ? o->zf : o->f;		/* for outprintf() */
+	const struct bin_record *r = &slot->rec;
+	float64 **p = slot->payload, **q = slot->sub;
+	int     n = r->n;
+
+	if (slot->chunk){		/* raw_stream: a chunk of data. (Its frame's record comes after the last one) */
+		if (o->payload_bytes){
+			if (write_payload (outfile, p, NULL, slot->rows, o->payload_bytes)){
+				feprintf ("Fatal error: couldn't write output for frame %d: %s\n", r->frame, strerror(errno));
+			}
+		}else if (o->z){
+			if (write_codes (o->z, p, slot->rows)){
+				feprintf ("Fatal error: couldn't write output for frame %d: %s\n", r->frame, strerror(errno));
+			}
+		}else{
+			for (i=0 ; i < slot->rows; i++){
+				print_row (o->fb, p, NULL, i);
+			}
+			fmt_flush (o->fb);
+		}
+
+	}else if (o->payload_bytes){	/* Binary output, all modes: the record, then the raw data or pixels. */
+		if ( (fwrite (r, sizeof (*r), 1, outfile) != 1) || (o->rows && !o->stream && write_payload (outfile, p, q, o->rows, o->payload_bytes)) ){
+			feprintf ("Fatal error: couldn't write output for frame %d: %s\n", r->frame, strerror(errno));
+		}
+
+	}else if (o->mode == LINREG){  	/* Linear regression mode */
+
+		/* Human-readable summary. NB: Error_uV is the error in the estimate of Delta_uV. */
+		outprintf ("#Frame: %4d; Endtime: %.9f; Delta_uV: ", r->frame, r->endtime);
+		print_vals (outfile, ", ", "% f", r->b_Dx, 1e6, 1);
+		outprintf ("; Error_uV: ");
+		print_vals (outfile, ", ", "% f", r->se_b, n, 1e6);
+		outprintf ("; Total_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n", sum_vals (r->b_Dx)*1e6, quadrature_addn (r->se_b) *n*1e6, (r->overload?"OVL":"OK"), (r->missed_trigger?"MISS":"OK"));
+
+		/* Parseable data: all one line, tab-separated. Also, see above where this is documented. Consider %g instead? */
+		const float64 *cols_lr[] = { r->b_Dx, r->a, r->b, r->s, r->se_a, r->se_b, r->r, r->min, r->max };	/* (Each has a column per channel) */
+		outprintf ("%d\t%f\t%d\t%d", r->frame, r->endtime, r->overload, r->missed_trigger);
+		for (i=0; i < (int)(sizeof (cols_lr) / sizeof (cols_lr[0])); i++){
+			outprintf ("\t");
+			print_vals (outfile, "\t", "%.9f", cols_lr[i], 1, 1);
+		}
+		outprintf ("\n");
+
+	}else if (o->mode == CDS_M){	/* Correlated double sampling, with multiple, averaged reads */
+
+		/* Human-readable summary */
+		outprintf ("#Frame: %4d; Endtime: %.9f; Delta_uV: ", r->frame, r->endtime);
+		print_vals (outfile, ", ", "% f", r->D_cds, 1e6, 1);
+		outprintf ("; Error_uV: ");
+		print_vals (outfile, ", ", "% f", r->se_b_cds, n, 1e6);
+		outprintf ("; Total_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n", sum_vals (r->D_cds)*1e6, quadrature_addn (r->se_b_cds) *n*1e6, (r->overload?"OVL":"OK"), (r->missed_trigger?"MISS":"OK"));
+
+		/* Parseable data. */
+		const float64 *cols_cds[] = { r->D_cds, r->se_b_cds, r->min, r->max };
+		outprintf ("%d\t%f\t%d\t%d", r->frame, r->endtime, r->overload, r->missed_trigger);
+		for (i=0; i < (int)(sizeof (cols_cds) / sizeof (cols_cds[0])); i++){
+			outprintf ("\t");
+			print_vals (outfile, "\t", "%.9f", cols_cds[i], 1, 1);
+		}
+		outprintf ("\n");
+
+	}else{				/* Raw, raw_stream, image and image_diff modes. */
+
+		/* Human-readable summary: mean/stdev rather than linreg. FIXME: is this really the most useful info for images? NB in image_diff mode, the means and stdDevs are for the 2nd frame, not the differences! */
+		outprintf ("#Frame: %4d; Endtime: %.9f; Means_uV: ", r->frame, r->endtime);
+		print_vals (outfile, ", ", "% f", r->mean, 1e6, 1);
+		outprintf ("; StdDev_uV: ");
+		print_vals (outfile, ", ", "% f", r->stdev, 1e6, 1);
+		outprintf ("; Overall_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n", sum_vals (r->mean)*1e6, quadrature_addn (r->stdev)*1e6, (r->overload?"OVL":"OK"), (r->missed_trigger?"MISS":"OK"));
+
+		/* Parseable data: the raw data (excluding the start/end guard samples), or the pixels, or (image_diff) frame_n - frame_n-1, where n is even. In the regular column format (one per channel) for eg fftplot */
+		if (o->z && o->rows && !o->stream){		/* (raw: the summary line, then the codes) */
+			output_text (o);
+			if (write_codes (o->z, p, o->rows)){
+				feprintf ("Fatal error: couldn't write output for frame %d: %s\n", r->frame, strerror(errno));
+			}
+		}
+		for (i=0 ; (i < o->rows) && !o->stream && !o->z; i++){
+			print_row (o->fb, p, q, i);
+		}
+		fmt_flush (o->fb);
+	}
+	if (o->z){
+		output_text (o);
+	}
+}
+
+/* Writer thread: write out the queued frames, in order, and return their slots. Sleep while the queue is empty; exit once done and drained. */
+void *writer_thread (void *arg){
+	struct  output *o = arg;
+	struct  out_slot *slot;
+	while (1){
+		if ( (slot = ring_pop (&o->full)) == NULL){
+			fflush (o->f);
+			pthread_mutex_lock (&o->lock);		/* (re-check under the lock: the producer queues, and sets done, holding it, so no wakeup is missed) */
+			while ( ( (slot = ring_pop (&o->full)) == NULL) && !o->done){
+				pthread_cond_wait (&o->work, &o->lock);
+			}
+			pthread_mutex_unlock (&o->lock);
+			if (slot == NULL){
+				break;
+			}
+		}
+		output_frame (o, slot);
+		__atomic_add_fetch (&o->written, 1, __ATOMIC_RELAXED);
+		pthread_mutex_lock (&o->lock);
+		ring_push (&o->empty, slot);
+		pthread_cond_signal (&o->room);
+		pthread_mutex_unlock (&o->lock);
+	}
+	fflush (o->f);
+	return NULL;
+}
+
+/* Set up the output. With a writer thread, allocate depth slots, each with its own payload buffers, all initially on the empty ring. */
+void output_start (struct output *o){
+	int i, c;
+	o->slots = calloc ( (o->depth ? o->depth : 1), sizeof (*o->slots));
+	if (o->slots == NULL){
+		feprintf ("Fatal error: couldn't malloc() output slots.\n");
+	}
+	o->written = o->dropped = o->blocked = o->max_queued = o->done = 0;
+	o->fb = NULL;
+	if (o->payload_bytes == 0){		/* ascii */
+		if ( (o->fb = malloc (sizeof (*o->fb))) == NULL){
+			feprintf ("Fatal error: couldn't malloc() output text buffer.\n");
+		}
+		fmt_init (o->fb, o->f);
+	}
+	if (o->z){				/* The header's '#' lines */
+		output_text (o);
+	}
+	if (o->depth == 0){
+		for (c=0; (c < num_ch) && o->stream; c++){	/* raw_stream, inline: the one slot still needs a buffer for the chunks. */
+			o->slots[0].own[c] = o->slots[0].payload[c] = malloc (o->rows * sizeof (float64));
+			if (o->slots[0].own[c] == NULL){
+				feprintf ("Fatal error: couldn't malloc() output buffer.\n");
+			}
+		}
+		return;
+	}
+	o->full.size  = o->empty.size = o->depth + 1;
+	o->full.head  = o->full.tail  = o->empty.head = o->empty.tail = 0;
+	o->full.item  = malloc (o->full.size  * sizeof (*o->full.item));
+	o->empty.item = malloc (o->empty.size * sizeof (*o->empty.item));
+	if ( (o->full.item == NULL) || (o->empty.item == NULL) ){
+		feprintf ("Fatal error: couldn't malloc() output queues.\n");
+	}
+	pthread_mutex_init (&o->lock, NULL);
+	pthread_cond_init (&o->work, NULL);
+	pthread_cond_init (&o->room, NULL);
+	for (i=0; i < o->depth; i++){
+		for (c=0; (c < num_ch) && o->rows; c++){
+			o->slots[i].own[c] = o->slots[i].payload[c] = malloc (o->rows * sizeof (float64));
+			if (o->slots[i].own[c] == NULL){
+				feprintf ("Fatal error: couldn't malloc() enough for %d output slots of %d quads (-w %d).\n", o->depth, o->rows, o->depth);
+			}
+		}
+		ring_push (&o->empty, &o->slots[i]);
+	}
+	if (pthread_create (&o->thread, NULL, writer_thread, o)){
+		feprintf ("Fatal error: couldn't create writer thread.\n");
+	}
+}
+
+/* Get a slot for the next frame's output. Inline, there's only one. Otherwise take an empty one: if there are none, either block until the writer thread
+ * returns one, or (drop) return NULL, and the frame isn't output. */
+struct out_slot *output_get_slot (struct output *o){
+	struct  out_slot *slot;
+	if (o->depth == 0){
+		return o->slots;
+	}
+	if ( (slot = ring_pop (&o->empty)) ){
+		return slot;
+	}
+	if (o->drop){
+		o->dropped++;
+		return NULL;
+	}
+	o->blocked++;
+	pthread_mutex_lock (&o->lock);
+	while ( (slot = ring_pop (&o->empty)) == NULL){
+		pthread_cond_wait (&o->room, &o->lock);
+	}
+	pthread_mutex_unlock (&o->lock);
+	return slot;
+}
+
+/* Hand a filled slot to the writer thread (or, inline, write it now). The queue can't be full: it has room for every slot. */
+void output_put_slot (struct output *o, struct out_slot *slot){
+	unsigned queued;
+	if (o->depth == 0){
+		output_frame (o, slot);
+		o->written++;
+		return;
+	}
+	pthread_mutex_lock (&o->lock);
+	ring_push (&o->full, slot);
+	pthread_cond_signal (&o->work);
+	pthread_mutex_unlock (&o->lock);
+	queued = ring_count (&o->full);
+	o->max_queued = (queued > o->max_queued) ? queued : o->max_queued;
+}
+
+/* Print the queue statistics. (Also from the SIGUSR1 handler.) */
+void output_report (struct output *o){
+	if (o->depth == 0){
+		eprintf ("Output: inline (no writer thread); frames written: %lu.\n", o->written);
+	}else{
+		eprintf ("Output: writer queue: %u/%d now, max %u; frames written: %lu, dropped (queue full): %lu, blocked (queue full): %lu.\n",
+			ring_count (&o->full), o->depth, o->max_queued, __atomic_load_n (&o->written, __ATOMIC_RELAXED), o->dropped, o->blocked);
+	}
+}
+
+/* Drain the queue, stop the writer thread and report. */
+void output_finish (struct output *o){
+	int i, c;
+	if (o->depth){
+		pthread_mutex_lock (&o->lock);
+		o->done = 1;
+		pthread_cond_signal (&o->work);
+		pthread_mutex_unlock (&o->lock);
+		pthread_join (o->thread, NULL);
+		pthread_mutex_destroy (&o->lock);
+		pthread_cond_destroy (&o->work);
+		pthread_cond_destroy (&o->room);
+		free (o->full.item);
+		free (o->empty.item);
+	}
+	for (i=0; i < (o->depth ? o->depth : 1); i++){
+		for (c=0; c < DEV_NUM_CH; c++){
+			free (o->slots[i].own[c]);
+		}
+	}
+	output_report (o);
+	free (o->slots);
+	free (o->fb);
+	if (o->z){
+		if (codec_finish (o->z)){
+			feprintf ("Fatal error: couldn't write output: %s\n", strerror(errno));
+		}
+		deprintf ("Compressed output: %llu bytes, for %llu samples (%.2f bits/sample).\n", (unsigned long long)o->z->written, (unsigned long long)o->z->tuples,
+			o->z->tuples ? (8.0 * o->z->written / (o->z->tuples * num_ch)) : 0.0);
+		fclose (o->zf);
+		free (o->ztext);
+	}
+}
+
+
+/* Latency histograms (-H). Every StartTask, StopTask, read call and output phase is timed, and counted into a log-bucketed histogram, so that we can see */
+/* the tail latency (not just whether one StopTask...StartTask gap exceeded SLOW_TASKLOOP_DETECT_MS). Percentiles are printed at exit, and on SigUSR1. */
+enum lat_phase { LAT_START, LAT_STOP, LAT_STOPSTART, LAT_READ, LAT_READ_WAIT, LAT_OUTPUT, LAT_NUM };
+struct lat_hist {
+	const char *name;
+	uint64_t count, total_ns, max_ns;
+	uint64_t bucket[LAT_BUCKETS];
+};
+int lat_enabled = 0;
+struct lat_hist lat[LAT_NUM] = {
+	[LAT_START] = { .name = "StartTask" },		[LAT_STOP] = { .name = "StopTask" },		[LAT_STOPSTART] = { .name = "StopTask...StartTask" },
+	[LAT_READ] = { .name = "Read" },		[LAT_READ_WAIT] = { .name = "Read (blocked)" },	[LAT_OUTPUT] = { .name = "Output phase" },
+};
+
+/* Bucket for ns: values < 2^LAT_SUB_BITS have their own; above that, the octave (msb), then the next LAT_SUB_BITS bits. */
+int lat_bucket (uint64_t ns){
+	int msb;
+	if (ns < (1 << LAT_SUB_BITS)){
+		return ns;
+	}
+	msb = 63 - __builtin_clzll (ns);
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + ((ns >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/* Upper bound of bucket b (exclusive) */
+uint64_t lat_bucket_max (int b){
+	int msb = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	if (b < (1 << LAT_SUB_BITS)){
+		return b + 1;
+	}
+	return (uint64_t)((1 << LAT_SUB_BITS) + (b & ((1 << LAT_SUB_BITS) - 1)) + 1) << (msb - LAT_SUB_BITS);
+}
+
+/* Timestamp (ns), for lat_record(). 0 if -H isn't on, to save the clock_gettime(). */
+uint64_t lat_start(){
+	struct timespec ts;
+	if (!lat_enabled){
+		return 0;
+	}
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Count a duration (ns) */
+void lat_add (enum lat_phase p, uint64_t ns){
+	lat[p].count++;
+	lat[p].total_ns += ns;
+	lat[p].max_ns = (ns > lat[p].max_ns) ? ns : lat[p].max_ns;
+	lat[p].bucket[lat_bucket (ns)]++;
+}
+
+/* Count the time since t0 (from lat_start()) */
+void lat_record (enum lat_phase p, uint64_t t0){
+	if (lat_enabled){
+		lat_add (p, lat_start() - t0);
+	}
+}
+
+/* The q-th quantile (0..1) of h, in ns: the upper bound of the bucket that holds it (but no more than the max). */
+uint64_t lat_quantile (struct lat_hist *h, double q){
+	uint64_t want = ceil (q * h->count), sum = 0;
+	int b;
+	for (b=0; b < LAT_BUCKETS; b++){
+		sum += h->bucket[b];
+		if ( (sum >= want) && (sum > 0) ){
+			return (lat_bucket_max (b) < h->max_ns) ? lat_bucket_max (b) : h->max_ns;
+		}
+	}
+	return h->max_ns;
+}
+
+/* Print the percentiles. (Also from the SIGUSR1 handler.) */
+void lat_report(){
+	int p;
+	eprintf ("Latency (us):  %-22s %10s %10s %10s %10s %10s %10s\n", "phase", "count", "mean", "p50", "p99", "p99.9", "max");
+	for (p=0; p < LAT_NUM; p++){
+		if (lat[p].count){
+			eprintf ("Latency (us):  %-22s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", lat[p].name, (unsigned long long)lat[p].count, lat[p].total_ns / (1e3 * lat[p].count),
+				lat_quantile (&lat[p], 0.5) / 1e3, lat_quantile (&lat[p], 0.99) / 1e3, lat_quantile (&lat[p], 0.999) / 1e3, lat[p].max_ns / 1e3);
+		}
+	}
+}
+
+
+/* Move n tuples, from tuple offset 'off', to the start of the buffer: data_i (-I) if non-NULL, else data. (For a chunk that ran past the end of a frame, or
+ * that began with samples to discard.) A channel-major chunk (ld > 0) is repacked to blocks of n: channel by channel, upwards, so nothing is overwritten early. */
+void shift_tuples (float64 *data, int32 *data_i, int ld, int32 off, int32 n){
+	int c;
+	for (c=0; c < (ld ? num_ch : 1); c++){
+		if (data_i){
+			memmove (data_i + c * n, data_i + CHUNK_AT (ld, off) + c * ld, (ld ? 1 : num_ch) * n * sizeof (int32));
+		}else{
+			memmove (data + c * n, data + CHUNK_AT (ld, off) + c * ld, (ld ? 1 : num_ch) * n * sizeof (float64));
+		}
+	}
+}
+
+/* Read up to 'num' samples (or DAQmx_Val_Auto) into data_i as int32 codes (-I), if data_i is non-NULL, else into data as float64 volts. Return the DAQmx status. */
+/* fill_mode is DAQmx_Val_GroupByScanNumber (tuples), or DAQmx_Val_GroupByChannel (channel-major, -C). */
+int32 read_samples (int32 num, int32 fill_mode, float64 *data, int32 *data_i, uInt32 data_size, int32 *samples_read){
+	if (data_i){
+		return DAQmxReadBinaryI32(taskHandle, num, DAQmx_Val_WaitInfinitely, fill_mode, data_i, data_size, samples_read, NULL);
+	}
+	return DAQmxReadAnalogF64(taskHandle, num, DAQmx_Val_WaitInfinitely, fill_mode, data, data_size, samples_read, NULL);
+}
+
+/* Parse -k: a comma-separated list of distinct channels, each in 0..DEV_NUM_CH-1, into ch[]. Return how many, or -1 if malformed. */
+int parse_channels (const char *arg, int *ch){
+	int   n = 0, c, i;
+	char *end;
+	while (*arg){
+		c = strtol (arg, &end, 10);
+		if ( (end == arg) || (c < 0) || (c >= DEV_NUM_CH) || (n == DEV_NUM_CH) || ( (*end != ',') && (*end != '\0') ) || ( (*end == ',') && (end[1] == '\0') ) ){
+			return -1;
+		}
+		for (i=0; i < n; i++){
+			if (ch[i] == c){
+				return -1;
+			}
+		}
+		ch[n++] = c;
+		arg = (*end == ',') ? end + 1 : end;
+	}
+	return n;
+}
+
+/* Parse -v (NULL: the default) into v[0..n-1]: either one range, for all n channels, or one per channel, comma-separated. Each must be one the device has. */
+/* Return 0 if ok, -1 if not. */
+int parse_ranges (const char *arg, int n, float64 *v){
+	int   i = 0;
+	char *end;
+	if (!arg){
+		for (i=0; i < n; i++){
+			v[i] = DEFAULT_VOLTAGE_RANGE;
+		}
+		return 0;
+	}
+	while (*arg){
+		if (i == n){
+			return -1;
+		}
+		v[i] = strtod (arg, &end);
+		if ( (end == arg) || ( (*end != ',') && (*end != '\0') ) || ( (*end == ',') && (end[1] == '\0') ) ||
+		     ( (v[i] != VOLTAGE_RANGE_0) && (v[i] != VOLTAGE_RANGE_1) && (v[i] != VOLTAGE_RANGE_2) && (v[i] != VOLTAGE_RANGE_3) ) ){
+			return -1;
+		}
+		i++;
+		arg = (*end == ',') ? end + 1 : end;
+	}
+	if (i == 1){
+		for (; i < n; i++){
+			v[i] = v[0];
+		}
+	}
+	return (i == n) ? 0 : -1;
+}
+
+/* Ascii header: print the active channels' values v[c] in format fmt, then newline: just one, if they are all the same, else comma-separated. */
+void print_list (FILE *outfile, const char *fmt, const float64 *v){
+	int c, same = 1;
+	for (c=1; c < num_ch; c++){
+		same = same && (v[c] == v[0]);
+	}
+	for (c=0; c < (same ? 1 : num_ch); c++){
+		outprintf ("%s", c ? "," : "");
+		outprintf (fmt, v[c]);
+	}
+	outprintf ("\n");
+}
+
+/* Ascii header: print, for each active channel, "prefix<N>suffix", comma-separated, where N is the physical channel (as in -k). */
+void print_names (FILE *outfile, const char *prefix, const char *suffix, const int *ch_list){
+	int c;
+	for (c=0; c < num_ch; c++){
+		outprintf ("%s%s%d%s", c ? ", " : "", prefix, ch_list[c], suffix);
+	}
+}
 
 /* Signal handler: handle Ctrl-C in middle of main loop. */
 void handle_signal_cc(int signum){
@@ -225,9 +1337,16 @@ void handle_signal_cc(int signum){
 	terminate_loop = 1; 	/* Break out of the while loop this time round,. */
 }
 
-/* Signal handler: handle SIGUSR1: print current state. */
+/* Signal handler: handle SIGUSR1: print current state, and the output queue. */
+struct output *usr1_output = NULL;
 void handle_signal_usr1(int signum __attribute__ ((unused)) ){
 	eprintf ("%s\n", state);  //global.
+	if (usr1_output){
+		output_report (usr1_output);
+	}
+	if (lat_enabled){
+		lat_report();
+	}
 }
 
 
@@ -235,12 +1354,15 @@ void handle_signal_usr1(int signum __attribute__ ((unused)) ){
 int main(int argc, char* argv[]){
 
 	int	opt; extern char *optarg; extern int optind, opterr, optopt;       /* getopt */
-	char   *input_channels = DEV_DEV"/"INPUT_CHANNELS;
+	char   *channels_arg = DEFAULT_CHANNELS, *vin_arg = NULL;
+	char    input_channels[DEV_NUM_CH * 65] = "";	/* The active channels, as a DAQmx list, eg "Dev1/ai0,Dev1/ai2" */
+	int     all_channels;			/* ... all of them, in order? */
+	int     ch_list[DEV_NUM_CH];		/* -k: the physical channel of each active one, in order */
 	uInt64	num_samples_per_frame = DEFAULT_COUNT;
 	uInt64	num_samples_per_group;
 	float64 sample_rate = DEFAULT_SAMPLE_HZ;
 	float64 sample_interval = ((double)1 / DEFAULT_SAMPLE_HZ);
-	float64 vin_max = DEFAULT_VOLTAGE_RANGE;
+	float64 vin_max[DEV_NUM_CH];		/* -v: each active channel's range */
 	int     num_frames = DEFAULT_MAXFRAMES;
 	int     group_size = DEFAULT_GROUP_SIZE;
 	int     group_interval = DEFAULT_GROUP_INTERVAL;
@@ -250,15 +1372,37 @@ int main(int argc, char* argv[]){
 	int 	num_cdsm = DEFAULT_NUM_CDSM;
 	int     num_pixels = 0;
 	int32   he_retval = 0;   		/* Used by #define handleErr() above */
-	float64 readback_hz = 0, readback_v1 = 0, readback_v2 = 0, readback_g;
+	float64 readback_hz = 0, readback_v1[DEV_NUM_CH], readback_v2[DEV_NUM_CH], readback_g[DEV_NUM_CH];	/* (per active channel) */
 	bool32  overload_occurred = 0;
-	int32   samples_read_thistime;		/* Number of samples (per channel) that were actually read in this pass */
+	int32   samples_read_thistime;		/* Number of samples (per channel) that were actually read in this pass (and are in this frame) */
+	int32   got, off;				/* Samples in this chunk (before splitting it at the frame boundary); offset of this frame's part */
+	int32   carry = 0, carry_off = 0;	/* Samples past the end of the last frame, still in data[] (at carry_off), for the next frame */
+	uInt64  skip = 0;			/* Samples still to be discarded before the next frame: the group interval (-i) or the offset (-j) */
+	uInt64  ahead;				/* How far the next read may go: to the end of the next frame, but not past the end of the task */
 	uInt64  samples_read_inner = 0;		/* Number of samples (per channel) that have been read in the inner loop */
 	uInt64  samples_read_total = 0;		/* Number of samples (per channel) that have been read so far in (grand) total */
-	uInt64	n, n_this, n_discard;
-	int     i, c, ret, px, guard, do_break, opt_c = 0, opt_i = 0, opt_p = 0, dump_raw = 0, prev_frame, frame = 0, group = 0, missed_trigger = 0, group_pos = 0, do_triggerready_delete = 0;
+	uInt64  task_first = 0;			/* ... of which, before the current task started. (-M: the ring's sample index is within the task) */
+	uInt64	n, n_this;
+	int     i, c, ret, lo, hi, q0, count, do_break, opt_c = 0, opt_i = 0, opt_p = 0, dump_raw = 0, prev_frame, frame = 0, group = 0, missed_trigger = 0, group_pos = 0, do_triggerready_delete = 0;
 	float64 data[BUFFER_SIZE];		/* Our read data buffer. Multiple of 4. Needn't have room for num_samples_per_frame all at once */
-	float64 S_x[DEV_NUM_CH], S_y[DEV_NUM_CH], S_xx[DEV_NUM_CH], S_yy[DEV_NUM_CH], S_xy[DEV_NUM_CH], S_y_g1[DEV_NUM_CH], S_yy_g1[DEV_NUM_CH], S_y_g2[DEV_NUM_CH], S_yy_g2[DEV_NUM_CH];
+	int32   data_i[BUFFER_SIZE];		/* Equivalent, when reading as int32 ADC codes (-I) */
+	int     int_adc = 0;			/* -I: read int32 ADC codes, sum as integers, scale once per frame */
+	int     driver_skip = 0;		/* -S: skip the guard and interval samples in the driver (read offset), rather than reading them */
+	int     chan_major = 0;			/* -C: read channel-major (GroupByChannel), so that each channel is contiguous for the kernels */
+	int32   fill_mode = DAQmx_Val_GroupByScanNumber;
+	int     ld = 0;				/* Layout of this chunk: 0 for tuples, else (-C) the length of each channel's block. See CHUNK_IDX() */
+	void   *ring_buf = NULL, *ring_data;	/* (-C with -M) The chunk, interleaved for the ring */
+	size_t  size;
+	float64 v[DEV_NUM_CH];
+	uInt64  frame_last;			/* The last sample of the frame that is actually read (+1): the frame, or with -S, up to the guard_post */
+	struct  frame_sums_i sums_i, cds_g1_i, cds_g2_i;	/* (-I) Integer sums: the frame, and the CDS groups. Scaled into sums, cds_g1, cds_g2. */
+	struct  frame_sums cds_g1, cds_g2;
+	struct  adc_scale scale;		/* (-I) The device's scaling, code to volts, per channel */
+	float64 coeff[ADC_SCALE_COEFFS], full_scale, nonlinear;
+	char    chan_name[64];
+	struct  frame_sums sums;		/* Sums for the statistics of this frame. */
+	float64 *weights = NULL, S_x, S_xx, Dx;	/* Estimator weight vector (lin_reg), and the sums over x, which are the same for every frame. */
+	float64 S_y_g1[DEV_NUM_CH], S_yy_g1[DEV_NUM_CH], S_y_g2[DEV_NUM_CH], S_yy_g2[DEV_NUM_CH];
 	float64 b[DEV_NUM_CH], a[DEV_NUM_CH], s[DEV_NUM_CH], se_a[DEV_NUM_CH], se_b[DEV_NUM_CH], r[DEV_NUM_CH], b_Dx[DEV_NUM_CH];
 	float64 mean[DEV_NUM_CH], stdev[DEV_NUM_CH], min[DEV_NUM_CH], max[DEV_NUM_CH], D_cds[DEV_NUM_CH], stdev_cds_g1[DEV_NUM_CH], stdev_cds_g2[DEV_NUM_CH], se_b_cds[DEV_NUM_CH];
 	double  first_trigger_interval = 0, this_trigger_interval = 0, stopstart_interval = 0;
@@ -268,8 +1412,24 @@ int main(int argc, char* argv[]){
 	struct  stat stat_p;     		/* pointer to stat structure */
 	char   *triggerready_filename = "";	/* trigger_ready filename */
 	char   *mode_arg="lin_reg";
+	int     payload_bytes = 0;		/* Output format (-o): 0 for ascii; else binary, and this is the size of each payload value. */
+	int     compressed = 0;			/* -o compressed: the ascii output, as a compressed stream, with the raw data as int32 codes */
+	struct  codec zc;
+	struct  adc_scale codes;		/* (-o compressed) The identity: the raw payloads are then the codes themselves. */
+	double  zscale[DEV_NUM_CH][CODEC_SCALE_COEFFS];
+	struct  bin_header bin_hdr;
+	struct  bin_record rec;			/* This frame's results */
+	char   *shm_name = NULL;		/* Shared-memory ring (-M) */
+	struct  shmring *ring = NULL;
+	struct  output out;			/* Output (and writer thread) */
+	struct  out_slot *slot, *chunk = NULL;	/* (raw_stream: the chunk of data being filled) */
+	int     writer_depth = -1, writer_drop = 0;		/* (-1: not given; DEFAULT_WRITER_DEPTH, within WRITER_MAX_BYTES) */
+	int     cont_offset = 0, opt_j = 0;	/* Continuous mode (-g cont): samples to discard after the trigger, before the first frame */
+	struct  readsched rsched;		/* Read scheduler: how much to read, and when */
+	struct  realtime rt;			/* Real-time profile (--realtime) */
+	uint64_t t_lat = 0;			/* Latency histograms (-H): start of the phase being timed */
 	struct  timeval	frame_start, frame_end, group_end, group_end_prev, task_prestop, task_started;
-	enum    mode { RAW, LINREG, CDS_M, IMAGE, IMAGE_CDS }; enum mode mode=LINREG;  /* Which mode to operate in? */
+	enum    mode mode=LINREG;  		/* Which mode to operate in? */
 
 	/* Set handler for SIGUSR1: print state to stderr. */
 	signal(SIGUSR1, handle_signal_usr1);
@@ -279,13 +1439,18 @@ int main(int argc, char* argv[]){
                 print_help(argv[0]);
                 exit (EXIT_SUCCESS);
         }
+	if (realtime_args (&argc, argv, &rt)){			/* Likewise --realtime[=CPU][,poll]; remove it before getopt */
+		feprintf ("Invalid --realtime. Use --realtime, --realtime=CPU, --realtime=poll, or --realtime=CPU,poll.\n");
+	}
 
-        while ((opt = getopt(argc, argv, "dhra:c:f:g:i:n:m:p:v:x:y:z:T:")) != -1) {  /* Getopt */
+        while ((opt = getopt(argc, argv, "dhrCHISWa:c:f:g:i:j:k:n:m:o:p:v:w:x:y:z:M:T:")) != -1) {  /* Getopt */
                 switch (opt) {
 			case 'a':				/* Analysis type */
 				mode_arg = optarg;
 				if (!strcasecmp(optarg, "raw")){
 					mode = RAW;
+				}else if (!strcasecmp(optarg, "raw_stream")){
+					mode = RAW_STREAM;
 				}else if ((!strcasecmp(optarg, "lin_reg")) || (!strcasecmp(optarg, "linreg"))) {
 					mode = LINREG;
 				}else if (!strcasecmp(optarg, "cds_multiple")){
@@ -295,7 +1460,7 @@ int main(int argc, char* argv[]){
 				}else if (!strcasecmp(optarg, "image_diff")){
 					mode = IMAGE_CDS;
 				}else{
-					feprintf ("Illegal mode. Values of -a can be: raw, lin_reg, cds_multiple, image, image_diff.\n");
+					feprintf ("Illegal mode. Values of -a can be: raw, raw_stream, lin_reg, cds_multiple, image, image_diff.\n");
 				}
 				break;
 
@@ -316,13 +1481,30 @@ int main(int argc, char* argv[]){
 				sample_interval = ((double)1 / sample_rate);
 				break;
 
-			case 'g':				/* Group of frames */
-				group_size = atoi(optarg);
-				if (group_size <= 0){
-					feprintf ("Fatal Error: group_size (-g) must be > 0.\n");
+			case 'g':				/* Group of frames. "cont" for one continuous task */
+				if (!strcasecmp(optarg, "cont")){
+					group_size = -1;
+				}else{
+					group_size = atoi(optarg);
+					if (group_size <= 0){
+						feprintf ("Fatal Error: group_size (-g) must be > 0, (or 'cont' for continuous).\n");
+					}
 				}
 				break;
 
+			case 'I':				/* Read int32 ADC codes */
+				int_adc = 1;
+				break;
+
+			case 'C':				/* Read channel-major */
+				chan_major = 1;
+				fill_mode = DAQmx_Val_GroupByChannel;
+				break;
+
+			case 'H':				/* Latency histograms */
+				lat_enabled = 1;
+				break;
+
 			case 'h':                               /* Help */
 				print_help(argv[0]);
 				exit (EXIT_SUCCESS);
@@ -335,6 +1517,18 @@ int main(int argc, char* argv[]){
 				}
 				break;
 
+			case 'j':				/* Offset of the first frame, after the trigger, in continuous mode */
+				opt_j = 1;
+				cont_offset = atoi(optarg);
+				if (cont_offset < 0){
+					feprintf ("Fatal Error: offset (-j) must be >= 0.\n");
+				}
+				break;
+
+			case 'M':				/* Shared-memory ring */
+				shm_name = optarg;
+				break;
+
 			case 'm':				/* Max frames. "cont" for continuous */
 				if (!strcasecmp(optarg, "cont")){
 					num_frames = -1;
@@ -357,6 +1551,21 @@ int main(int argc, char* argv[]){
 				}
 				break;
 
+			case 'o':				/* Output format */
+				if (!strcasecmp(optarg, "ascii")){
+					payload_bytes = 0;
+				}else if ((!strcasecmp(optarg, "binary")) || (!strcasecmp(optarg, "binary64"))){
+					payload_bytes = sizeof (float64);
+				}else if (!strcasecmp(optarg, "binary32")){
+					payload_bytes = sizeof (float32);
+				}else if (!strcasecmp(optarg, "compressed")){
+					payload_bytes = 0;
+					compressed = 1;
+				}else{
+					feprintf ("Illegal output format. Values of -o can be: ascii, binary, binary32, compressed.\n");
+				}
+				break;
+
 			case 'p':				/* Number of pixels (per quadrant) in imaging mode */
 				opt_p = 1;
 				num_pixels = atoi(optarg);
@@ -369,13 +1578,29 @@ int main(int argc, char* argv[]){
 				dump_raw = 1;
 				break;
 
-			case 'v':				/* Voltage Limit: set gain/rainge for input voltage swing of [-v_limit, +v_limit] */
-				vin_max = atof(optarg);
-				if ( (vin_max != VOLTAGE_RANGE_0) && (vin_max != VOLTAGE_RANGE_0) && (vin_max != VOLTAGE_RANGE_2) && (vin_max != VOLTAGE_RANGE_3) ){
-					feprintf ("Fatal Error: voltage range must be set to +/-V where V is in { %4.2f, %4.2f, %4.2f }\n", VOLTAGE_RANGE_0, VOLTAGE_RANGE_1, VOLTAGE_RANGE_2);
+			case 'S':				/* Skip guard/interval samples in the driver */
+				driver_skip = 1;
+				break;
+
+			case 'v':				/* Voltage Limit: set gain/rainge for input voltage swing of [-v_limit, +v_limit]. (Checked below, with -k) */
+				vin_arg = optarg;
+				break;
+
+			case 'k':				/* Channels to acquire */
+				channels_arg = optarg;
+				break;
+
+			case 'w':				/* Writer thread queue depth */
+				writer_depth = atoi(optarg);
+				if (writer_depth < 0){
+					feprintf ("Fatal Error: writer queue depth (-w) must be >= 0.\n");
 				}
 				break;
 
+			case 'W':				/* Drop frames, rather than block, when the writer queue is full */
+				writer_drop = 1;
+				break;
+
 			case 'x':				/* Guard samples (pre) */
 				guard_pre = atoi(optarg);
 				if (guard_pre < 0){
@@ -410,13 +1635,27 @@ int main(int argc, char* argv[]){
 	}
 
 
-	/* Calculations */
-	num_samples_per_group = (num_samples_per_frame * group_size)  +  ( group_interval * (group_size -1) );
+	/* Calculations. (In continuous mode, there's only one, unbounded, group: num_samples_per_group is just the frame period, and sizes the buffer.) */
+	if (group_size == -1){
+		num_samples_per_group = num_samples_per_frame + group_interval;
+	}else{
+		num_samples_per_group = (num_samples_per_frame * group_size)  +  ( group_interval * (group_size -1) );
+	}
 
 	/* Sanity checks */
 	if (argc - optind != 0){
 		feprintf ("This takes no non-option arguments. Use -h for help.\n");
 	}
+	num_ch = parse_channels (channels_arg, ch_list);
+	if (num_ch <= 0){
+		feprintf ("Fatal Error: channels (-k) must be a comma-separated list of distinct channels, each in 0-%d, eg '0,2'.\n", DEV_NUM_CH - 1);
+	}
+	for (c=0, all_channels = (num_ch == DEV_NUM_CH); c < num_ch; c++){
+		all_channels = all_channels && (ch_list[c] == c);
+	}
+	if (parse_ranges (vin_arg, num_ch, vin_max)){
+		feprintf ("Fatal Error: voltage range (-v) must be one V, or one per channel (-k), comma-separated; each V is in { %4.2f, %4.2f, %4.2f, %4.2f }.\n", VOLTAGE_RANGE_0, VOLTAGE_RANGE_1, VOLTAGE_RANGE_2, VOLTAGE_RANGE_3);
+	}
 	if (do_triggerready_delete){		/* Trigger Ready file must pre-exist, and be empty. */
  		if (stat (triggerready_filename, &stat_p) == -1){
  			feprintf ("Trigger-Ready signal-file '%s' doesn't exist. It must be pre-created (empty) by the external process and supplied to us.\n", triggerready_filename);
@@ -430,12 +1669,15 @@ int main(int argc, char* argv[]){
 	if (num_samples_per_frame - (guard_pre + guard_post) < 3){
 		feprintf ("Error: number of samples per frame (excluding guard_pre/guard_post) must be 3 or more. Otherwise, the linear-regression statistics can't be calculated.\n");
 	}
-	if ((num_frames != -1) && (num_frames % group_size != 0)){
+	if ((num_frames != -1) && (group_size != -1) && (num_frames % group_size != 0)){
 		feprintf ("Error: finite number of frames (%d) must be an exact multiple of the group size (%d)\n", num_frames, group_size);
 	}
 	if (num_samples_per_group  > DEV_SAMPLES_MAX){
 		feprintf ("Error: too many samples per group. Value %lld exceeds max number of samples per Task, %d. [Calculate: samples * groups + interval * (groups-1) ].\n", (long long)num_samples_per_group, DEV_SAMPLES_MAX);
 	}
+	if ((group_size != -1) && opt_j){
+		feprintf ("Error: option -j (offset) only applies to continuous mode, -g cont.\n");
+	}
 	if (mode != CDS_M && opt_c){
 		feprintf ("Error: option -c specified without setting mode to 'cds_multiple'.\n");
 	}
@@ -454,35 +1696,64 @@ int main(int argc, char* argv[]){
 	if (((mode == IMAGE) || (mode == IMAGE_CDS)) && ((unsigned int)(guard_pre + num_pixels + (num_pixels - 1) * guard_internal + guard_post) != num_samples_per_frame) ){
 		feprintf ("Error: in imaging mode, must satisfy: number_of_samples_per_frame = guard_pre + num_pixels + ((num_pixels - 1) * guard_internal) + guard_post.\nCurrent values: samples_per_frame=%d, guard_pre=%d, guard_internal=%d, guard_post=%d, num_pixels=%d.\n", (int)num_samples_per_frame, guard_pre, guard_internal, guard_post, num_pixels);
 	}
+	if ((mode == RAW_STREAM) && writer_drop){
+		feprintf ("Error: raw_stream mode can't drop (-W) output: a frame's data would have holes. Use a deeper queue (-w) instead.\n");
+	}
 	if ((mode == IMAGE_CDS) && (num_frames % 2 != 0)){
 		feprintf ("Error: in differential imaging mode, number of frames must (obviously) be even.\n");
 	}
+	if (driver_skip && dump_raw){
+		deprintf ("Raw dump (-r) with -S: the guard samples aren't read, so won't be dumped.\n");
+	}
+	if (dump_raw){				/* The raw dump is written during acquisition: it has to be inline. */
+		writer_depth = 0;
+	}
+	if (payload_bytes && dump_raw){
+		feprintf ("Error: raw dump (-r) is ascii; it can't be mixed into binary output (-o).\n");
+	}
+	if ( (payload_bytes || compressed) && (*(uInt32*)"\1\0\0\0" != 1)){	/* The NI driver is x86-only, but check anyway. */
+		feprintf ("Error: binary output (-o) is little-endian; this machine isn't.\n");
+	}
+	if (compressed && ( !int_adc || ( (mode != RAW) && (mode != RAW_STREAM) ) || dump_raw) ){
+		feprintf ("Error: compressed output (-o compressed) is of the raw ADC codes: it needs -I, and mode raw or raw_stream; not -r.\n");
+	}
 
 	 /* keep compiler happy: these initialisations aren't needed, but allow us to use -Wall without noise. */
 	gettimeofday(&group_end_prev, NULL); gettimeofday(&task_prestop, NULL);
  	for (c=0; c < DEV_NUM_CH; c++){
-  		S_x[c] =  S_xx[c] = S_y [c] = S_yy[c] = S_xy[c] = S_y_g1[c] = S_yy_g1[c] = S_y_g2[c] = S_yy_g2[c] = mean[c] = stdev[c] = 0;  min[c] = 1e10; max[c] = -1e10;
+  		S_y_g1[c] = S_yy_g1[c] = S_y_g2[c] = S_yy_g2[c] = mean[c] = stdev[c] = 0;
+	}
+	frame_sums_reset (&sums);
+
+	/* Build the estimator's weight vector over the non-guard samples, and the sums over x. These are the same for every frame, so do it once, here. */
+	n  = num_samples_per_frame - guard_pre - guard_post;
+	x_sums (n, &S_x, &S_xx, &Dx);
+	if (mode == LINREG){
+		weights = build_weights (EST_OLS, n, S_x, Dx);
+		if (weights == NULL){
+			feprintf ("Fatal error: couldn't malloc() enough for %lld weights.\n", (long long)n);
+		}
 	}
 
 	/* Allocate memory for the pixel arrys or raw data */
-	if ( (mode == IMAGE) || (mode || IMAGE_CDS) ){
-		for (c=0; c < DEV_NUM_CH; c++){
+	if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){
+		for (c=0; c < num_ch; c++){
 			pixels1[c] = malloc (num_pixels * sizeof (*pixels1[0]) );
 			if (NULL == pixels1[c]){
-				feprintf ("Fatal error: couldn't malloc() enough for %d quads of %d pixels.\n", DEV_NUM_CH, num_pixels);
+				feprintf ("Fatal error: couldn't malloc() enough for %d quads of %d pixels.\n", num_ch, num_pixels);
 			}
 			if (mode == IMAGE_CDS){
 				pixels2[c] = malloc (num_pixels * sizeof (*pixels2[0]) );
 				if (NULL == pixels2[c]){
-					feprintf ("Fatal error: couldn't malloc() enough for %d quads of %d pixels.\n", DEV_NUM_CH, num_pixels);
+					feprintf ("Fatal error: couldn't malloc() enough for %d quads of %d pixels.\n", num_ch, num_pixels);
 				}
 			}
 		}
 	}else if (mode == RAW){
-		for (c=0; c < DEV_NUM_CH; c++){
+		for (c=0; c < num_ch; c++){
 			raw[c] = malloc (num_samples_per_frame * sizeof (*raw[0]) );
 			if (NULL == raw[c]){
-				feprintf ("Fatal error: couldn't malloc() enough for %d quads of %lld samples.\n", DEV_NUM_CH, (long long)num_samples_per_frame);
+				feprintf ("Fatal error: couldn't malloc() enough for %d quads of %lld samples.\n", num_ch, (long long)num_samples_per_frame);
 			}
 	 		for (i=0; (unsigned)i < num_samples_per_frame; i++){  /* keep compiler happy, unnecessary initialisation for -Wall */
 	 			raw [c][i] = 0;
@@ -500,28 +1771,56 @@ int main(int argc, char* argv[]){
 	handleErr ( DAQmxConnectTerms ( "/"DEV_DEV"/ai/SampleClock", "/"DEV_DEV"/"RTSI6,  DAQmx_Val_DoNotInvertPolarity));
 
 	/* Set input channels: choose the channel(s), the terminal-mode, and the voltage-scale. NB the voltage scale is coerced by device capabilities. */
-	handleErr( DAQmxCreateAIVoltageChan(taskHandle, input_channels, "AnalogInput", TERMINAL_MODE, -vin_max, vin_max, DAQmx_Val_Volts, NULL) );  /* DAQmx_Val_Volts is the scale-type */
- 	handleErr( DAQmxGetAIMin (taskHandle, input_channels, &readback_v1)  ); 	/* Check coercion */
- 	handleErr( DAQmxGetAIMax (taskHandle, input_channels, &readback_v2) );
-	handleErr( DAQmxGetAIGain(taskHandle, input_channels, &readback_g) );
-	deprintf ("Input Voltage range requested: [%f, %f] V; actually coerced by device to: [%f, %f] V. Gain is: %f dB. Terminal_mode: %s.\n", -vin_max, vin_max, readback_v1, readback_v2, readback_g, TERMINAL_MODE_STR);
+	/* One call per active channel (-k), each with its own range (-v); the task's channels, and so the values in each tuple, are in this order. Unnamed, */
+	/* so that each (virtual) channel is called by its physical name, eg "Dev1/ai2", for the properties below. Channels not in -k aren't read at all. */
+	for (c=0; c < num_ch; c++){
+		snprintf (chan_name, sizeof (chan_name), DEV_DEV"/ai%d", ch_list[c]);
+		handleErr( DAQmxCreateAIVoltageChan(taskHandle, chan_name, "", TERMINAL_MODE, -vin_max[c], vin_max[c], DAQmx_Val_Volts, NULL) );  /* DAQmx_Val_Volts is the scale-type */
+		handleErr( DAQmxGetAIMin (taskHandle, chan_name, &readback_v1[c])  ); 	/* Check coercion */
+		handleErr( DAQmxGetAIMax (taskHandle, chan_name, &readback_v2[c]) );
+		handleErr( DAQmxGetAIGain(taskHandle, chan_name, &readback_g[c]) );
+		deprintf ("Channel %s: input voltage range requested: [%f, %f] V; actually coerced by device to: [%f, %f] V. Gain is: %f dB. Terminal_mode: %s.\n", chan_name, -vin_max[c], vin_max[c], readback_v1[c], readback_v2[c], readback_g[c], TERMINAL_MODE_STR);
+		strcat (strcat (input_channels, c ? "," : ""), chan_name);	/* (Fits: see its size) */
+	}
 
 	/* Configure Channel input-coupling (AC/DC). NB if choosing AC coupling, remember to allow the settling time! */
 	deprintf  ("Setting input_coupling to %d, %s ...\n", INPUT_COUPLING, INPUT_COUPLING_STR );
 	handleErr( DAQmxSetAICoupling (taskHandle, input_channels, INPUT_COUPLING) );
 
-	/* Configure Triggering. Set trigger input to digital triggering via the external SMA connector, and select the edge. Must use a Reference trigger because we NEED the PulseBlaster to respond to HW_TRIGGER */
-	deprintf  ("Setting triggering to external trigger input, %s, using %s edge. Reference trigger with %d pre-trigger samples...\n", DEV_TRIGGER_INPUT, TRIGGER_EDGE_STR, PRETRIGGER_SAMPLES);
-	handleErr ( DAQmxCfgDigEdgeRefTrig (taskHandle, DEV_TRIGGER_INPUT, TRIGGER_EDGE, PRETRIGGER_SAMPLES) );
-
-	/* Configure Timing and Sample Count. [Use Rising Edge of Onboard clock (arbitrary choice).] */
-	/* Acquire finite number, num_samples_per_group, of samples (on each channel) at a rate of (coereced)sample_rate. */
-	handleErr( DAQmxCfgSampClkTiming(taskHandle, OnboardClock, sample_rate, INT_CLOCK_EDGE, DAQmx_Val_FiniteSamps, num_samples_per_group ) );  /* Finite number of samples */
-	handleErr( DAQmxGetSampClkRate (taskHandle, &readback_hz)  ); 	/* Check coercion */
-	deprintf ("Acquiring (finite) %lld samples per task. Sample clock requested: %f Hz; actually coerced to: %f Hz. Using %s edge of the internal sample-clock.\n", (long long)num_samples_per_group, sample_rate, readback_hz, INT_CLOCK_EDGE_STR);
+	if (group_size == -1){	/* Continuous mode: one task, for all the frames. The reference trigger is only for finite tasks: use a Start trigger. */
+		/* The frames are then sliced out of the stream by sample count: the first -j samples are discarded, then every (n+i) samples is one frame. */
+		/* [This relies on the NI and PulseBlaster sharing a clock, so the frame period is exact; there's no pre-triggering for the PB's HW_Trigger.] */
+		deprintf  ("Setting triggering to external trigger input, %s, using %s edge. Start trigger (continuous mode)...\n", DEV_TRIGGER_INPUT, TRIGGER_EDGE_STR);
+		handleErr ( DAQmxCfgDigEdgeStartTrig (taskHandle, DEV_TRIGGER_INPUT, TRIGGER_EDGE) );
+
+		/* Configure Timing. Continuous samples: the final parameter then sizes the buffer: at least CONT_BUFFER_SECONDS of data, or CONT_BUFFER_FRAMES frames. */
+		n = (CONT_BUFFER_FRAMES * num_samples_per_group > CONT_BUFFER_SECONDS * sample_rate) ? (CONT_BUFFER_FRAMES * num_samples_per_group) : (uInt64)(CONT_BUFFER_SECONDS * sample_rate);
+		handleErr( DAQmxCfgSampClkTiming(taskHandle, OnboardClock, sample_rate, INT_CLOCK_EDGE, DAQmx_Val_ContSamps, n ) );  /* Continuous samples */
+		handleErr( DAQmxGetSampClkRate (taskHandle, &readback_hz)  ); 	/* Check coercion */
+		deprintf ("Acquiring continuously, buffer %lld samples; frame period %lld samples. Sample clock requested: %f Hz; actually coerced to: %f Hz. Using %s edge of the internal sample-clock.\n", (long long)n, (long long)num_samples_per_group, sample_rate, readback_hz, INT_CLOCK_EDGE_STR);
+	}else{
+		/* Configure Triggering. Set trigger input to digital triggering via the external SMA connector, and select the edge. Must use a Reference trigger because we NEED the PulseBlaster to respond to HW_TRIGGER */
+		deprintf  ("Setting triggering to external trigger input, %s, using %s edge. Reference trigger with %d pre-trigger samples...\n", DEV_TRIGGER_INPUT, TRIGGER_EDGE_STR, PRETRIGGER_SAMPLES);
+		handleErr ( DAQmxCfgDigEdgeRefTrig (taskHandle, DEV_TRIGGER_INPUT, TRIGGER_EDGE, PRETRIGGER_SAMPLES) );
+
+		/* Configure Timing and Sample Count. [Use Rising Edge of Onboard clock (arbitrary choice).] */
+		/* Acquire finite number, num_samples_per_group, of samples (on each channel) at a rate of (coereced)sample_rate. */
+		handleErr( DAQmxCfgSampClkTiming(taskHandle, OnboardClock, sample_rate, INT_CLOCK_EDGE, DAQmx_Val_FiniteSamps, num_samples_per_group ) );  /* Finite number of samples */
+		handleErr( DAQmxGetSampClkRate (taskHandle, &readback_hz)  ); 	/* Check coercion */
+		deprintf ("Acquiring (finite) %lld samples per task. Sample clock requested: %f Hz; actually coerced to: %f Hz. Using %s edge of the internal sample-clock.\n", (long long)num_samples_per_group, sample_rate, readback_hz, INT_CLOCK_EDGE_STR);
+	}
 
-	/* Ensure that DAQmxReadAnalogF64() (below) will not block for completion, but will read all the available samples. */
+	/* Ensure that DAQmxReadAnalogF64() (below) will not block for completion, but will read all the available samples. [Only matters for DAQmx_Val_Auto reads: */
+	/* the read scheduler asks for an exact number. It works from the coerced rate.] */
 	handleErr( DAQmxSetReadReadAllAvailSamp (taskHandle, TRUE) );
+	readsched_init (&rsched, readback_hz, BUFFER_SIZE_TUPLES);
+
+	/* With -S, skip samples in the driver: a read then starts 'ReadOffset' samples after the current read position. (Set per frame, below; normally 0.) */
+	/* So the padding (guards, intervals, offset) is never transferred, nor converted. [An offset ahead of the samples acquired makes the read wait for them.] */
+	if (driver_skip){
+		handleErr( DAQmxSetReadRelativeTo (taskHandle, DAQmx_Val_CurrReadPos) );
+	}
+	frame_last = driver_skip ? (num_samples_per_frame - guard_post) : num_samples_per_frame;
 
 	/* Disable EnhancedAliasRejectionEnable as #defined above: ensure that filterdelay is constant 63. No benefit at higher frequencies anyway. */
 	handleErr( DAQmxSetAIEnhancedAliasRejectionEnable(taskHandle, input_channels, ENABLE_ADC_LF_EAR) );
@@ -532,11 +1831,31 @@ int main(int argc, char* argv[]){
 	handleErr( DAQmxTaskControl ( taskHandle, DAQmx_Val_Task_Commit) ); //*/   /* Error: DAQmxErrorPALResourceReserved  i.e. -50103  arises if there are two processes contending for access to this device. */
 	state = "Committed";
 
+	/* Int32 path: get each channel's scaling polynomial (code to volts). We scale the sums, not the samples, so it must be linear: the higher-order terms */
+	/* must be worth less than half an ADC code, even at full scale. (The NI 4462's is.) */
+	if (int_adc){
+		for (c=0; c < num_ch; c++){
+			memset (coeff, 0, sizeof (coeff));
+			snprintf (chan_name, sizeof (chan_name), DEV_DEV"/ai%d", ch_list[c]);
+			handleErr( DAQmxGetAIDevScalingCoeff (taskHandle, chan_name, coeff, ADC_SCALE_COEFFS) );
+			scale.c0[c] = coeff[0];
+			scale.c1[c] = coeff[1];
+			full_scale = (coeff[1] != 0) ? fabs (readback_v2[c] / coeff[1]) : 0;	/* Full scale, in codes */
+			nonlinear = fabs (coeff[2]) * pow (full_scale, 2) + fabs (coeff[3]) * pow (full_scale, 3);
+			deprintf ("Channel %s: scaling coefficients: %g, %g, %g, %g. Non-linearity at full scale: %g V.\n", chan_name, coeff[0], coeff[1], coeff[2], coeff[3], nonlinear);
+			if ( (coeff[1] == 0) || (nonlinear > fabs (coeff[1]) / 2) ){
+				feprintf ("Fatal error: channel %s's scaling (code to volts) isn't linear: coefficients %g, %g, %g, %g. Can't use -I.\n", chan_name, coeff[0], coeff[1], coeff[2], coeff[3]);
+			}
+		}
+	}
+
 	/* Ready to go... print a brief summary */
 	if (mode == LINREG){
 		eprintf ("Configuration: Mode: lin_reg,  FreqHz: %f,  Frames: %d,  SampsPerFrame: %ld,  GroupSize: %d,  GuardPre: %d, GuardPost: %d\n", sample_rate, num_frames, (unsigned long)num_samples_per_frame, group_size, guard_pre, guard_post);
 	}else if (mode == CDS_M){
 		eprintf ("Configuration: Mode: cds_multiple,  FreqHz: %f,  Frames: %d,  SampsPerFrame: %ld,  GroupSize: %d,  Num_CDSm: %d,  GuardPre: %d, GuardPost: %d\n", sample_rate, num_frames, (unsigned long)num_samples_per_frame, group_size, num_cdsm, guard_pre, guard_post);
+	}else if (mode == RAW_STREAM){
+		eprintf ("Configuration: Mode: raw_stream,  FreqHz: %f,  Frames: %d,  SampsPerFrame: %ld,  GroupSize: %d,  GuardPre: %d, GuardPost: %d\n", sample_rate, num_frames, (unsigned long)num_samples_per_frame, group_size, guard_pre, guard_post);
 	}else if (mode == RAW){
 		eprintf ("Configuration:Mode: raw,  FreqHz: %f,  Frames: %d,  SampsPerFrame: %ld,  GroupSize: %d,  GuardPre: %d, GuardPost: %d\n", sample_rate, num_frames, (unsigned long)num_samples_per_frame, group_size, guard_pre, guard_post);
 	}else if (mode == IMAGE){
@@ -545,46 +1864,145 @@ int main(int argc, char* argv[]){
 		eprintf ("Configuration: Mode: image_diff,  FreqHz: %f,  Frames: %d,  SampsPerFrame: %ld,  GroupSize: %d,  Pixels %d,  GuardPre: %d, GuardPost: %d,  GuardInt: %d\n", sample_rate, num_frames, (unsigned long)num_samples_per_frame, group_size, num_pixels, guard_pre, guard_post, guard_internal);
 	}
 
-	/* Write out header to file (use the readback values where they might differ from the requested ones). */
- 	outprintf ("#Data from       %s:\n", DEV_NAME);
-	outprintf ("#mode:           %s\n", mode_arg);
- 	outprintf ("#freq_hz:        %.3f\n", readback_hz);
-	outprintf ("#interval_s:     %4.9f\n", sample_interval);
-	outprintf ("#samples:        %lld\n", (long long)num_samples_per_frame);
-	outprintf ("#frames:         %lld\n", (long long)num_samples_per_frame);
-	outprintf ("#group_size:     %d\n", group_size);
-	outprintf ("#group_interval: %d\n", group_interval);
-	outprintf ("#guard_pre:  %d\n", guard_pre);
-	outprintf ("#guard_post: %d\n", guard_post);
-	if (mode == IMAGE || mode == IMAGE_CDS){
-		outprintf ("#pixels:         %d\n", num_pixels);
-		outprintf ("#guard_int:      %d\n", guard_internal);
-	}
-	if (mode == CDS_M){
-		outprintf ("#cds_m_num:      %d\n", num_cdsm);
-	}
-	outprintf ("#channels:   %s\n", INPUT_CHANNELS);
- 	outprintf ("#voltage:    %.3f\n", readback_v1);
-	outprintf ("#gain:       %.1f\n", readback_g);
-	outprintf ("#coupling:   %s\n", INPUT_COUPLING_STR);
-	outprintf ("#terminal:   %s\n", TERMINAL_MODE_STR);
-	outprintf ("#trigger:    %s\n", TRIGGER_EDGE_STR);
-	outprintf ("#trigger_compensation:   %d\n",  TRIGGER_EARLY_BY);
-	outprintf ("#trigger_compensation_s: %f\n", (TRIGGER_EARLY_BY * sample_interval) );
-
-	/* Include the parseable data format in the output file, as well as -h above */
-	if (mode == LINREG){
-		outprintf ("#Data Format for lin_reg is: frame_number, end_timestamp, overload_occurred, missed_trigger, b_Dx (0,1,2,3), a (0,1,2,3),  b (0,1,2,3), s (0,1,2,3), se_a (0,1,2,3), se_b (0,1,2,3), r (0,1,2,3), min (0,1,2,3), max (0,1,2,3)\n");
-	}else if (mode == CDS_M){
-		outprintf ("#Data Format for cds_m is: frame_number, end_timestamp, overload_occurred, missed_trigger, D_cds (0,1,2,3),  se_b_cds (0,1,2,3), min (0,1,2,3), max(0,1,2,3)\n");
-	}else if (mode == RAW){
-		outprintf ("#Data Format for raw is: data_0, data_1, data_2, data_3\n");
-	}else if (mode == IMAGE){
-		outprintf ("#Data Format for image is: quad_0, quad_1, quad_2, quad_3\n");
-	}else if (mode == IMAGE_CDS){
-		outprintf ("#Data Format for image_differential is: quad_0_{frame_even - frame_odd}, quad_1_{frame_even - frame_odd},  quad_2_{frame_even - frame_odd},  quad_3_{frame_even - frame_odd}\n");
+	/* Set up the output. Payload tuples per frame: raw data (excluding the start/end guard samples), or pixels. raw_stream: at most one read per chunk. */
+	out.f = outfile; out.mode = mode; out.payload_bytes = payload_bytes; out.depth = writer_depth; out.drop = writer_drop; out.stream = (mode == RAW_STREAM);
+	out.rows = (mode == RAW) ? (int)(num_samples_per_frame - guard_pre - guard_post) : ( (mode == IMAGE || mode == IMAGE_CDS) ? num_pixels : 0 );
+	out.rows = (mode == RAW_STREAM) ? BUFFER_SIZE_TUPLES : out.rows;
+	if (out.depth < 0){			/* Default depth: fewer slots for big frames (which could be GB each, near DEV_SAMPLES_MAX); inline if even one is too big. */
+		out.depth = ( (size_t)out.rows * num_ch * sizeof (float64) > WRITER_MAX_BYTES / DEFAULT_WRITER_DEPTH) ?
+			(int)(WRITER_MAX_BYTES / ( (size_t)out.rows * num_ch * sizeof (float64) )) : DEFAULT_WRITER_DEPTH;
+		deprintf ("Output: writer queue depth %d (default, for frames of %d tuples).\n", out.depth, out.rows);
 	}
 
+	/* The binary header (for -o binary, and -M), using the readback values where they might differ from the requested ones. */
+	memset (&bin_hdr, 0, sizeof (bin_hdr));
+	memcpy (bin_hdr.magic, BIN_MAGIC, sizeof (bin_hdr.magic));
+	bin_hdr.version       = BIN_VERSION;
+	bin_hdr.header_size   = sizeof (struct bin_header);
+	bin_hdr.record_size   = sizeof (struct bin_record);
+	bin_hdr.payload_rows  = 0;
+	bin_hdr.payload_bytes = sizeof (float64);
+	bin_hdr.num_channels  = num_ch;
+	bin_hdr.mode          = mode;
+	bin_hdr.num_frames    = num_frames;		bin_hdr.group_size = group_size;	bin_hdr.group_interval = group_interval;
+	bin_hdr.guard_pre     = guard_pre;		bin_hdr.guard_post = guard_post;	bin_hdr.guard_internal = guard_internal;
+	bin_hdr.num_pixels    = num_pixels;		bin_hdr.num_cdsm   = num_cdsm;		bin_hdr.trigger_compensation = TRIGGER_EARLY_BY;
+	bin_hdr.samples_per_frame = num_samples_per_frame;
+	bin_hdr.freq_hz       = readback_hz;		bin_hdr.interval_s = sample_interval;
+	bin_hdr.voltage       = readback_v1[0];		bin_hdr.gain       = readback_g[0];	/* (The first channel's: see voltages[], gains[]) */
+	for (c=0; c < num_ch; c++){
+		bin_hdr.channels[c] = ch_list[c];	bin_hdr.voltages[c] = readback_v1[c];	bin_hdr.gains[c] = readback_g[c];
+	}
+	strncpy (bin_hdr.mode_name, mode_arg, sizeof (bin_hdr.mode_name) - 1);
+
+	/* Create the shared-memory ring. Its readers get the header without a payload: the frame messages are just the records. (The raw data is separate.) */
+	if (shm_name){
+		ring = shmring_create (shm_name, &bin_hdr, sizeof (bin_hdr));
+		if (ring == NULL){
+			feprintf ("Fatal error: couldn't create shared-memory ring '%s': %s\n", shm_name, strerror(errno));
+		}
+		deprintf ("Publishing to shared-memory ring '%s'.\n", shm_name);
+		if (chan_major){
+			ring_buf = malloc (sizeof (data));
+			if (ring_buf == NULL){
+				feprintf ("Fatal error: couldn't malloc() the buffer to interleave channel-major chunks for the ring.\n");
+			}
+		}
+	}
+
+	/* Compressed: start the stream, with the scaling (so the decoder gives volts, as ascii would), and collect the header's '#' lines, for it. */
+	out.z = NULL;
+	if (compressed){
+		memset (zscale, 0, sizeof (zscale));
+		for (c=0; c < num_ch; c++){
+			zscale[c][0] = scale.c0[c];  zscale[c][1] = scale.c1[c];
+			codes.c0[c] = 0;  codes.c1[c] = 1;
+		}
+		if (codec_start (&zc, outfile, num_ch, 9, zscale)){
+			feprintf ("Fatal error: couldn't write output header: %s\n", strerror(errno));
+		}
+		out.z = &zc;
+		if ( (out.zf = open_memstream (&out.ztext, &out.zsize)) == NULL){
+			feprintf ("Fatal error: couldn't open a memory stream for the header: %s\n", strerror(errno));
+		}
+		outfile = out.zf;
+	}
+
+	/* Write out header to file. */
+	if (payload_bytes){		/* Binary: one fixed-layout header struct. */
+		bin_hdr.payload_rows  = (mode == RAW_STREAM) ? (int)(num_samples_per_frame - guard_pre - guard_post) : out.rows;
+		bin_hdr.payload_bytes = payload_bytes;
+		if (fwrite (&bin_hdr, sizeof (bin_hdr), 1, outfile) != 1){
+			feprintf ("Fatal error: couldn't write output header: %s\n", strerror(errno));
+		}
+	}else{
+	 	outprintf ("#Data from       %s:\n", DEV_NAME);
+		outprintf ("#mode:           %s\n", mode_arg);
+	 	outprintf ("#freq_hz:        %.3f\n", readback_hz);
+		outprintf ("#interval_s:     %4.9f\n", sample_interval);
+		outprintf ("#samples:        %lld\n", (long long)num_samples_per_frame);
+		outprintf ("#frames:         %lld\n", (long long)num_samples_per_frame);
+		outprintf ("#group_size:     %d\n", group_size);
+		outprintf ("#group_interval: %d\n", group_interval);
+		outprintf ("#guard_pre:  %d\n", guard_pre);
+		outprintf ("#guard_post: %d\n", guard_post);
+		if (mode == IMAGE || mode == IMAGE_CDS){
+			outprintf ("#pixels:         %d\n", num_pixels);
+			outprintf ("#guard_int:      %d\n", guard_internal);
+		}
+		if (mode == CDS_M){
+			outprintf ("#cds_m_num:      %d\n", num_cdsm);
+		}
+		outprintf ("#channels:   %s\n", all_channels ? ALL_CHANNELS_HEADER : input_channels);
+		if (int_adc){
+			outprintf ("#adc_read:   int32\n");
+		}
+	 	outprintf ("#voltage:    ");		/* (One value if they're all the same, else one per channel, comma-separated) */
+		print_list (outfile, "%.3f", readback_v1);
+		outprintf ("#gain:       ");
+		print_list (outfile, "%.1f", readback_g);
+		outprintf ("#coupling:   %s\n", INPUT_COUPLING_STR);
+		outprintf ("#terminal:   %s\n", TERMINAL_MODE_STR);
+		outprintf ("#trigger:    %s\n", TRIGGER_EDGE_STR);
+		outprintf ("#trigger_compensation:   %d\n",  TRIGGER_EARLY_BY);
+		outprintf ("#trigger_compensation_s: %f\n", (TRIGGER_EARLY_BY * sample_interval) );
+
+		/* Include the parseable data format in the output file, as well as -h above */
+		/* (Each per-channel field has one value per active channel (-k), in order: as here.) */
+		if (mode == LINREG){
+			outprintf ("#Data Format for lin_reg is: frame_number, end_timestamp, overload_occurred, missed_trigger, b_Dx (%s), a (%s),  b (%s), s (%s), se_a (%s), se_b (%s), r (%s), min (%s), max (%s)\n",
+				channels_arg, channels_arg, channels_arg, channels_arg, channels_arg, channels_arg, channels_arg, channels_arg, channels_arg);
+		}else if (mode == CDS_M){
+			outprintf ("#Data Format for cds_m is: frame_number, end_timestamp, overload_occurred, missed_trigger, D_cds (%s),  se_b_cds (%s), min (%s), max(%s)\n", channels_arg, channels_arg, channels_arg, channels_arg);
+		}else if (mode == RAW || mode == RAW_STREAM){
+			outprintf ("#Data Format for %s is: ", (mode == RAW) ? "raw" : "raw_stream");
+			print_names (outfile, "data_", "", ch_list);
+			outprintf ( (mode == RAW) ? "\n" : ". Each frame's summary line follows its data.\n");
+		}else if (mode == IMAGE){
+			outprintf ("#Data Format for image is: ");
+			print_names (outfile, "quad_", "", ch_list);
+			outprintf ("\n");
+		}else if (mode == IMAGE_CDS){
+			outprintf ("#Data Format for image_differential is: ");
+			print_names (outfile, "quad_", "_{frame_even - frame_odd}", ch_list);
+			outprintf ("\n");
+		}
+	}
+
+	/* Start the writer thread (after the header: the thread then owns outfile). */
+	outfile = out.f;
+	output_start (&out);
+	usr1_output = &out;
+
+	/* Real-time profile (--realtime): lock and pre-fault the memory, pin this thread to a CPU, SCHED_FIFO. (After output_start(), so the writer thread isn't.) */
+	realtime_prefault (&rt, data, sizeof(data));
+	realtime_prefault (&rt, data_i, sizeof(data_i));
+	if (ring_buf){
+		realtime_prefault (&rt, ring_buf, sizeof(data));
+	}
+	realtime_start (&rt);
+	rsched.busy_poll = rt.busy_poll;
+
 	//Set handler for Ctrl-C. Within the outer-while-loop, Ctrl-C will stop cleanly at the end of the current frame, not kill the program. */
 	signal(SIGINT, handle_signal_cc);
 
@@ -603,7 +2021,11 @@ int main(int argc, char* argv[]){
 			gettimeofday(&task_started, NULL); /* In a group of frames; task already running. Fudge the task_started time. */
 		}else{
 			vdeprintf ("Starting task (frame %d), [Also starts to send SampleClock out on %s so PulseBlaster HW_Trigger will succeed] ...\n", frame, RTSI6);
+			t_lat = lat_start();
 			handleErr( DAQmxStartTask(taskHandle) );
+			lat_record (LAT_START, t_lat);
+			readsched_start (&rsched);
+			task_first = samples_read_total;
 			state = "Ready/Running";
 			gettimeofday(&task_started, NULL);
 			if (frame == 0){	/* Make it explicit, especially if we have just received a trigger and failed to respond to it because we were not ready! */
@@ -614,6 +2036,11 @@ int main(int argc, char* argv[]){
 				unlink (triggerready_filename);
 				do_triggerready_delete = 1; 
 			}
+			carry = 0;
+			skip = (group_size == -1) ? cont_offset : 0;	/* Continuous mode: discard the offset before the first frame. */
+			if (skip > 0){
+				vdeprintf  ("Will discard %d points, the offset of the first frame after the trigger.\n", cont_offset);
+			}
 		}
 
 		/* Start of frame (NB this is before the trigger pulse arrives, NOT once triggered). */
@@ -628,6 +2055,9 @@ int main(int argc, char* argv[]){
 			stopstart_interval = timestamp_diff (task_started, task_prestop);
 			if (group_pos == 0){	/* task overhead */
 				deprintf ("TaskStop()...TaskStart() overhead took %.3f ms.\n", stopstart_interval * 1000);
+				if (lat_enabled){
+					lat_add (LAT_STOPSTART, stopstart_interval * 1e9);
+				}
 				if (stopstart_interval > (SLOW_TASKLOOP_DETECT_MS / 1000)){   /* warn if > 1ms. */
 					if (debug){
 						feprintf ("Fatal Error: TaskStop()...TaskStart() took %.3f ms in frame %d. This exceeds the warning threshold, %f ms.\n", (stopstart_interval * 1000), prev_frame, SLOW_TASKLOOP_DETECT_MS);
@@ -657,99 +2087,74 @@ int main(int argc, char* argv[]){
 
 			/* Calculate the stats for previous frame, (frame -1) */
 			deprintf ("Processing data for frame %d.\n", prev_frame);
+			t_lat = lat_start();
 			n =  samples_read_inner - (guard_pre + guard_post);	/* Already ensured >=3 above, so ok to calculate stats. */
-			for (c=0; c < DEV_NUM_CH; c++){
-				b    [c]  =  ( n * S_xy[c] -  S_x[c] * S_y[c] ) /  ( n * S_xx[c] - pow(S_x[c],2) );		/*  b-hat, estimator for gradient. */
-				a    [c]  =  ( S_y[c] / n ) - ( b[c] * S_x[c] / n);						/*  a-hat, estimator for y-intercept. */
-				s    [c]  =  sqrt(fabs( (1.0 / (n * (n-2))) * ( n * S_yy[c] - pow(S_y[c],2) - (pow(b[c],2) * (n * S_xx[c] - pow(S_x[c],2)) ) )));  /* sigma-hat, (estimator of std-dev of noise) */
-				se_b [c]  =  sqrt (fabs ( ( n * pow(s[c],2) ) / ( n * S_xx[c] - pow(S_x[c],2) ) ) );		/* std err in b-hat */
-				se_a [c]  =  sqrt ( pow(se_b[c],2) * S_xx[c] / n );						/* std err in a-hat */
-				r    [c]  =  ( (n * S_xy[c]) - (S_x[c] * S_y[c]) ) / sqrt(fabs( (n * S_xx[c] - pow(S_x[c],2)) * (n * S_yy[c] - pow(S_y[c],2)) ));  /* r-hat, estimator for Pearson's product-moment-correlation-coefficient. */
+			if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){		/* ...but in the imaging modes, the stats are of the pixels only (internal guards excluded). */
+				n = num_pixels;
+			}
+			for (c=0; c < num_ch; c++){
+				b    [c]  =  (mode == LINREG) ? sums.S_wy[c] : 0;								/*  b-hat, estimator for gradient: the dot product with the OLS weights. */
+				a    [c]  =  ( sums.S_y[c] / n ) - ( b[c] * S_x / n);							/*  a-hat, estimator for y-intercept. */
+				s    [c]  =  sqrt(fabs( (1.0 / (n * (n-2))) * ( n * sums.S_yy[c] - pow(sums.S_y[c],2) - (pow(b[c],2) * Dx) )));  /* sigma-hat, (estimator of std-dev of noise) */
+				se_b [c]  =  sqrt (fabs ( ( n * pow(s[c],2) ) / Dx ) );						/* std err in b-hat */
+				se_a [c]  =  sqrt ( pow(se_b[c],2) * S_xx / n );							/* std err in a-hat */
+				r    [c]  =  ( b[c] * Dx ) / sqrt(fabs( Dx * (n * sums.S_yy[c] - pow(sums.S_y[c],2)) ));		/* r-hat, estimator for Pearson's product-moment-correlation-coefficient. (n*S_xy - S_x*S_y = b*Dx) */
 				b_Dx [c]  =  b[c] * n;										/* b_delta_x:  best estimate for the total change in signal */
-				mean [c]  =  S_y[c] / n;									/* sample mean */
-				stdev[c]  =  sqrt(fabs( (1.0/(n-1)) * (S_yy[c] - (pow(S_y[c],2) / n)) ) );			/* sample std-dev */
-			      /*min  [c]     already calculated */
-			      /*max  [c]     already calculated */
-			        D_cds[c]  =  ((S_y_g2[c] - S_y_g1[c])/num_cdsm) * (n/(n - num_cdsm));				/* Best estimate for delta, using CDS_m. */
+				mean [c]  =  sums.S_y[c] / n;									/* sample mean */
+				stdev[c]  =  sqrt(fabs( (1.0/(n-1)) * (sums.S_yy[c] - (pow(sums.S_y[c],2) / n)) ) );			/* sample std-dev */
+				min  [c]  =  sums.min[c];									/* min and max were found in the accumulation kernel. */
+				max  [c]  =  sums.max[c];
+				D_cds[c]  =  (mode == CDS_M) ? fowler_delta (S_y_g1[c], S_y_g2[c], n, num_cdsm) : 0;			/* Best estimate for delta, using CDS_m. */
 				stdev_cds_g1[c] = sqrt(fabs( (1.0/(num_cdsm-1)) * (S_yy_g1[c] - (pow(S_y_g1[c],2) / num_cdsm) ) ));  /* stddev for 1st cds half */
 				stdev_cds_g2[c] = sqrt(fabs( (1.0/(num_cdsm-1)) * (S_yy_g2[c] - (pow(S_y_g2[c],2) / num_cdsm) ) ));  /* stddev for 2nd cds half */
 				se_b_cds[c]  =  quadrature_add2 ( stdev_cds_g1[c], stdev_cds_g2[c] ) / num_cdsm;		  /* overall stddev in the estimate of the gradient. (i.e. scale by 1/num_cds) */
 			}
 
-			if (mode == LINREG){  		/* Linear regression mode */
-
-				/* Human-readable summary. NB: Error_uV is the error in the estimate of Delta_uV. */
-				outprintf ("#Frame: %4d; Endtime: %.9f; Delta_uV: % f, % f, % f, % f; Error_uV: % f, % f, % f, % f; Total_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n",
-					prev_frame, correct_timestamp(frame_end, sample_interval),
-					b_Dx[0]*1e6, b_Dx[1]*1e6, b_Dx[2]*1e6, b_Dx[3]*1e6,	  se_b[0]*n*1e6, se_b[1]*n*1e6, se_b[2]*n*1e6, se_b[3]*n*1e6,
-					(b_Dx[0] + b_Dx[1] + b_Dx[2] + b_Dx[3])*1e6,
-					quadrature_add4 (se_b[0], se_b[1], se_b[2], se_b[3]) *n*1e6,
-					(overload_occurred?"OVL":"OK"), (missed_trigger?"MISS":"OK"));
-
-				/* Parseable data: all one line, tab-separated. Also, see above where this is documented. Consider %g instead? */
-				outprintf ("%d\t%f\t%d\t%d\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\n",
-					prev_frame, correct_timestamp(frame_end, sample_interval), (int)overload_occurred, missed_trigger, b_Dx[0], b_Dx[1], b_Dx[2], b_Dx[3],
-					a[0], a[1], a[2], a[3],	   b[0], b[1], b[2], b[3],   s[0], s[1], s[2], s[3],   se_a[0], se_a[1], se_a[2], se_a[3],   se_b[0], se_b[1], se_b[2], se_b[3],
-					r[0], r[1], r[2], r[3],    min[0], min[1], min[2], min[3],  max[0], max[1], max[2], max[3]);
-
-			}else if (mode == CDS_M){	/* Correlated double sampling, with multiple, averaged reads */
-
-				/* Human-readable summary */
-				outprintf ("#Frame: %4d; Endtime: %.9f; Delta_uV: % f, % f, % f, % f; Error_uV: % f, % f, % f, % f; Total_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n",
-				prev_frame, correct_timestamp(frame_end, sample_interval), D_cds[0]*1e6, D_cds[1]*1e6, D_cds[2]*1e6, D_cds[3]*1e6,
-				se_b_cds[0]*n*1e6, se_b_cds[1]*n*1e6, se_b_cds[2]*n*1e6, se_b_cds[3]*n*1e6,
-				(D_cds[0] + D_cds[1] + D_cds[2] + D_cds[3])*1e6,
-				quadrature_add4 (se_b_cds[0], se_b_cds[1], se_b_cds[2], se_b_cds[3]) *n*1e6,
-				(overload_occurred?"OVL":"OK"), (missed_trigger?"MISS":"OK"));
-
-				/* Parseable data. */
-				outprintf ("%d\t%f\t%d\t%d\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\t%.9f\n",
-				prev_frame, correct_timestamp(frame_end, sample_interval), (int)overload_occurred, missed_trigger,
-				D_cds[0], D_cds[1], D_cds[2], D_cds[3],  se_b_cds[0], se_b_cds[1], se_b_cds[2], se_b_cds[3],
-				min[0], min[1], min[2], min[3],  max[0], max[1], max[2], max[3]);
-
-			}else if (mode == RAW){		/* Raw data mode. */
-
-				/* Human-readable summary: mean/stdev rather than linreg. */
-				outprintf ("#Frame: %4d; Endtime: %.9f; Means_uV: % f, % f, % f, % f; StdDev_uV: % f, % f, % f, % f; Overall_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n",
-					prev_frame, correct_timestamp(frame_end, sample_interval),
-					mean[0]*1e6, mean[1]*1e6, mean[2]*1e6, mean[3]*1e6, stdev[0]*1e6, stdev[1]*1e6, stdev[2]*1e6, stdev[3]*1e6,
-					(mean[0]+mean[1]+mean[2]+mean[3])*1e6, quadrature_add4 ( stdev[0], stdev[1], stdev[2], stdev[3])*1e6,
-					(overload_occurred?"OVL":"OK"), (missed_trigger?"MISS":"OK"));
-
-				/* Parseable data: output the raw data (excluding the start/end guard samples), in the regular 4-column format for eg fftplot */
-				for (i=0 ; (unsigned)i< (num_samples_per_frame - guard_pre - guard_post); i++){
-					outprintf ("%.9f\t%.9f\t%.9f\t%.9f\n",raw[0][i], raw[1][i], raw[2][i], raw[3][i] );  /* NB in dummy-mode, with -O3 (but not -O2), gcc complains WRONGLY that "raw[X] may be used uninitialized in this function" */
+			/* Output (image_diff: every 2nd frame). Hand the results to the writer (thread), so we don't wait on stdio. With a writer thread, the slot takes */
+			/* the raw/pixel arrays (zero-copy), and we take its spare ones for the next frame. [image_diff: copy the difference, we still need both arrays.] */
+			if ( (mode != IMAGE_CDS) || ((prev_frame%2) == 0) ){
+				memset (&rec, 0, sizeof (rec));
+				rec.frame = prev_frame;		rec.overload = overload_occurred;	rec.missed_trigger = missed_trigger;	rec.n = n;
+				rec.endtime = correct_timestamp(frame_end, sample_interval);
+				for (c=0; c < num_ch; c++){
+					rec.b_Dx[c]  = b_Dx[c];		rec.a[c]        = a[c];		rec.b[c]     = b[c];	rec.s[c]     = s[c];
+					rec.se_a[c]  = se_a[c];		rec.se_b[c]     = se_b[c];	rec.r[c]     = r[c];
+					rec.D_cds[c] = D_cds[c];	rec.se_b_cds[c] = se_b_cds[c];
+					rec.mean[c]  = mean[c];		rec.stdev[c]    = stdev[c];	rec.min[c]   = min[c];	rec.max[c]   = max[c];
 				}
-
-			}else if (mode == IMAGE){	/* Image mode */
-
-				/* Human-readable summary. FIXME: is this really the most useful info in this case? */
-				outprintf ("#Frame: %4d; Endtime: %.9f; Means_uV: % f, % f, % f, % f; StdDev_uV: % f, % f, % f, % f; Overall_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n",
-					prev_frame, correct_timestamp(frame_end, sample_interval),
-					mean[0]*1e6, mean[1]*1e6, mean[2]*1e6, mean[3]*1e6, stdev[0]*1e6, stdev[1]*1e6, stdev[2]*1e6, stdev[3]*1e6,
-					(mean[0]+mean[1]+mean[2]+mean[3])*1e6, quadrature_add4 ( stdev[0], stdev[1], stdev[2], stdev[3])*1e6,
-					(overload_occurred?"OVL":"OK"), (missed_trigger?"MISS":"OK"));
-
-				/* Parseable data */
-				for (i=0 ; i<num_pixels; i++){
-					outprintf ("%.9f\t%.9f\t%.9f\t%.9f\n", pixels1[0][i], pixels1[1][i], pixels1[2][i], pixels1[3][i] );
+				if (ring){
+					shmring_put (ring, SHM_FRAME, num_ch, prev_frame, 0, &rec, sizeof (rec));
 				}
-
-			}else if (mode == IMAGE_CDS && (prev_frame%2) == 0){	/* Image Differential mode: every 2nd frame. */
-
-				/* Human-readable summary. FIXME: is this really the most useful info in this case? NB the means and stdDevs are for the 2nd frame, not the differences! */
-				outprintf ("#Frame: %4d; Endtime: %.9f; Means_uV: % f, % f, % f, % f; StdDev_uV: % f, % f, % f, % f; Overall_uV: %f +/- %f; Ovload: %s; MissTrig: %s\n",
-					prev_frame, correct_timestamp(frame_end, sample_interval),
-					mean[0]*1e6, mean[1]*1e6, mean[2]*1e6, mean[3]*1e6, stdev[0]*1e6, stdev[1]*1e6, stdev[2]*1e6, stdev[3]*1e6,
-					(mean[0]+mean[1]+mean[2]+mean[3])*1e6, quadrature_add4 ( stdev[0], stdev[1], stdev[2], stdev[3])*1e6,
-					(overload_occurred?"OVL":"OK"), (missed_trigger?"MISS":"OK"));
-
-				/* Parseable data 4 quadrants, frame_n - frame_n-1,  where n is even. */
-				for (i=0 ; i<num_pixels; i++){
-					outprintf ("%.9f\t%.9f\t%.9f\t%.9f\n", (pixels2[0][i] - pixels1[0][i]), (pixels2[1][i] - pixels1[1][i]), (pixels2[2][i] - pixels1[2][i]), (pixels2[3][i] - pixels1[3][i]) );
+				slot = output_get_slot (&out);
+				if (slot){
+					slot->rec = rec;
+					slot->sub = NULL;
+					slot->chunk = 0;
+					if (out.stream){		/* raw_stream: the data has gone already; this is just the trailer. */
+						slot->rows = 0;
+					}else if (out.depth == 0){		/* Inline: point at the arrays. */
+						for (c=0; (c < num_ch) && out.rows; c++){
+							slot->payload[c] = (mode == RAW) ? raw[c] : ( (mode == IMAGE_CDS) ? pixels2[c] : pixels1[c] );
+						}
+						slot->sub = (mode == IMAGE_CDS) ? pixels1 : NULL;
+					}else if (mode == RAW || mode == IMAGE){
+						pixels = (mode == RAW) ? raw : pixels1;
+						for (c=0; c < num_ch; c++){
+							slot->payload[c] = pixels[c];
+							pixels[c] = slot->own[c];
+							slot->own[c] = slot->payload[c];
+						}
+					}else if (mode == IMAGE_CDS){
+						for (c=0; c < num_ch; c++){
+							for (i=0; i < num_pixels; i++){
+								slot->payload[c][i] = pixels2[c][i] - pixels1[c][i];
+							}
+						}
+					}
+					output_put_slot (&out, slot);
 				}
 			}
+			lat_record (LAT_OUTPUT, t_lat);
 		}
 
 		/* Break now? */
@@ -760,118 +2165,176 @@ int main(int argc, char* argv[]){
 
 		/* --------------------------------------------------------------------------------------------- */
 		/* Inner loop. Repeatedly check for data from the NI 4462, read what we can, and pre-process it. */
-		/* As in ni4462_test.c, first do a non-blocking read, then (iff we got zero samples), do the blocking read. */
+		/* Reads aren't limited to this frame: a read may run on, through the group interval, into the next frame. The chunk is split at the exact sample: */
+		/* the interval part is dropped, and the next frame's part is carried over, and is its first chunk. So grouped frames read just like single ones. */
 
-		/* Zero the sums for start of frame. */
+		/* Zero the sums for start of frame. (With -S, the guard_pre samples are skipped, along with whatever precedes this frame.) */
 		samples_read_inner = 0;
-		px = 0; guard = 0;
+		if (driver_skip){
+			samples_read_inner = guard_pre;
+			skip += guard_pre;
+		}
+		frame_sums_reset (&sums);
 		for (c=0; c < DEV_NUM_CH; c++){
-			S_x[c] = S_xx[c] = S_y[c] = S_yy[c] = S_xy[c] = S_y_g1[c] = S_yy_g1[c] = S_y_g2[c] = S_yy_g2[c] = 0;
-			min[c] = 1e10; max[c] = -1e10;
+			S_y_g1[c] = S_yy_g1[c] = S_y_g2[c] = S_yy_g2[c] = 0;
+		}
+		if (int_adc){
+			frame_sums_i_reset (&sums_i);
+			frame_sums_i_reset (&cds_g1_i);
+			frame_sums_i_reset (&cds_g2_i);
 		}
 
 		/* Interleaved reading and calculating */
 		while (1){
 
-			/* First, let the device actually do some sampling! */
-
-			/* Non-blocking read of all the samples that are available. May return 0 or more samples (automatically safely limited by size of buffer). DAQmx_Val_Auto is non-blocking when DAQmxSetReadReadAllAvailSamp(TRUE) above */
-			/* Can only do the non-blocking read with group_size == 1: it could otherwise acquire MORE samples than we want in this frame! Non-blocking is desirable; it allows us to pre-process while still acquiring. */
-			if (group_size == 1){
-				vdeprintf  ("Non-blocking read of as many samples as available...\n");
-				handleErr( DAQmxReadAnalogF64(taskHandle, DAQmx_Val_Auto, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &samples_read_thistime, NULL) );
+			/* First, let the device actually do some sampling! The read scheduler picks the chunk, and sleeps until it should be ready; then the read of */
+			/* exactly that many returns at once. (The first read of a task blocks, waiting for the trigger.) See ni4462_readsched.c */
+			/* It may read up to the end of the next frame of this task (if any), so that the boundary needn't cost a short read. */
+			off = 0;
+			if (carry > 0){			/* The last frame's read ran into this one: use the rest of it first. */
+				got = carry;  off = carry_off;  carry = 0;
+				vdeprintf  ("Using %d samples carried over from the previous frame's last read (frame %d)...\n", (int)got, frame);
 			}else{
-				vdeprintf  ("Blocking read of exactly one frame of samples...\n");  /* Have to do it this way; else we could read part of the next frame. */
-				handleErr( DAQmxReadAnalogF64(taskHandle, (num_samples_per_frame - samples_read_inner), DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &samples_read_thistime, NULL) );
+				if (samples_read_total == 0){   /* First ever trigger */
+					eprintf ("Waiting for first external trigger (%s edge)...\n", TRIGGER_EDGE_STR);
+				}
+				ahead = skip + num_samples_per_frame - samples_read_inner;
+				if ( !chan_major && ( (group_size == -1) ? ( (num_frames == -1) || (frame + 1 < num_frames) ) : (group_pos + 1 < group_size) ) ){
+					ahead += group_interval + num_samples_per_frame;	/* Another frame follows, in this task. (Not -C: a carried-over channel-major tail would need repacking.) */
+				}
+				if (driver_skip){		/* Skip in the driver; then read only this frame's wanted samples. (Nothing to carry.) */
+					ahead = frame_last - samples_read_inner;
+					if (skip > 0){
+						vdeprintf  ("Skipping %lld points (guards, interval), in the driver.\n", (long long)skip);
+						handleErr( DAQmxSetReadOffset (taskHandle, skip) );
+						readsched_skip (&rsched, skip);
+						samples_read_total += skip;
+					}
+				}
+				n = readsched_next (&rsched, ahead);
+				vdeprintf  ("Reading %lld samples (frame %d)...\n", (long long)n, frame);
+				t_lat = lat_start();
+				handleErr( read_samples (n, fill_mode, data, int_adc ? data_i : NULL, (sizeof(data)/sizeof(data[0])), &got) );
+				readsched_done (&rsched, got);
+				lat_record ( (rsched.blocked ? LAT_READ_WAIT : LAT_READ), t_lat);
+				if (driver_skip && (skip > 0)){		/* (The offset applies to every read, until reset) */
+					handleErr( DAQmxSetReadOffset (taskHandle, 0) );
+					skip = 0;
+				}
 			}
 
+			/* Split the chunk: [skip | this frame | carry]. */
+			if (skip > 0){
+				n = (skip < (uInt64)got) ? skip : (uInt64)got;
+				vdeprintf  ("Discarding %d points, of the interval before this frame.\n", (int)n);
+				off += n;  got -= n;  skip -= n;
+				samples_read_total += n;
+			}
+			samples_read_thistime = ( (uInt64)got > frame_last - samples_read_inner ) ? (int32)(frame_last - samples_read_inner) : got;
+			if (samples_read_thistime < got){
+				carry = got - samples_read_thistime;
+				carry_off = off + samples_read_thistime;
+			}
+			if (samples_read_thistime == 0){	/* (All interval) */
+				continue;
+			}
+			if (off > 0){			/* The processing below wants this frame's part at the start of the buffer. */
+				shift_tuples (data, int_adc ? data_i : NULL, chan_major ? (off + got) : 0, off, samples_read_thistime);
+			}
+			ld = chan_major ? samples_read_thistime : 0;	/* Layout of the chunk, for the kernels: see CHUNK_IDX() */
+
 			n_this = samples_read_inner;
 			samples_read_inner += samples_read_thistime;
 			samples_read_total += samples_read_thistime;
 			vdeprintf  ("   ...acquired %d points this time; loop_total is: %lld.\n",(int)samples_read_thistime, (long long)samples_read_inner);
 
-			/* IFF we got zero samples, now do a blocking read, and wait. Otherwise, optimise: guess that it won't block, so proceed to the next iteration. */
-			if (samples_read_thistime == 0){
-				/* Blocking read of 1 sample. */
-				/* This is where we block, if waiting for an external trigger input */
-				if ( samples_read_total == 0) {   /* First ever trigger */
-					eprintf ("Waiting for first external trigger (%s edge)...\n", TRIGGER_EDGE_STR);
-				}else if ( (samples_read_inner == 0)  ){
-					vdeprintf ("Waiting for external trigger for frame %d (blocking read)...\n", frame);
-				}
-				handleErr( DAQmxReadAnalogF64(taskHandle, 1, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &samples_read_thistime, NULL) );
-				samples_read_inner += samples_read_thistime;
-				samples_read_total += samples_read_thistime;
-				vdeprintf  ("...acquired %d points this time; loop_total is: %lld.\n",(int)samples_read_thistime, (long long)samples_read_inner);
-			}
-
-			/* Dump (prefixed) raw data, if desired. Format for parseability:  #=frame_num,sample_num:\tval0\tval1\tval2\tval3. Don't skip the guard samples here. */
+			/* Dump (prefixed) raw data, if desired. Format for parseability:  #=frame_num,sample_num:\tval0\tval1\tval2\tval3 (one per active channel). Don't skip the guard samples here. */
 			if (dump_raw){
 				for (i=0; i < samples_read_thistime; i++){
-					outprintf ("#=%d,%d:\t% .9f\t% .9f\t% .9f\t% .9f\n", frame, (unsigned int)(n_this+i), data[DEV_NUM_CH*i+0], data[DEV_NUM_CH*i+1], data[DEV_NUM_CH*i+2],  data[DEV_NUM_CH*i+3] );
+					chunk_tuple (data, int_adc ? data_i : NULL, ld, i, &scale, v);	/* (In volts, either way) */
+					outprintf ("#=%d,%d:\t", frame, (unsigned int)(n_this+i));
+					print_vals (outfile, "\t", "% .9f", v, 1, 1);
+					outprintf ("\n");
 				}
 			}
 
-			/* Pre-process the data for this subgroup of this frame. */
-			/* Note: The counter i advances with the captured samples; px advances with the non-guard samples. */
-			for (i=0; i < samples_read_thistime; i++){
-				if ( (unsigned int)(n_this + i) < (unsigned int)(guard_pre) ){  				/* Skip first guard sample(s) */
-					continue;
-				}
-				if ( (unsigned int)(n_this + i) >= (unsigned int)(num_samples_per_frame - guard_post) ){	/* Skip final guard sample(s) */
-					continue;
-				}
-				if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){							/* Skip internal guard sample(s) in IMAGE modes */
-					if ( guard % (guard_internal+1) != 0) {
-						guard++;
-						continue;
-					}
+			/* Publish the raw chunk to the shared-memory ring, if any. The sample index is the device's: counted from this task's trigger, including the */
+			/* discarded (or driver-skipped) guard and interval samples. The ring's messages are tuples: a channel-major chunk is interleaved first, into ring_buf. */
+			if (ring){
+				size = int_adc ? sizeof (int32) : sizeof (float64);
+				ring_data = int_adc ? (void *)data_i : (void *)data;
+				if (chan_major){
+					interleave_tuples (ring_buf, ring_data, ld, samples_read_thistime, size);
+					ring_data = ring_buf;
 				}
+				shmring_put_raw (ring, int_adc ? SHM_RAW_I32 : SHM_RAW_F64, num_ch, frame, samples_read_total - task_first - samples_read_thistime, ring_data, samples_read_thistime, size);
+			}
 
- 				for (c=0; c < DEV_NUM_CH; c++){		/* Statistics.*/
- 					S_x  [c] +=  px;
- 					S_xx [c] +=  (px*px);
- 					S_y  [c] +=  data [DEV_NUM_CH*i +c];
- 					S_yy [c] +=  data [DEV_NUM_CH*i +c] * data [DEV_NUM_CH*i +c];
- 					S_xy [c] +=  px * data [DEV_NUM_CH*i +c];
- 					min  [c] =   (data [DEV_NUM_CH*i +c] < min[c]) ? data [DEV_NUM_CH*i +c] : min [c] ;
- 					max  [c] =   (data [DEV_NUM_CH*i +c] > max[c]) ? data [DEV_NUM_CH*i +c] : max [c] ;
+			/* Pre-process the data for this chunk of the frame: samples [n_this, n_this + samples_read_thistime). Rather than testing every sample against */
+			/* the guards, CDS windows and mode, split the chunk once into contiguous spans, [lo, hi) relative to data, and hand each to a branch-free kernel. */
+			if (chunk_span (n_this, samples_read_thistime, guard_pre, num_samples_per_frame - guard_post, &lo, &hi)){	/* The non-guard samples. */
+				q0 = n_this + lo - guard_pre;		/* Position of data[lo], counted from the first non-guard sample. */
+				if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){		/* Pixels are every (guard_internal+1)th sample; stride over the internal guard(s). */
+					i = ( (q0 + guard_internal) / (guard_internal+1) ) * (guard_internal+1);	/* first pixel at or after q0 */
+					count = (i < q0 + (hi - lo)) ? ( (q0 + (hi - lo) - i - 1) / (guard_internal+1) + 1 ) : 0;
+					pixels = ((mode == IMAGE_CDS) && (frame%2)) ? pixels2 : pixels1 ; /* Destination? In Image_CDS mode, odd and even frames go into different arrays */
+					if (int_adc){
+						accumulate_sums_i (&sums_i, data_i, ld, lo + i - q0, count, guard_internal+1, i / (guard_internal+1), NULL);
+						copy_tuples_i (pixels, i / (guard_internal+1), data_i, ld, lo + i - q0, count, guard_internal+1, &scale);
+					}else{
+						accumulate_sums (&sums, data, ld, lo + i - q0, count, guard_internal+1, i / (guard_internal+1), NULL);
+						copy_tuples (pixels, i / (guard_internal+1), data, ld, lo + i - q0, count, guard_internal+1);
+					}
+				}else if (int_adc){
+					accumulate_sums_i (&sums_i, data_i, ld, lo, hi - lo, 1, q0, weights);
+					if (mode == RAW){
+						copy_tuples_i (raw, q0, data_i, ld, lo, hi - lo, 1, compressed ? &codes : &scale);
+					}
+				}else{
+					accumulate_sums (&sums, data, ld, lo, hi - lo, 1, q0, weights);
+					if (mode == RAW){		/* Save it for later (after outputting the summary header) */
+						copy_tuples (raw, q0, data, ld, lo, hi - lo, 1);
+					}
 				}
-
-				if ( px < num_cdsm) {					/* CDS sum for group 1 */
-					for (c=0; c < DEV_NUM_CH; c++){
-						S_y_g1 [c]  += data [DEV_NUM_CH*i +c];
-						S_yy_g1 [c] += data [DEV_NUM_CH*i +c] * data [DEV_NUM_CH*i +c];
+				if (mode == RAW_STREAM){		/* Don't save it: send it now. Fill a chunk; it goes when full, or at the end of the frame. */
+					if ( chunk && (chunk->rows + (hi - lo) > out.rows) ){
+						output_put_slot (&out, chunk);
+						chunk = NULL;
 					}
-				}else if ( (unsigned int)px >= (num_samples_per_frame - guard_post - num_cdsm) ){
-					for (c=0; c < DEV_NUM_CH; c++){			/* CDS sum for group 2 */
-						S_y_g2  [c] += data [DEV_NUM_CH*i +c];
-						S_yy_g2 [c] += data [DEV_NUM_CH*i +c] * data [DEV_NUM_CH*i +c];
+					if (chunk == NULL){		/* (Never NULL: raw_stream doesn't drop) */
+						chunk = output_get_slot (&out);
+						chunk->chunk = 1;  chunk->rows = 0;  chunk->rec.frame = frame;
 					}
+					if (int_adc){
+						copy_tuples_i (chunk->payload, chunk->rows, data_i, ld, lo, hi - lo, 1, compressed ? &codes : &scale);
+					}else{
+						copy_tuples (chunk->payload, chunk->rows, data, ld, lo, hi - lo, 1);
+					}
+					chunk->rows += hi - lo;
 				}
-
-				/* If mode is RAW, save it for later (after outputting the summary header) */
-				if (mode == RAW){
-					for (c=0; c < DEV_NUM_CH; c++){
-						raw [c][px] = data [DEV_NUM_CH*i +c];
+			}
+			if (mode == CDS_M){			/* CDS sums for the first and last num_cdsm non-guard samples. */
+				if (chunk_span (n_this, samples_read_thistime, guard_pre, guard_pre + num_cdsm, &lo, &hi)){
+					if (int_adc){
+						accumulate_cds_i (&cds_g1_i, data_i, ld, lo, hi - lo);
+					}else{
+						accumulate_cds (S_y_g1, S_yy_g1, data, ld, lo, hi - lo);
 					}
 				}
-
-				/* If mode is IMAGE or IMAGE_CDS then save the data into the relevant pixels_x array */
-				if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){
-					pixels = ((mode == IMAGE_CDS) && (frame%2)) ? pixels2 : pixels1 ; /* Destination? In Image_CDS mode, odd and even frames go into different arrays */
-					for (c=0; c < DEV_NUM_CH; c++){
-						pixels [c][px] = data [DEV_NUM_CH*i +c];
+				if (chunk_span (n_this, samples_read_thistime, num_samples_per_frame - guard_post - num_cdsm, num_samples_per_frame - guard_post, &lo, &hi)){
+					if (int_adc){
+						accumulate_cds_i (&cds_g2_i, data_i, ld, lo, hi - lo);
+					}else{
+						accumulate_cds (S_y_g2, S_yy_g2, data, ld, lo, hi - lo);
 					}
 				}
-
-				px++;
-				guard++;
 			}
 
-			/* Have we now got all the samples we need for this loop? */
-			if ( samples_read_inner == num_samples_per_frame) {
-				vdeprintf ("Finished acquiring all %lld samples for this frame (%d)... breaking out of inner loop.\n", (long long)num_samples_per_frame, frame);
+			/* Have we now got all the samples we need for this loop? (With -S, the guard_post samples are skipped before the next frame.) */
+			if ( samples_read_inner == frame_last) {
+				vdeprintf ("Finished acquiring all %lld samples for this frame (%d)... breaking out of inner loop.\n", (long long)frame_last, frame);
+				skip = num_samples_per_frame - frame_last;
+				samples_read_inner += skip;	/* (Counted as read: they'll be skipped) */
 				break;
 			}
 		}
@@ -879,6 +2342,25 @@ int main(int argc, char* argv[]){
 		/* End of sampling */
 		gettimeofday(&frame_end, NULL);
 
+		/* raw_stream: send the rest of this frame's data. (Its record follows, as a trailer, with the next frame's processing.) */
+		if (chunk){
+			output_put_slot (&out, chunk);
+			chunk = NULL;
+		}
+
+		/* Int32 path: scale the (exact) integer sums to volts, once per frame. The stats, below, then don't care which path. */
+		if (int_adc){
+			frame_sums_scale (&sums_i, &scale, &sums);
+			if (mode == CDS_M){
+				frame_sums_scale (&cds_g1_i, &scale, &cds_g1);
+				frame_sums_scale (&cds_g2_i, &scale, &cds_g2);
+				for (c=0; c < num_ch; c++){
+					S_y_g1[c] = cds_g1.S_y[c];	S_yy_g1[c] = cds_g1.S_yy[c];
+					S_y_g2[c] = cds_g2.S_y[c];	S_yy_g2[c] = cds_g2.S_yy[c];
+				}
+			}
+		}
+
 		/* --------------------------------------------------------------------------------------------- */
 
 		/* (!!) Here, the NI4462 is done. We might have very little time between the last sample being read (i.e. end of this frame), and the start of the next frame. */
@@ -896,7 +2378,7 @@ int main(int argc, char* argv[]){
 
  		/* Stop the task. Then loop back, and start again immediately. Do NOT clear the task; we can go back and start again, using the same configuration. */
 		/* If we are WITHIN a group of frames, don't actually stop the task. Just save the timestamp, and if necessary, discard some intervening samples. */
-		group_pos++;
+		group_pos = (group_size == -1) ? 1 : (group_pos + 1);	/* (In continuous mode, the group never ends.) */
 		if (group_pos == group_size){		/* End of group (or the group-size is 1). Really stop the task; will then be started anew. */
 			gettimeofday(&group_end, NULL);
 			group_pos = 0;
@@ -904,32 +2386,47 @@ int main(int argc, char* argv[]){
 
 			gettimeofday(&task_prestop, NULL);
 			vdeprintf ("Stopping task (frame %d).\n", frame);
+			t_lat = lat_start();
 			handleErr( DAQmxStopTask(taskHandle) );
+			lat_record (LAT_STOP, t_lat);
 			state = "Stopped";
 		}else{					/* Within a group; don't stop the task (but fake the timestamp) */
 			gettimeofday(&task_prestop, NULL);
 			vdeprintf ("Continuing task within a group. (frame: %d, group_pos: %d)...\n", frame, group_pos);
-			if (group_interval > 0){	/* If necessary, skip samples for the group-interval. (We can't have another trigger-pulse, so use dead-reckoning). */
-				/* Blocking read of group_interval samples; throw these away; they are simply padding. */
-				n_discard = group_interval;
-				vdeprintf  ("Discarding %lld points for interval between frames in the same group.\n", (long long)n_discard);
-				while (n_discard > 0){	/* [discard in chunks of n_discard; group_interval could exceed BUFFER_SIZE_TUPLES]. */
-					n = (n_discard > BUFFER_SIZE_TUPLES) ? BUFFER_SIZE_TUPLES : n_discard;   
-					handleErr( DAQmxReadAnalogF64(taskHandle, n, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &samples_read_thistime, NULL) );
-					n_discard -= samples_read_thistime;
-				}
-			}
+			skip += group_interval;		/* Skip samples for the group-interval, at the start of the next frame's reads. (We can't have another trigger-pulse, so use dead-reckoning). */
 		}
 
 		frame++ ;
 	}
 
+	/* In continuous mode, the task is still running. Stop it. */
+	if (group_size == -1){
+		vdeprintf ("Stopping task (continuous mode).\n");
+		t_lat = lat_start();
+		handleErr( DAQmxStopTask(taskHandle) );
+		lat_record (LAT_STOP, t_lat);
+		state = "Stopped";
+	}
+
 	/* Clear task: we're done. This discards its configuration. [even if we omit this call, it is implicit when this program exits. */
 	handleErr( DAQmxClearTask(taskHandle) );
 
+	deprintf ("Read scheduler: %llu reads (%llu blocked, %llu after a sleep); read call overhead %.1f us; target chunk %llu samples.\n", (unsigned long long)rsched.calls,
+		(unsigned long long)rsched.blocks, (unsigned long long)rsched.sleeps, rsched.overhead * 1e6, (unsigned long long)readsched_target (&rsched));
+
+	/* Let the writer thread finish writing out. Tell the ring's readers that we're done. */
+	usr1_output = NULL;
+	output_finish (&out);
+	if (lat_enabled){
+		lat_report();
+	}
+	if (ring){
+		shmring_close (ring);
+	}
+
 	/* Free memory for the pixel arrys (not strictly necessary at program end.) */
-	if ( (mode == IMAGE) || (mode || IMAGE_CDS) ){
-		for (i=0; i < DEV_NUM_CH; i++){
+	if ( (mode == IMAGE) || (mode == IMAGE_CDS) ){
+		for (i=0; i < num_ch; i++){
 			free (pixels1[i]);
 			pixels1[i] = NULL;
 			if (mode == IMAGE_CDS){
@@ -938,11 +2435,13 @@ int main(int argc, char* argv[]){
 			}
 		}
 	}else if (mode == RAW){
-		for (i=0; i < DEV_NUM_CH; i++){
+		for (i=0; i < num_ch; i++){
 			free (raw[i]);
 			raw[i] = NULL;
 		}
 	}
+	free (weights);
+	free (ring_buf);
 
 	/* Done! */
 	deprintf ("Cleaning up after libnidaqmx: removing lockfiles from NI tempdir, %s .\n", LIBDAQMX_TMPDIR)   /* libdaqmx should clean up its own lockfiles, but doesn't. */
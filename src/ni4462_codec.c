@@ -0,0 +1,335 @@
+/* Lossless compressed stream of int32 ADC codes (ni4462_test -Z, ni4462_capture -o compressed), and its decoder (ni4462_decode). (#included by all three)
+   Archiving the ASCII output as .dat.bz2 takes far longer than the capture did. The ADC codes are 24-bit, but neighbouring samples are close: so, for each
+   block of CODEC_BLOCK_TUPLES tuples and each channel, predict every sample from the previous 0, 1 or 2 (constant, linear), choosing whichever order gives
+   the smallest residuals, and Rice-code the residuals (zigzag to unsigned, then u >> k in unary, and the low k bits), with k chosen from their mean. That's
+   tens of MSamples/s on one core: far more than 4 x 204.8 kHz. Noise-dominated data compresses to about (noise bits + 2) per sample.
+   Every block is independently decodable (it starts with its first samples verbatim), and starts with a sync word, its size and a CRC-32: so a damaged or
+   truncated file loses only the blocks that are damaged. Text blocks carry the '#' lines that the ASCII output would have had, in order with the data: the
+   decoder writes them back out verbatim, and the data as the ASCII rows (codes, "%d"; or volts, via the header's scaling polynomial), ie the .dat text.
+   The stream ends with an empty text block, whose 'first' is the total number of tuples: so the decoder can count what's missing at the end, too.
+   The structs are little-endian (x86), with no padding.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#define CODEC_MAGIC		"NI4462CZ"				/* 8 bytes, no NUL */
+#define CODEC_VERSION		1
+#define CODEC_SYNC		0x4b4c425a				/* "ZBLK": starts every block */
+#define CODEC_BLOCK_TUPLES	4096					/* The most tuples in one data block */
+#define CODEC_MAX_CH		4
+#define CODEC_SCALE_COEFFS	4
+#define CODEC_MAX_ORDER		2					/* Predictor: 0 (x), 1 (x - x[-1]), 2 (x - 2x[-1] + x[-2]) */
+#define CODEC_MAX_K		30
+#define CODEC_ESCAPE		24					/* A residual whose unary part would be this long is stored verbatim (32 bits) instead */
+#define CODEC_TEXT_MAX		(1024 * 1024)				/* The most text in one block */
+#define CODEC_BLOCK_MAX		(sizeof (struct codec_block) + CODEC_MAX_CH * (sizeof (struct codec_chan) + CODEC_BLOCK_TUPLES * (CODEC_ESCAPE + 32 + 7) / 8))
+
+enum codec_type { CODEC_DATA = 1, CODEC_TEXT = 2 };
+
+struct codec_header {
+	char     magic[8];			/* CODEC_MAGIC */
+	uint32_t version;			/* CODEC_VERSION */
+	uint32_t header_bytes;			/* sizeof (struct codec_header): the first block follows */
+	uint32_t num_channels;			/* Values per tuple */
+	uint32_t block_tuples;			/* The most tuples per data block */
+	uint32_t volts_digits;			/* How the writer's ASCII output showed the data: 0: codes ("%d"), else volts, with this many decimals ("%.9f") */
+	uint32_t reserved;
+	double   scale[CODEC_MAX_CH][CODEC_SCALE_COEFFS];	/* Per channel: volts = sum_k scale[c][k] * code^k */
+};
+
+struct codec_block {
+	uint32_t sync;				/* CODEC_SYNC */
+	uint32_t type;				/* enum codec_type */
+	uint32_t bytes;				/* Bytes that follow this struct */
+	uint32_t tuples;			/* CODEC_DATA: tuples in the block */
+	uint64_t first;				/* Index of the block's first tuple in the stream. (CODEC_TEXT: tuples before it) */
+	uint32_t crc;				/* CRC-32 of the bytes that follow */
+	uint32_t reserved;
+};
+
+struct codec_chan {			/* Data block: for each channel, one of these, then its residuals: 'bytes' of Rice code, MSB first, padded to a byte */
+	uint8_t  order;				/* Predictor order */
+	uint8_t  k;				/* Rice parameter */
+	uint16_t reserved;
+	uint32_t bytes;
+	int32_t  warmup[CODEC_MAX_ORDER];	/* The first 'order' samples, verbatim */
+};
+
+struct codec {
+	FILE    *f;
+	struct codec_header hdr;
+	int      have;				/* Tuples in x[][], not yet written */
+	uint64_t tuples;			/* Tuples written */
+	uint64_t written;			/* Bytes written */
+	int32_t  x[CODEC_MAX_CH][CODEC_BLOCK_TUPLES];		/* The block being filled, channel-major */
+	unsigned char out[CODEC_BLOCK_MAX];
+};
+
+static uint32_t codec_crc_table[256];
+
+/* CRC-32 (IEEE 802.3, as zlib) of n bytes. */
+uint32_t codec_crc (const unsigned char *p, size_t n){
+	uint32_t crc = 0xffffffff, c;
+	int      i, j;
+	if (codec_crc_table[1] == 0){
+		for (i=0; i < 256; i++){
+			for (c = i, j=0; j < 8; j++){
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			}
+			codec_crc_table[i] = c;
+		}
+	}
+	while (n--){
+		crc = codec_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffff;
+}
+
+/* Start the stream on f: write the header, for tuples of num_channels values, with the scaling polynomial scale[c][] (code to volts; NULL if unknown), and */
+/* volts_digits (see struct codec_header). Returns 0, or -1 if the write failed. */
+int codec_start (struct codec *z, FILE *f, int num_channels, int volts_digits, double scale[][CODEC_SCALE_COEFFS]){
+	z->f = f;
+	z->have = 0;
+	z->tuples = 0;
+	memset (&z->hdr, 0, sizeof (z->hdr));
+	memcpy (z->hdr.magic, CODEC_MAGIC, sizeof (z->hdr.magic));
+	z->hdr.version = CODEC_VERSION;
+	z->hdr.header_bytes = sizeof (z->hdr);
+	z->hdr.num_channels = num_channels;
+	z->hdr.block_tuples = CODEC_BLOCK_TUPLES;
+	z->hdr.volts_digits = volts_digits;
+	if (scale){
+		memcpy (z->hdr.scale, scale, num_channels * sizeof (z->hdr.scale[0]));
+	}
+	z->written = sizeof (z->hdr);
+	return (fwrite (&z->hdr, sizeof (z->hdr), 1, f) == 1) ? 0 : -1;
+}
+
+/* Rice-code the residuals of x[0 ... n-1], as struct codec_chan then the bits, at p. Returns the end. */
+unsigned char *codec_encode_chan (const int32_t *x, int n, unsigned char *p){
+	struct codec_chan *ch = (struct codec_chan *)p;
+	uint64_t s[CODEC_MAX_ORDER + 1] = {0, 0, 0}, acc = 0;
+	int64_t  e1, e2;
+	int      i, order = 0, k = 0, nacc = 0, ok1 = 1, ok2 = 1;
+	uint32_t u, q;
+	unsigned char *start;
+
+	/* Choose the predictor: the smallest sum of |residuals|. (Orders whose residuals don't fit in an int32 can't be used: not for 24-bit codes, though.) */
+	for (i = CODEC_MAX_ORDER; i < n; i++){
+		e1 = (int64_t)x[i] - x[i-1];
+		e2 = e1 - ((int64_t)x[i-1] - x[i-2]);
+		s[0] += llabs ((int64_t)x[i]);
+		s[1] += llabs (e1);
+		s[2] += llabs (e2);
+		ok1 &= (e1 == (int32_t)e1);
+		ok2 &= (e2 == (int32_t)e2);
+	}
+	if (n > CODEC_MAX_ORDER){
+		order = (ok1 && (s[1] < s[0])) ? 1 : 0;
+		order = (ok2 && (s[2] < s[order])) ? 2 : order;
+	}
+	while ( (k < CODEC_MAX_K) && ( ((uint64_t)(n - order) << (k + 1)) <= 2 * s[order] ) ){	/* k ~ log2 (mean u), where u ~ 2|e| */
+		k++;
+	}
+
+	memset (ch, 0, sizeof (*ch));
+	ch->order = order;
+	ch->k = k;
+	for (i=0; (i < order) && (i < n); i++){
+		ch->warmup[i] = x[i];
+	}
+	p = start = p + sizeof (*ch);
+	for (i = order; i < n; i++){
+		e1 = (order == 0) ? x[i] : ( (order == 1) ? ((int64_t)x[i] - x[i-1]) : ((int64_t)x[i] - 2 * (int64_t)x[i-1] + x[i-2]) );
+		u = ((uint32_t)e1 << 1) ^ (uint32_t)(-(int32_t)(e1 < 0));	/* zigzag: 0, -1, 1, -2, 2... -> 0, 1, 2, 3, 4... */
+		q = u >> k;
+		if (q < CODEC_ESCAPE){		/* q zeros, a one, then the low k bits */
+			acc = (acc << (q + 1)) | 1;
+			nacc += q + 1;
+			acc = (acc << k) | (u & ((1u << k) - 1));
+			nacc += k;
+		}else{				/* CODEC_ESCAPE zeros, then u */
+			acc = (acc << CODEC_ESCAPE);
+			nacc += CODEC_ESCAPE;
+			while (nacc >= 8){
+				nacc -= 8;
+				*p++ = acc >> nacc;
+			}
+			acc = (acc << 32) | u;
+			nacc += 32;
+		}
+		while (nacc >= 8){
+			nacc -= 8;
+			*p++ = acc >> nacc;
+		}
+	}
+	if (nacc){
+		*p++ = acc << (8 - nacc);
+	}
+	ch->bytes = p - start;
+	return p;
+}
+
+/* Write out the tuples in x[][], if any, as one data block. Returns 0, or -1 if the write failed. */
+int codec_flush (struct codec *z){
+	struct codec_block *b = (struct codec_block *)z->out;
+	unsigned char *p = z->out + sizeof (*b);
+	unsigned c;
+	if (z->have == 0){
+		return 0;
+	}
+	for (c=0; c < z->hdr.num_channels; c++){
+		p = codec_encode_chan (z->x[c], z->have, p);
+	}
+	b->sync = CODEC_SYNC;
+	b->type = CODEC_DATA;
+	b->bytes = p - z->out - sizeof (*b);
+	b->tuples = z->have;
+	b->first = z->tuples;
+	b->crc = codec_crc (z->out + sizeof (*b), b->bytes);
+	b->reserved = 0;
+	z->tuples += z->have;
+	z->have = 0;
+	z->written += p - z->out;
+	return (fwrite (z->out, p - z->out, 1, z->f) == 1) ? 0 : -1;
+}
+
+/* Append count tuples: value c of tuple i is d[ss*i + cs*c] (as in ni4462_test's kernels). Blocks are written as they fill. Returns 0, or -1. */
+int codec_put (struct codec *z, const int32_t *d, int count, int ss, int cs){
+	int i, c, n, ret = 0;
+	while (count > 0){
+		n = (count < CODEC_BLOCK_TUPLES - z->have) ? count : (CODEC_BLOCK_TUPLES - z->have);
+		for (c=0; c < (int)z->hdr.num_channels; c++){
+			for (i=0; i < n; i++){
+				z->x[c][z->have + i] = d[ss*i + cs*c];
+			}
+		}
+		z->have += n;
+		d += ss * n;
+		count -= n;
+		if (z->have == CODEC_BLOCK_TUPLES){
+			ret |= codec_flush (z);
+		}
+	}
+	return ret;
+}
+
+/* The size of the stream so far, including the tuples not yet written: those are estimated at its rate so far (or uncompressed, before the first block). */
+uint64_t codec_size (const struct codec *z){
+	double per_tuple = z->tuples ? (double)z->written / z->tuples : (double)(z->hdr.num_channels * sizeof (int32_t));
+	return z->written + (uint64_t)(z->have * per_tuple) + (z->have ? sizeof (struct codec_block) : 0);
+}
+
+/* Append text (eg the '#' lines), in order with the data: the pending tuples are written first. Returns 0, or -1. */
+int codec_text (struct codec *z, const char *text, size_t len){
+	struct codec_block b;
+	int    ret = codec_flush (z);
+	for ( ; len > 0; text += b.bytes, len -= b.bytes){
+		memset (&b, 0, sizeof (b));
+		b.sync = CODEC_SYNC;
+		b.type = CODEC_TEXT;
+		b.bytes = (len < CODEC_TEXT_MAX) ? len : CODEC_TEXT_MAX;
+		b.first = z->tuples;
+		b.crc = codec_crc ((const unsigned char *)text, b.bytes);
+		z->written += sizeof (b) + b.bytes;
+		if ( (fwrite (&b, sizeof (b), 1, z->f) != 1) || (fwrite (text, b.bytes, 1, z->f) != 1) ){
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+/* Finish: write the last (partial) block, and the end marker (an empty text block), and flush. Returns 0, or -1. */
+int codec_finish (struct codec *z){
+	struct codec_block b;
+	int    ret = codec_flush (z);
+	memset (&b, 0, sizeof (b));
+	b.sync = CODEC_SYNC;
+	b.type = CODEC_TEXT;
+	b.first = z->tuples;
+	b.crc = codec_crc (NULL, 0);
+	z->written += sizeof (b);
+	return ( ret || (fwrite (&b, sizeof (b), 1, z->f) != 1) || fflush (z->f) ) ? -1 : 0;
+}
+
+
+/* Decoder. Read the next block: its struct into b, and the bytes that follow into payload (room for CODEC_TEXT_MAX or CODEC_BLOCK_MAX bytes, whichever */
+/* is more). Returns 1, 0 at the end of the stream, or -1 if the block is damaged (or cut short): then, the next call looks for the next sync word. */
+int codec_read_block (FILE *f, struct codec_block *b, unsigned char *payload){
+	size_t   n = fread (b, 1, sizeof (*b), f);
+	unsigned char *s = (unsigned char *)b;
+	if (n == 0){
+		return 0;
+	}
+	while ( (n < sizeof (*b)) || (b->sync != CODEC_SYNC) ){	/* Resynchronise: slide along a byte at a time, until there's a sync word */
+		if (n == sizeof (*b)){
+			memmove (s, s + 1, --n);
+		}
+		if (fread (s + n, 1, 1, f) != 1){
+			return (n == 0) ? 0 : -1;
+		}
+		n++;
+	}
+	if ( ( (b->type != CODEC_DATA) && (b->type != CODEC_TEXT) ) || (b->bytes > ( (CODEC_TEXT_MAX > CODEC_BLOCK_MAX) ? CODEC_TEXT_MAX : CODEC_BLOCK_MAX ) ) ||
+	     ( (b->type == CODEC_DATA) && ( (b->tuples == 0) || (b->tuples > CODEC_BLOCK_TUPLES) ) ) ){
+		return -1;
+	}
+	if ( (fread (payload, 1, b->bytes, f) != b->bytes) || (codec_crc (payload, b->bytes) != b->crc) ){
+		return -1;
+	}
+	return 1;
+}
+
+/* Decode a data block's payload (from codec_read_block()) into x[c][0 ... b->tuples - 1]. Returns 0, or -1 if it's inconsistent. */
+int codec_decode (const struct codec_block *b, const unsigned char *payload, int num_channels, int32_t x[][CODEC_BLOCK_TUPLES]){
+	const unsigned char *p = payload, *end = payload + b->bytes, *e;
+	struct codec_chan ch;
+	uint64_t acc;
+	uint32_t u;
+	int      c, i, n, q, k, order, nacc;
+	int32_t *y;
+	for (c=0; c < num_channels; c++){
+		if (p + sizeof (ch) > end){
+			return -1;
+		}
+		memcpy (&ch, p, sizeof (ch));
+		p += sizeof (ch);
+		order = ch.order;  k = ch.k;  e = p + ch.bytes;  n = b->tuples;  y = x[c];
+		if ( (order > CODEC_MAX_ORDER) || (k > CODEC_MAX_K) || (e > end) ){
+			return -1;
+		}
+		for (i=0; (i < order) && (i < n); i++){
+			y[i] = ch.warmup[i];
+		}
+		acc = 0;  nacc = 0;		/* acc: the next nacc bits, left-aligned. Keep at least 57 (the longest code, 24 + 32 bits, and its 1) */
+		for (i = order; i < n; i++){
+			while ( (nacc <= 56) && (p < e) ){
+				acc |= (uint64_t)*p++ << (56 - nacc);
+				nacc += 8;
+			}
+			q = acc ? __builtin_clzll (acc) : 64;
+			if (q >= CODEC_ESCAPE){
+				if (nacc < CODEC_ESCAPE + 32){
+					return -1;
+				}
+				u = acc >> (64 - CODEC_ESCAPE - 32);
+				acc <<= CODEC_ESCAPE + 32;  nacc -= CODEC_ESCAPE + 32;
+			}else{
+				if (nacc < q + 1 + k){
+					return -1;
+				}
+				acc <<= q + 1;
+				u = ((uint32_t)q << k) | (k ? (uint32_t)(acc >> (64 - k)) : 0);
+				acc <<= k;  nacc -= q + 1 + k;
+			}
+			u = (u >> 1) ^ (uint32_t)(-(int32_t)(u & 1));	/* un-zigzag */
+			y[i] = (int32_t)( u + ( (order == 0) ? 0 : ( (order == 1) ? (uint32_t)y[i-1] : (uint32_t)(2 * (uint32_t)y[i-1] - (uint32_t)y[i-2]) ) ) );
+		}
+		p = e;
+	}
+	return 0;
+}
@@ -0,0 +1,174 @@
+/* Decoder for the compressed stream written by ni4462_test -Z or ni4462_capture -o compressed: turn it back into the ASCII (.dat) text that the program
+   would otherwise have written. The blocks are independent: a damaged block is reported (and skipped), and the rest of the file still decodes.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+/* Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "ni4462_codec.c"						/* The stream format */
+#include "ni4462_fmt.c"							/* Fast ASCII formatting. Also '-lm' */
+
+/* Macros */
+#define eprintf(...)	fprintf(stderr, __VA_ARGS__)				/* Error printf: send to stderr  */
+
+#define deprintf(...)	if (debug) { fprintf(stderr, __VA_ARGS__); }		/* Debug error printf: print to stderr iff debug is set */
+
+#define feprintf(...)	fprintf(stderr, __VA_ARGS__); exit (EXIT_FAILURE)	/* Fatal error printf: send to stderr and exit */
+
+
+/* Globals */
+int debug = 0;
+unsigned char payload[ (CODEC_TEXT_MAX > CODEC_BLOCK_MAX) ? CODEC_TEXT_MAX : CODEC_BLOCK_MAX ];
+int32_t x[CODEC_MAX_CH][CODEC_BLOCK_TUPLES];
+struct fmtbuf out;
+
+
+/* Show help */
+void print_help(char *argv0){
+	argv0 = basename(argv0);
+	eprintf("INTRO: %s decodes the compressed stream written by 'ni4462_test -Z' or 'ni4462_capture -o compressed', and writes the ASCII text that\n"
+		"the program would otherwise have written (the '#' lines, and the data, one line per sample, channels tab-separated) to stdout.\n"
+		"The stream is blocks of %d samples, each independently decodable, with a CRC: a damaged block is skipped (and reported), not the rest of the file.\n"
+		"\n"
+		"USAGE:  %s  [OPTIONS]  [infile.z]\n"
+		"\n"
+		"OPTIONS:\n"
+		"   -h             print help and exit\n"
+		"   -d             debug: be much more verbose.\n"
+		"   -c             write the data as ADC codes ('%%d'). [default, for ni4462_test -Z, which writes int32adc].\n"
+		"   -v             write the data in volts, scaled by the polynomial in the stream's header ('%%.9f' for ni4462_capture, else '%%f').\n"
+		"                  [default, for ni4462_capture, which writes volts: then, the output is exactly its ascii output].\n"
+		"   -t             test: decode and check the whole stream, but write nothing. The exit status is non-zero if any block was damaged.\n"
+		"\n"
+		"NOTES:\n"
+		"  * With no infile, or '-', read stdin. Eg:  %s run.z | fftplot  or  %s run.z > run.dat.\n"
+		"  * The data are the int32 codes, as read. They are predicted from the previous 0, 1 or 2 samples, and the residuals Rice-coded, per block and channel.\n"
+		"  * A damaged block's samples are missing from the output: the summary on stderr gives the number lost. The exit status is then non-zero.\n"
+		"  * The stream ends with a marker that gives its total number of samples, so a damaged tail is counted too. Without it (cut short), there's a warning.\n"
+		"\n", argv0, CODEC_BLOCK_TUPLES, argv0, argv0, argv0);
+}
+
+/* Volts, from code q, for channel c: the polynomial, evaluated as ni4462_capture does, c0 + c1 * q, when it's linear. */
+double to_volts (const struct codec_header *h, int c, int32_t q){
+	const double *s = h->scale[c];
+	if ( (s[2] == 0) && (s[3] == 0) ){
+		return s[0] + s[1] * q;
+	}
+	return s[0] + q * (s[1] + q * (s[2] + q * s[3]));
+}
+
+/* Main */
+int main (int argc, char *argv[]){
+	int	opt; extern char *optarg; extern int optind, opterr, optopt;       /* getopt */
+	FILE   *in = stdin;
+	struct  codec_header h;
+	struct  codec_block b;
+	int     volts = -1, test = 0, digits, ret, c, ended = 0;
+	uint32_t i, nch;
+	uint64_t tuples = 0, lost = 0, blocks = 0, damaged = 0, text = 0;
+
+	while ((opt = getopt(argc, argv, "cdhtv")) != -1) {
+		switch (opt) {
+			case 'h':
+				print_help(argv[0]);
+				exit (EXIT_SUCCESS);
+				break;
+			case 'd':
+				debug = 1;
+				break;
+			case 'c':
+				volts = 0;
+				break;
+			case 'v':
+				volts = 1;
+				break;
+			case 't':
+				test = 1;
+				break;
+			default:
+				feprintf ("Unrecognised argument %c. Use -h for help.\n", optopt);
+				break;
+		}
+	}
+	if (argc - optind > 1){
+		feprintf ("Wrong number of non-option arguments: at most one (the input file) is allowed. Use -h for help.\n");
+	}
+	if ( (optind < argc) && strcmp (argv[optind], "-") && ( (in = fopen (argv[optind], "r")) == NULL) ){
+		feprintf ("Could not open %s: %s\n", argv[optind], strerror (errno));
+	}
+
+	if ( (fread (&h, sizeof (h), 1, in) != 1) || memcmp (h.magic, CODEC_MAGIC, sizeof (h.magic)) ){
+		feprintf ("Error: not a compressed ni4462 stream (no '%s' header).\n", CODEC_MAGIC);
+	}
+	if ( (h.version != CODEC_VERSION) || (h.header_bytes != sizeof (h)) || (h.num_channels < 1) || (h.num_channels > CODEC_MAX_CH) ){
+		feprintf ("Error: unsupported stream: version %u, header %u bytes, %u channels. (This decoder is version %d.)\n", h.version, h.header_bytes, h.num_channels, CODEC_VERSION);
+	}
+	nch = h.num_channels;
+	volts = (volts == -1) ? (h.volts_digits != 0) : volts;
+	digits = h.volts_digits ? (int)h.volts_digits : 6;
+	deprintf ("Stream: %u channels, blocks of up to %u tuples; writing %s.\n", nch, h.block_tuples, volts ? "volts" : "ADC codes");
+	fmt_init (&out, stdout);
+
+	/* Each block: text is written out as is; data is decoded, and written as rows. */
+	while ( (ret = codec_read_block (in, &b, payload)) != 0){
+		if (ret < 0){
+			damaged++;
+			eprintf ("Warning: damaged block, after sample %llu. Skipping to the next one.\n", (unsigned long long)tuples);
+			continue;
+		}
+		if (b.first > tuples + lost){		/* (A damaged data block: its tuples are missing) */
+			lost = b.first - tuples;
+		}
+		ended = (b.type == CODEC_TEXT) && (b.bytes == 0);	/* (The end marker: its 'first' is the total, so the check above counts a damaged tail too) */
+		if (b.type == CODEC_TEXT){
+			text += b.bytes;
+			if (!test){
+				fmt_flush (&out);
+				fwrite (payload, b.bytes, 1, stdout);
+			}
+			continue;
+		}
+		if (codec_decode (&b, payload, nch, x)){
+			damaged++;
+			eprintf ("Warning: block at sample %llu doesn't decode. Skipping it.\n", (unsigned long long)b.first);
+			continue;
+		}
+		blocks++;
+		tuples += b.tuples;
+		for (i=0; (i < b.tuples) && !test; i++){
+			for (c=0; c < (int)nch; c++){
+				if (volts){
+					fmt_f (&out, to_volts (&h, c, x[c][i]), digits, (c < (int)nch - 1) ? '\t' : '\n');
+				}else{
+					fmt_d (&out, x[c][i], (c < (int)nch - 1) ? '\t' : '\n');
+				}
+			}
+		}
+	}
+	if ( fmt_flush (&out) || fflush (stdout) ){
+		feprintf ("Error: couldn't write the output: %s\n", strerror (errno));
+	}
+
+	deprintf ("Decoded %llu samples (%llu blocks), and %llu bytes of text.\n", (unsigned long long)tuples, (unsigned long long)blocks, (unsigned long long)text);
+	if (!ended){
+		eprintf ("Warning: the stream has no end marker: it was cut short (or is still being written). Any samples after %llu are missing.\n", (unsigned long long)(tuples + lost));
+	}
+	if (damaged){
+		eprintf ("Error: %llu damaged blocks; at least %llu samples lost%s.\n", (unsigned long long)damaged, (unsigned long long)lost, ended ? "" : ", and the cut-off tail");
+		exit (EXIT_FAILURE);
+	}
+	return 0;
+}
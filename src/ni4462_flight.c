@@ -0,0 +1,138 @@
+/* Flight recorder (ni4462_test -F): keep the last few seconds of data in memory, and write a file only when something happens. (#included by ni4462_test.c)
+   Streaming 4 x 204.8 kHz to disk all day is ~ 6.5 MB/s (int32), for the sake of a few seconds around each event. Instead, each read is copied into a
+   preallocated ring of tuples, big enough for the pre-event history plus one read. An event (SIGUSR2; "event" on the control socket; or a sample on the
+   chosen channel crossing the level) starts a file, which gets the history from the ring, then the post-event data as it arrives. Then the recorder re-arms.
+   The control socket is a Unix datagram socket, so that polling it, once per read, never blocks: each datagram is one command.
+   Eg:  echo event | socat - UNIX-SENDTO:/tmp/ni4462_flight.socket
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FLIGHT_SOCKET		"/tmp/ni4462_flight.socket"		/* Default control socket (-K) */
+#define FLIGHT_CMD_MAX		64
+
+struct flight {
+	unsigned char *buf;			/* The ring: cap tuples */
+	size_t   tuple_bytes;
+	uint64_t cap;
+	uint64_t head;				/* Tuples put so far: tuple i is in the ring iff head - cap <= i < head */
+	int      sock;				/* Control socket, or -1 */
+	const char *sock_path;
+};
+
+/* Allocate the ring, for cap tuples of tuple_bytes, and touch it all now (not in the loop). Returns 0, or -1. */
+int flight_init (struct flight *r, size_t tuple_bytes, uint64_t cap){
+	memset (r, 0, sizeof (*r));
+	r->sock = -1;
+	r->tuple_bytes = tuple_bytes;
+	r->cap = cap;
+	if ( (r->buf = malloc (cap * tuple_bytes)) == NULL){
+		return -1;
+	}
+	memset (r->buf, 0, cap * tuple_bytes);
+	return 0;
+}
+
+/* Append n tuples (n <= cap), overwriting the oldest. */
+void flight_put (struct flight *r, const void *d, uint64_t n){
+	uint64_t at = r->head % r->cap, first = (n < r->cap - at) ? n : r->cap - at;
+	memcpy (r->buf + at * r->tuple_bytes, d, first * r->tuple_bytes);
+	memcpy (r->buf, (const unsigned char *)d + first * r->tuple_bytes, (n - first) * r->tuple_bytes);
+	r->head += n;
+}
+
+/* The oldest tuple still in the ring. */
+uint64_t flight_oldest (const struct flight *r){
+	return (r->head > r->cap) ? r->head - r->cap : 0;
+}
+
+/* Where tuple i is (flight_oldest() <= i < head), and (in *n) how many tuples follow it contiguously, up to the wrap or head. */
+const void *flight_at (const struct flight *r, uint64_t i, uint64_t *n){
+	uint64_t at = i % r->cap;
+	*n = (r->head - i < r->cap - at) ? r->head - i : r->cap - at;
+	return r->buf + at * r->tuple_bytes;
+}
+
+/* Level crossings: the first of n samples (sample i of channel c is d[ss*i + c]) with |value| >= level, where the one before was below it; or -1. */
+/* *prev carries |the last sample| over to the next read. (Start it as NAN: a signal that's already above the level isn't an event.) */
+int flight_level_f (const float64 *d, int n, int ss, int c, float64 level, float64 *prev){
+	int     i;
+	float64 p = *prev, a;
+	for (i=0; i < n; i++, p = a){
+		a = fabs (d[ss*i + c]);
+		if ( (a >= level) && (p < level) ){
+			break;
+		}
+	}
+	*prev = (n > 0) ? fabs (d[ss*(n-1) + c]) : *prev;
+	return (i < n) ? i : -1;
+}
+
+int flight_level_d (const int32 *d, int n, int ss, int c, float64 level, float64 *prev){
+	int     i;
+	float64 p = *prev, a;
+	for (i=0; i < n; i++, p = a){
+		a = fabs ((float64)d[ss*i + c]);
+		if ( (a >= level) && (p < level) ){
+			break;
+		}
+	}
+	*prev = (n > 0) ? fabs ((float64)d[ss*(n-1) + c]) : *prev;
+	return (i < n) ? i : -1;
+}
+
+/* Listen on the control socket, at path. (Remove a stale socket; but don't steal one that's in use.) Returns 0, or -1 (see errno). */
+int flight_listen (struct flight *r, const char *path){
+	struct sockaddr_un addr;
+	int fd;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen (path) >= sizeof (addr.sun_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strncpy (addr.sun_path, path, sizeof (addr.sun_path) - 1);
+	if ( (fd = socket (AF_UNIX, SOCK_DGRAM, 0)) < 0){
+		return -1;
+	}
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) == 0){
+		close (fd);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	close (fd);
+	unlink (path);
+	if ( ( (r->sock = socket (AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) || (bind (r->sock, (struct sockaddr *)&addr, sizeof (addr)) < 0) ){
+		return -1;
+	}
+	r->sock_path = path;
+	return 0;
+}
+
+/* Read any commands waiting on the control socket, without blocking. Returns how many were "event". (There are no others, yet: they're ignored.) */
+int flight_poll (struct flight *r){
+	char    cmd[FLIGHT_CMD_MAX];
+	ssize_t len;
+	int     events = 0;
+	while ( (r->sock >= 0) && ( (len = recv (r->sock, cmd, sizeof (cmd) - 1, MSG_DONTWAIT)) >= 0) ){
+		cmd[len] = '\0';
+		events += !strncmp (cmd, "event", 5);
+	}
+	return events;
+}
+
+/* Free the ring; close and remove the control socket. */
+void flight_close (struct flight *r){
+	if (r->sock >= 0){
+		close (r->sock);
+		unlink (r->sock_path);
+	}
+	free (r->buf);
+}
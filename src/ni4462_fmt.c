@@ -0,0 +1,132 @@
+/* Fast ASCII formatting of the data values, byte-identical to printf's "%f" / "%.9f" and "%d". (#included by ni4462_test.c and ni4462_capture.c)
+   The ASCII formats are the contract with fftplot, linregplot, numpy.loadtxt() etc, but printf() is slow: it parses the format, and does arbitrary precision
+   decimal conversion, for every value. Here, a value is converted exactly, with integer arithmetic: a double x = ip + frac, where ip = floor(|x|) and frac are
+   exact; frac is m / 2^k (m < 2^53), so the fraction digits are round(m * 10^prec / 2^k), computed exactly in 96 bits, rounding ties to even (as glibc does).
+   (Values >= 2^64, inf, nan, or more than FMT_MAX_PREC digits go to snprintf().) The text is built in a large buffer, which is handed over in one fwrite()
+   per read or frame: a buffer this big goes straight through to write(). Via the FILE, so that it stays in order with any other output (eg the '#' headers).
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#define FMT_BUF_BYTES		(256 * 1024)				/* Text buffered before each fwrite() */
+#define FMT_VAL_MAX		400					/* Room for any one value (the longest, "%.9f" of -DBL_MAX, is 320 chars) */
+#define FMT_MAX_PREC		9
+
+struct fmtbuf {
+	FILE   *f;
+	size_t  n;				/* Bytes in buf[] */
+	char    buf[FMT_BUF_BYTES];
+};
+
+static const uint32_t fmt_pow10[FMT_MAX_PREC + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+void fmt_init (struct fmtbuf *b, FILE *f){
+	b->f = f;
+	b->n = 0;
+}
+
+/* Hand the text over to the FILE. Returns 0, or -1 if the write failed. */
+int fmt_flush (struct fmtbuf *b){
+	size_t n = b->n;
+	b->n = 0;
+	return ( (n == 0) || (fwrite (b->buf, n, 1, b->f) == 1) ) ? 0 : -1;
+}
+
+/* Write the decimal digits of u, ending just before 'end'. Returns the start. */
+char *fmt_digits (char *end, uint64_t u){
+	uint32_t v;
+	while (u > UINT32_MAX){			/* (Rare: keep the 64-bit divisions out of the usual case, for 32-bit builds) */
+		*--end = '0' + (u % 10);
+		u /= 10;
+	}
+	v = u;
+	do {
+		*--end = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+/* Append x, as printf ("%.*f", prec, x) would, then the separator 'sep' (eg '\t', '\n'). */
+void fmt_f (struct fmtbuf *b, double x, int prec, char sep){
+	char     tmp[24], *s, *d;
+	double   a = fabs (x), frac, f;
+	uint64_t ip, m, lo, mid, hi, lo2;
+	uint32_t q = 0, P;
+	int      ex, k, j, halfbit, below, i;
+
+	if (b->n > FMT_BUF_BYTES - FMT_VAL_MAX){
+		fmt_flush (b);
+	}
+	d = b->buf + b->n;
+	if ( !(a < 18446744073709549568.0) || (prec < 0) || (prec > FMT_MAX_PREC) ){	/* (>= 2^64, inf, nan: !(a < ..) catches nan too) */
+		d += snprintf (d, FMT_VAL_MAX, "%.*f", prec, x);
+		*d++ = sep;
+		b->n = d - b->buf;
+		return;
+	}
+
+	ip = (uint64_t)a;				/* Exact */
+	frac = a - (double)ip;				/* Exact (Sterbenz) */
+	P = fmt_pow10[prec];
+	if (frac != 0){
+		f = frexp (frac, &ex);			/* frac = m / 2^k, exactly */
+		m = (uint64_t)ldexp (f, 53);
+		k = 53 - ex;				/* >= 53: frac < 1, so ex <= 0 */
+		if (k <= 84){				/* (Else m*P < 2^83 < half: it rounds to 0) */
+			lo  = (m & 0xffffffff) * P;	/* m*P, as hi:lo2 (< 2^83) */
+			mid = (m >> 32) * P;
+			lo2 = lo + (mid << 32);
+			hi  = (mid >> 32) + (lo2 < lo);
+			q   = (k < 64) ? ( (hi << (64 - k)) | (lo2 >> k) ) : (hi >> (k - 64));
+			j   = k - 1;			/* The "half" bit, and whether anything is below it: round to nearest, ties to even */
+			halfbit = (j < 64) ? ( (lo2 >> j) & 1 ) : ( (hi >> (j - 64)) & 1 );
+			below   = (j < 64) ? ( (lo2 & ((1ULL << j) - 1)) != 0 ) : ( (lo2 != 0) || ( (hi & ((1ULL << (j - 64)) - 1)) != 0 ) );
+			if ( halfbit && (below || ( (prec ? q : ip) & 1 )) ){	/* (The last digit printed: with prec 0, that's ip's) */
+				q++;
+			}
+			if (q == P){			/* Carry, eg 0.9999999999 -> 1.000000 */
+				q = 0;
+				ip++;
+			}
+		}
+	}
+
+	if (signbit (x)){				/* (Including -0.0, and negatives that round to zero: "-0.000000", as printf) */
+		*d++ = '-';
+	}
+	s = fmt_digits (tmp + sizeof (tmp), ip);
+	memcpy (d, s, tmp + sizeof (tmp) - s);
+	d += tmp + sizeof (tmp) - s;
+	if (prec > 0){
+		*d++ = '.';
+		for (i = prec - 1; i >= 0; i--){
+			d[i] = '0' + (q % 10);
+			q /= 10;
+		}
+		d += prec;
+	}
+	*d++ = sep;
+	b->n = d - b->buf;
+}
+
+/* Append x, as printf ("%d", x) would, then 'sep'. */
+void fmt_d (struct fmtbuf *b, int x, char sep){
+	char     tmp[16], *s, *d;
+	if (b->n > FMT_BUF_BYTES - FMT_VAL_MAX){
+		fmt_flush (b);
+	}
+	d = b->buf + b->n;
+	if (x < 0){
+		*d++ = '-';
+	}
+	s = fmt_digits (tmp + sizeof (tmp), (x < 0) ? -(uint64_t)x : (uint64_t)x);
+	memcpy (d, s, tmp + sizeof (tmp) - s);
+	d += tmp + sizeof (tmp) - s;
+	*d++ = sep;
+	b->n = d - b->buf;
+}
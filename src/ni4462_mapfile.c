@@ -0,0 +1,136 @@
+/* Memory-mapped binary capture file (ni4462_test -w), for long continuous runs at full rate. (#included by ni4462_test.c)
+   ASCII output is one fprintf() per sample, and a flush per read: at 204.8 kHz x 4 channels, that's several hundred MB/s, and the disk becomes the limit.
+   Instead, the file is preallocated (posix_fallocate), and mapped MAPFILE_WINDOW_BYTES at a time; DAQmxReadAnalogF64() / DAQmxReadBinaryI32() read straight
+   into the mapped window, so the data is never copied by us: the kernel's writeback moves it to disk. The file is a struct mapfile_header (padded to one page,
+   so that the data is page-aligned, as mmap() needs), then the tuples, exactly as read (GroupByScanNumber). At the end, the header gets the sample count,
+   and the file is truncated to the data actually read. When the number of samples is known, no window (or extension) goes much beyond it: a short run
+   doesn't allocate, and pre-fault, a whole window.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define MAPFILE_MAGIC		"NI4462TM"				/* 8 bytes, no NUL */
+#define MAPFILE_VERSION		2					/* (2: first_sample) */
+#define MAPFILE_HEADER_BYTES	4096					/* The header, padded. (A multiple of the page size) */
+#define MAPFILE_WINDOW_BYTES	(64 * 1024 * 1024)			/* Map (and extend) the file this much at a time. A multiple of the page size, and of any tuple's size. */
+#define MAPFILE_SCALE_COEFFS	4					/* int32: the device's scaling polynomial, code to volts, has (up to) 4 coefficients */
+#define MAPFILE_MAX_CH		4
+
+struct mapfile_header {			/* Little-endian (x86). Fields in the order they're most likely wanted. */
+	char     magic[8];			/* MAPFILE_MAGIC */
+	uint32_t version;			/* MAPFILE_VERSION */
+	uint32_t header_bytes;			/* Offset of the first tuple: MAPFILE_HEADER_BYTES */
+	uint32_t num_channels;			/* Values per tuple (channel 0 first) */
+	uint32_t value_bytes;			/* 8: float64, in volts; 4: int32, in ADC codes */
+	uint64_t num_samples;			/* Tuples in the file. (Written at the end: 0 if the program didn't finish) */
+	float64  freq_hz;			/* Sample rate (readback) */
+	float64  voltage;			/* Voltage range: [-voltage, +voltage] (readback) */
+	float64  gain;				/* (readback) */
+	int64_t  start_sec, start_usec;		/* When the task was started. (With an external trigger, the first sample is later) */
+	uint32_t pretrigger_samples;		/* Of num_samples, these preceded the trigger */
+	uint32_t initial_discard;		/* Samples discarded before the first tuple (-j) */
+	float64  scale[MAPFILE_MAX_CH][MAPFILE_SCALE_COEFFS];	/* int32: per channel, volts = sum_k scale[c][k] * code^k. (float64: zeros) */
+	char     channel[16];			/* The -c argument: "0".."3", "all" */
+	uint64_t first_sample;			/* Index of the first tuple in the whole acquisition: 0, except in the later files of a rotated run (-r) */
+};
+
+struct mapfile {
+	int      fd;
+	struct mapfile_header hdr;
+	size_t   tuple_bytes;
+	uint64_t allocated;			/* Bytes of data (after the header) allocated in the file so far */
+	uint64_t limit;				/* Bytes of data expected in the file, if known (else 0) */
+	uint64_t win_start;			/* Data offset of the mapped window (a multiple of the page size) */
+	uint64_t win_bytes;			/* Its size: MAPFILE_WINDOW_BYTES, or less, up to the (page after the) limit */
+	unsigned char *win;			/* The window, or NULL */
+	uint64_t used;				/* Bytes of data written (all windows) */
+};
+
+/* Preallocate room for num_samples tuples (0 if unknown), and expect that many: the windows stop there. (If more are read after all, the file is extended.) */
+/* Returns 0, or -1 (see errno). */
+int mapfile_reserve (struct mapfile *m, uint64_t num_samples){
+	int err;
+	if ( (err = posix_fallocate (m->fd, 0, MAPFILE_HEADER_BYTES + num_samples * m->tuple_bytes)) ){	/* Fail now, not part way through, if the disk is too small. */
+		errno = err;
+		return -1;
+	}
+	m->allocated = m->limit = num_samples * m->tuple_bytes;
+	return 0;
+}
+
+/* Create the file (truncating it), for tuples of num_channels values of value_bytes, and preallocate room for num_samples of them (0 if unknown, ie continuous). */
+/* Returns 0, or -1 (see errno). Then fill in the rest of m->hdr, and mapfile_header(). */
+int mapfile_open (struct mapfile *m, const char *filename, int num_channels, int value_bytes, uint64_t num_samples){
+	memset (m, 0, sizeof (*m));
+	memcpy (m->hdr.magic, MAPFILE_MAGIC, sizeof (m->hdr.magic));
+	m->hdr.version = MAPFILE_VERSION;
+	m->hdr.header_bytes = MAPFILE_HEADER_BYTES;
+	m->hdr.num_channels = num_channels;
+	m->hdr.value_bytes = value_bytes;
+	m->tuple_bytes = num_channels * value_bytes;
+	if ( (m->fd = open (filename, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1){
+		return -1;
+	}
+	return mapfile_reserve (m, num_samples);
+}
+
+/* Write m->hdr to the file. (Again, at mapfile_close(), with num_samples.) Returns 0, or -1. */
+int mapfile_header (struct mapfile *m){
+	return ( pwrite (m->fd, &m->hdr, sizeof (m->hdr), 0) == sizeof (m->hdr) ) ? 0 : -1;
+}
+
+/* Where the next read goes, and how many tuples fit there (in this window). Maps the next window (extending the file, if needed) when this one is full. */
+/* Returns NULL (see errno) if that fails. The pages are pre-faulted (MAP_POPULATE): the read call shouldn't take page faults. */
+void *mapfile_next (struct mapfile *m, uint64_t *space){
+	int err;
+	if ( m->win && (m->used == m->win_start + m->win_bytes) ){
+		munmap (m->win, m->win_bytes);		/* The dirty pages stay in the page cache, for writeback. */
+		m->win = NULL;
+		m->win_start += m->win_bytes;
+	}
+	if (!m->win){
+		m->win_bytes = MAPFILE_WINDOW_BYTES;	/* (Up to the limit, rounded up to a page: so the next window, if any, still starts on one) */
+		if ( (m->limit > m->win_start) && (m->limit - m->win_start < MAPFILE_WINDOW_BYTES) ){
+			m->win_bytes = (m->limit - m->win_start + MAPFILE_HEADER_BYTES - 1) / MAPFILE_HEADER_BYTES * MAPFILE_HEADER_BYTES;
+		}
+		if (m->allocated < m->win_start + m->win_bytes){	/* Extend the file to the end of the window. (Then, we may write anywhere in it) */
+			if ( (err = posix_fallocate (m->fd, MAPFILE_HEADER_BYTES + m->allocated, m->win_start + m->win_bytes - m->allocated)) ){
+				errno = err;
+				return NULL;
+			}
+			m->allocated = m->win_start + m->win_bytes;
+		}
+		m->win = mmap (NULL, m->win_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m->fd, MAPFILE_HEADER_BYTES + m->win_start);
+		if (m->win == MAP_FAILED){
+			m->win = NULL;
+			return NULL;
+		}
+	}
+	*space = (m->win_start + m->win_bytes - m->used) / m->tuple_bytes;
+	return m->win + (m->used - m->win_start);
+}
+
+/* The read put n tuples at mapfile_next(). */
+void mapfile_advance (struct mapfile *m, uint64_t n){
+	m->used += n * m->tuple_bytes;
+}
+
+/* Finish: record the sample count in the header, unmap, truncate the file to the data actually written, and close it. Returns 0, or -1 (see errno). */
+int mapfile_close (struct mapfile *m){
+	int ret = 0;
+	if (m->win){
+		munmap (m->win, m->win_bytes);
+	}
+	m->hdr.num_samples = m->used / m->tuple_bytes;
+	if ( mapfile_header (m) || ftruncate (m->fd, MAPFILE_HEADER_BYTES + m->used) ){
+		ret = -1;
+	}
+	return ( close (m->fd) || ret ) ? -1 : 0;
+}
@@ -0,0 +1,142 @@
+/* Read scheduler: decide how many samples to ask DAQmx for, and when. (#included by ni4462_test.c and ni4462_capture.c)
+   The old way was a non-blocking read (DAQmx_Val_Auto) of whatever was there, then, iff that was nothing, a blocking read of 1 sample. At low rates, that's
+   many tiny reads; at high rates, the chunks are erratic. Instead, since the sample clock is known, predict when the next useful chunk will be ready, sleep
+   until then, and read exactly that chunk. Sample k (counted from the trigger) is ready at t0 + k/rate; t0 is found from the first read, which is allowed to
+   block (it waits for the trigger), and again whenever a read blocks (i.e. the prediction was early: eg after samples were discarded, or the clocks drift).
+   A read of n costs overhead + n * per_sample (the copy and conversion): a straight-line fit to (n, duration), with EMA weights, over the reads that didn't
+   block. (While every read is the same size, the slope can't be found: keep the last one, or 0.) A read has blocked if it took much longer than that; but
+   never if, by the prediction, at least another chunk was ready beyond what it read: it was draining a backlog, and re-anchoring would only make the schedule
+   think it's caught up. The target chunk is the one for which the overhead is READSCHED_OVERHEAD_FRACTION of the chunk's duration, within
+   [READSCHED_MIN_CHUNK, READSCHED_MAX_LATENCY_S of samples], and never more than the caller can take.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#define READSCHED_OVERHEAD_FRACTION	0.01				/* Aim for the DAQmx call to cost at most 1% of the time the chunk took to acquire... */
+#define READSCHED_MIN_CHUNK		16				/* ... but read at least this many samples at a time... */
+#define READSCHED_MAX_LATENCY_S		0.010				/* ... and don't hold samples in the driver for more than 10 ms. */
+#define READSCHED_OVERHEAD_INIT_S	50e-6				/* Initial guess at the cost of a read call (~0.03 ms measured, see ni4462_test.c) */
+#define READSCHED_EMA_WEIGHT		0.125				/* Weight of each new measurement in the EMA */
+#define READSCHED_BLOCK_FACTOR		4				/* A read that takes this many times its usual cost... */
+#define READSCHED_BLOCK_MIN_S		200e-6				/* ... and at least this long, must have blocked, waiting for data. */
+#define READSCHED_FIT_MIN_SPREAD	0.01				/* Fit the cost per sample only once the read sizes vary: variance >= 1% of mean(n^2) */
+
+struct readsched {
+	double   rate;				/* Sample rate (Hz) */
+	uint64_t max_chunk;			/* Most samples per read (the buffer size) */
+	double   overhead;			/* Fixed cost of a read call that didn't block (s) ... */
+	double   per_sample;			/* ... and its cost per sample (s) */
+	double   m_n, m_d, m_nn, m_nd;		/* EMAs of n, duration, n^2, n*duration, of those reads (the fit) */
+	uint64_t fits;
+	int      anchored;			/* Do we know t0 (yet)? */
+	double   t0;				/* Time (CLOCK_MONOTONIC) at which sample 0 (since the anchor) was ready */
+	uint64_t n;				/* Samples read (or skipped) since the anchor */
+	double   t_call;			/* Start of the current read call */
+	double   ready;				/* Samples that should have been ready then (if anchored) */
+	int      blocked;			/* Did the last read block? */
+	int      free_running;			/* The dummy library, not in real-time mode: the samples are always ready. Don't sleep. */
+	int      busy_poll;			/* Spin until the samples should be ready, rather than sleep (--realtime=poll) */
+	uint64_t calls, blocks, sleeps;		/* Statistics */
+};
+
+double readsched_now(){
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Set up, for a sample rate (the coerced one), and a buffer of max_chunk samples. (Then set busy_poll, if wanted.) */
+void readsched_init (struct readsched *rs, double rate, uint64_t max_chunk){
+	memset (rs, 0, sizeof (*rs));
+	rs->rate = rate;
+	rs->max_chunk = max_chunk;
+	rs->overhead = READSCHED_OVERHEAD_INIT_S;
+#ifdef USE_DUMMY_LIBDAQMX
+	rs->free_running = !sim_rt();
+#endif
+}
+
+/* The task has (re)started: wait for the trigger before predicting anything. */
+void readsched_start (struct readsched *rs){
+	rs->anchored = 0;
+}
+
+/* Samples that were consumed other than through readsched_next()/readsched_done() (eg discarded). Keeps the prediction in step. */
+void readsched_skip (struct readsched *rs, uint64_t n){
+	rs->n += n;
+}
+
+/* The target chunk size, now. */
+uint64_t readsched_target (struct readsched *rs){
+	double   t = rs->rate * rs->overhead / READSCHED_OVERHEAD_FRACTION, max = rs->rate * READSCHED_MAX_LATENCY_S;
+	t = (t > max) ? max : t;
+	t = (t < READSCHED_MIN_CHUNK) ? READSCHED_MIN_CHUNK : t;
+	return (t > rs->max_chunk) ? rs->max_chunk : (uint64_t)t;
+}
+
+/* Before a read: return how many samples to read (at most 'remaining', eg the rest of the frame), after sleeping until they should be ready. If we're */
+/* behind (more than the target is ready already), take all of it, in one call. The caller then does a blocking read of exactly that many, then readsched_done(). */
+uint64_t readsched_next (struct readsched *rs, uint64_t remaining){
+	uint64_t want = readsched_target (rs), ready;
+	double   t_ready, now = readsched_now();
+	struct   timespec ts;
+	if (rs->free_running){
+		want = rs->max_chunk;
+	}else if (rs->anchored){
+		ready = ( (now - rs->t0) * rs->rate > rs->n ) ? ( (uint64_t)((now - rs->t0) * rs->rate) - rs->n ) : 0;
+		want  = (ready > want) ? ( (ready > rs->max_chunk) ? rs->max_chunk : ready ) : want;
+	}
+	want = (want > remaining) ? remaining : want;
+	rs->ready = 0;
+	if (rs->anchored && !rs->free_running){
+		t_ready = rs->t0 + (rs->n + want) / rs->rate;
+		if ( (t_ready > now) && rs->busy_poll){
+			while (readsched_now() < t_ready){
+				;
+			}
+			rs->sleeps++;
+		}else if (t_ready > now){
+			ts.tv_sec  = (time_t)t_ready;
+			ts.tv_nsec = (long)((t_ready - ts.tv_sec) * 1e9);
+			while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+				;
+			}
+			rs->sleeps++;
+		}
+	}
+	rs->t_call = readsched_now();
+	rs->ready  = rs->anchored ? (rs->t_call - rs->t0) * rs->rate - rs->n : 0;
+	return want;
+}
+
+/* After a read of 'got' samples: did it block? (Then re-anchor: the last sample was ready just now.) Else, it's another point for the fit of the cost of a read. */
+void readsched_done (struct readsched *rs, uint64_t got){
+	double t = readsched_now(), d = t - rs->t_call, cost = rs->overhead + got * rs->per_sample, w, var;
+	int    draining = rs->ready >= (double)(got + readsched_target (rs));
+	rs->calls++;
+	rs->blocked = ( !rs->anchored || ( !draining && (d > READSCHED_BLOCK_FACTOR * cost) && (d > READSCHED_BLOCK_MIN_S) ) );
+	if (rs->blocked){
+		rs->blocks++;
+		rs->anchored = 1;
+		rs->t0 = t - (double)got / rs->rate;
+		rs->n  = 0;
+	}else{
+		w = (rs->fits++ == 0) ? 1 : READSCHED_EMA_WEIGHT;
+		rs->m_n  += w * (got - rs->m_n);
+		rs->m_d  += w * (d - rs->m_d);
+		rs->m_nn += w * ((double)got * got - rs->m_nn);
+		rs->m_nd += w * (got * d - rs->m_nd);
+		var = rs->m_nn - rs->m_n * rs->m_n;
+		if (var > READSCHED_FIT_MIN_SPREAD * rs->m_nn){
+			rs->per_sample = (rs->m_nd - rs->m_n * rs->m_d) / var;
+			rs->per_sample = (rs->per_sample > 0) ? rs->per_sample : 0;
+		}
+		rs->overhead = rs->m_d - rs->per_sample * rs->m_n;
+		rs->overhead = (rs->overhead > 0) ? rs->overhead : 0;
+	}
+	rs->n += got;
+}
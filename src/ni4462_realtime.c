@@ -0,0 +1,118 @@
+/* Real-time execution profile for the acquisition loop: --realtime. (#included by ni4462_test.c and ni4462_capture.c; they must #define _GNU_SOURCE.)
+   NOTES.txt found that the loop timings were only acceptable when run with 'nice -n -20', and with 'nice yes >/dev/null' on another core to stop frequency
+   scaling. This does it properly: lock all memory (mlockall), pre-fault the buffers and the stack, pin the acquisition thread to one CPU, run it as SCHED_FIFO,
+   and (optionally) busy-poll rather than sleep between reads (which also keeps that core at full clock). Each part may fail (most need root, or CAP_SYS_NICE
+   and CAP_IPC_LOCK): the program carries on regardless, and reports at startup exactly which parts took effect.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#include <ctype.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define REALTIME_ARG			"--realtime"			/* --realtime[=CPU][,poll] */
+#define REALTIME_PRIORITY		40				/* SCHED_FIFO priority. Below the kernel's threaded IRQ handlers (50): the driver needs those. */
+#define REALTIME_STACK_PREFAULT		(256 * 1024)			/* Pre-fault this much stack, below main()'s frame. */
+
+struct realtime {
+	int      enabled;		/* --realtime was given */
+	int      cpu;			/* CPU to pin the acquisition thread to. [default: the last one] */
+	int      busy_poll;		/* Spin between reads, rather than sleep */
+	uint64_t prefaulted;		/* Bytes pre-faulted, so far */
+};
+
+/* Find, parse, and remove any --realtime[=CPU][,poll] argument from argv, before getopt() sees it. Returns 0 if ok, -1 if malformed. */
+int realtime_args (int *argc, char *argv[], struct realtime *rt){
+	int   i, j;
+	char *s, *end;
+	memset (rt, 0, sizeof (*rt));
+	rt->cpu = sysconf (_SC_NPROCESSORS_ONLN) - 1;
+	for (i = 1; i < *argc; i++){
+		if ( (strncmp (argv[i], REALTIME_ARG, strlen (REALTIME_ARG))) || ( (argv[i][strlen (REALTIME_ARG)] != '\0') && (argv[i][strlen (REALTIME_ARG)] != '=') ) ){
+			continue;
+		}
+		rt->enabled = 1;
+		s = argv[i] + strlen (REALTIME_ARG);
+		if (*s == '='){
+			s++;
+			if (isdigit (*s)){
+				rt->cpu = strtol (s, &end, 10);
+				s = (*end == ',') ? end + 1 : end;
+			}
+			if (!strcmp (s, "poll")){
+				rt->busy_poll = 1;
+			}else if (*s != '\0'){
+				return -1;
+			}
+		}
+		for (j = i; j < *argc; j++){	/* Remove it (argv[argc] is NULL) */
+			argv[j] = argv[j+1];
+		}
+		(*argc)--; i--;
+	}
+	return 0;
+}
+
+/* Pre-fault a buffer: write to each page, so that the first real use doesn't take page faults. (Call before the data is used: this zeroes it.) */
+void realtime_prefault (struct realtime *rt, void *buf, size_t bytes){
+	if (rt->enabled){
+		memset (buf, 0, bytes);
+		rt->prefaulted += bytes;
+	}
+}
+
+/* Touch the stack that the loop will use. (Not inlined: its frame must be below the caller's.) */
+__attribute__ ((noinline)) void realtime_prefault_stack (struct realtime *rt){
+	char stack[REALTIME_STACK_PREFAULT];
+	memset (stack, 0, sizeof (stack));
+	__asm__ __volatile__ ("" : : "r" (stack) : "memory");	/* Don't let the compiler optimise the memset() away. */
+	rt->prefaulted += sizeof (stack);
+}
+
+/* Apply the profile to the calling thread (threads created later inherit the CPU and the policy). Report on stderr what took effect. Returns the number of failures. */
+int realtime_start (struct realtime *rt){
+	int    failed = 0;
+	char   lock[64] = "yes", cpu[64], fifo[64];
+	cpu_set_t cpus;
+	struct sched_param sp;
+	if (!rt->enabled){
+		return 0;
+	}
+
+	if (mlockall (MCL_CURRENT | MCL_FUTURE)){		/* All pages, now and future, are locked in RAM. */
+		snprintf (lock, sizeof (lock), "no (%s)", strerror (errno));
+		failed++;
+	}
+	realtime_prefault_stack (rt);
+
+	CPU_ZERO (&cpus);
+	if ( (rt->cpu < 0) || (rt->cpu >= CPU_SETSIZE) ){
+		snprintf (cpu, sizeof (cpu), "no (CPU %d is out of range)", rt->cpu);
+		failed++;
+	}else{
+		CPU_SET (rt->cpu, &cpus);
+		if (sched_setaffinity (0, sizeof (cpus), &cpus)){
+			snprintf (cpu, sizeof (cpu), "no (CPU %d: %s)", rt->cpu, strerror (errno));
+			failed++;
+		}else{
+			snprintf (cpu, sizeof (cpu), "CPU %d", rt->cpu);
+		}
+	}
+
+	sp.sched_priority = REALTIME_PRIORITY;
+	if (sched_setscheduler (0, SCHED_FIFO, &sp)){
+		snprintf (fifo, sizeof (fifo), "no (%s)", strerror (errno));
+		failed++;
+	}else{
+		snprintf (fifo, sizeof (fifo), "priority %d", REALTIME_PRIORITY);
+	}
+
+	fprintf (stderr, "Realtime: mlockall: %s; pre-faulted: %llu kB; pinned: %s; SCHED_FIFO: %s; busy-poll: %s.%s\n", lock, (unsigned long long)rt->prefaulted / 1024,
+		cpu, fifo, rt->busy_poll ? "yes" : "no", failed ? " (Some parts didn't take effect. mlockall needs CAP_IPC_LOCK, SCHED_FIFO needs CAP_SYS_NICE: eg root.)" : "");
+	return failed;
+}
@@ -0,0 +1,220 @@
+/* Reader for the shared-memory ring published by ni4462_test -M or ni4462_capture -M. Any number of these can follow the same acquisition, each at its own pace
+   (eg a live display, an archiver and an analysis process); the acquisition never waits for them. A reader that falls too far behind loses data, and reports it.
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+/* Headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <libgen.h>
+
+#include "ni4462_shmring.c"						/* The ring itself. Also '-lrt' */
+
+#define POLL_US			1000					/* When we're up to date, wait this long before looking again. */
+#define ATTACH_RETRY_US		10000					/* Waiting for the writer to create the ring (-w) */
+
+/* Macros */
+#define eprintf(...)	fprintf(stderr, __VA_ARGS__)				/* Error printf: send to stderr  */
+
+#define deprintf(...)	if (debug) { fprintf(stderr, __VA_ARGS__); }		/* Debug error printf: print to stderr iff debug is set */
+
+#define feprintf(...)	fprintf(stderr, __VA_ARGS__); exit (EXIT_FAILURE)	/* Fatal error printf: send to stderr and exit */
+
+
+/* Globals */
+int debug = 0;
+int terminate_loop = 0;		/* for Ctrl-C */
+struct shmring *ring = NULL;
+uint64_t messages = 0, tuples = 0;
+
+
+/* Show help */
+void print_help(char *argv0){
+	argv0 = basename(argv0);
+	eprintf("INTRO: %s follows the shared-memory ring that ni4462_test or ni4462_capture publishes with -M, and writes what it reads to stdout.\n"
+		"Any number of readers can follow the same acquisition, each at its own pace; the acquisition never blocks on them. If a reader falls more\n"
+		"than a ring's length (%d slots of %d bytes) behind, it loses the oldest messages: these are counted as overruns, and reported on stderr.\n"
+		"\n"
+		"USAGE:  %s  [OPTIONS]\n"
+		"\n"
+		"OPTIONS:\n"
+		"   -h             print help and exit\n"
+		"   -d             debug: be much more verbose.\n"
+		"   -M   NAME      name of the ring (as given to -M of the writer). [default: %s].\n"
+		"   -t   raw|frame which messages to output: raw data (as read, before any analysis), or the per-frame results (ni4462_capture only). [default: raw].\n"
+		"   -o   FORMAT    output format: ascii or binary. [default: ascii].\n"
+		"                    raw, ascii:    one line per sample, channels tab-separated (like ni4462_test).\n"
+		"                    raw, binary:   the tuples, as read (float64, or int32 for ni4462_test -o int32).\n"
+		"                    frame, binary: ni4462_capture's binary format: its struct bin_header, then one struct bin_record per frame (no payload).\n"
+		"   -O             start at the oldest message still in the ring, rather than the newest.\n"
+		"   -w             wait for the ring to appear, rather than failing if there isn't one (yet).\n"
+		"\n"
+		"Exits when the writer finishes (or on Ctrl-C). Reports overruns on stderr as they happen, and a summary at exit. SigUSR1 prints the counts.\n"
+		"\n"
+		"EXAMPLE:  ni4462_capture -M /ni4462 -a lin_reg ... > data.txt  &  %s -M /ni4462 -t raw | some_live_display\n"
+		"\n"
+		,argv0, SHM_SLOTS, SHM_SLOT_BYTES, argv0, SHM_DEFAULT_NAME, argv0);
+}
+
+/* Signal handler: handle Ctrl-C. Stop after this message. */
+void handle_signal_cc(int signum){
+	eprintf ("Ctrl-C (signal %d), stopping.\n", signum);
+	terminate_loop = 1;
+}
+
+/* Signal handler: handle SIGUSR1: print counts. */
+void handle_signal_usr1(int signum __attribute__ ((unused)) ){
+	if (ring){
+		eprintf ("Read %llu messages (%llu tuples); overruns: %llu messages lost.\n", (unsigned long long)messages, (unsigned long long)tuples, (unsigned long long)ring->overruns);
+	}
+}
+
+
+/* Do it... */
+int main(int argc, char* argv[]){
+
+	int	opt; extern char *optarg; extern int optind, opterr, optopt;       /* getopt */
+	char   *name = SHM_DEFAULT_NAME;
+	int     want_frames = 0, binary = 0, oldest = 0, wait_for_ring = 0, header_done = 0, i, n;
+	uint64_t overruns = 0;
+	static  struct shm_slot msg;		/* One message. (64 kB: not on the stack) */
+	double  *d = (double *)msg.data;
+	int32_t *di = (int32_t *)msg.data;
+
+	/* Parse options and check for validity */
+        if ((argc > 1) && (!strcmp (argv[1], "--help"))) {      /* Support --help, without the full getopt_long */
+                print_help(argv[0]);
+                exit (EXIT_SUCCESS);
+        }
+
+        while ((opt = getopt(argc, argv, "dhOwM:o:t:")) != -1) {  /* Getopt */
+                switch (opt) {
+			case 'd':				/* Debugging */
+				debug = 1;
+				break;
+
+			case 'h':                               /* Help */
+				print_help(argv[0]);
+				exit (EXIT_SUCCESS);
+				break;
+
+			case 'M':				/* Ring name */
+				name = optarg;
+				break;
+
+			case 'o':				/* Output format */
+				if (!strcasecmp(optarg, "ascii")){
+					binary = 0;
+				}else if (!strcasecmp(optarg, "binary")){
+					binary = 1;
+				}else{
+					feprintf ("Illegal output format. Values of -o can be: ascii, binary.\n");
+				}
+				break;
+
+			case 'O':				/* Start at the oldest message */
+				oldest = 1;
+				break;
+
+			case 't':				/* Message type */
+				if (!strcasecmp(optarg, "raw")){
+					want_frames = 0;
+				}else if (!strcasecmp(optarg, "frame")){
+					want_frames = 1;
+				}else{
+					feprintf ("Illegal type. Values of -t can be: raw, frame.\n");
+				}
+				break;
+
+			case 'w':				/* Wait for the ring */
+				wait_for_ring = 1;
+				break;
+
+			default:
+				feprintf ("Unrecognised argument %c. Use -h for help.\n", opt);
+				break;
+		}
+	}
+	if (argc - optind != 0){
+		feprintf ("This takes no non-option arguments. Use -h for help.\n");
+	}
+	if (want_frames && !binary){
+		feprintf ("Error: frames (-t frame) are only available in binary (-o binary).\n");
+	}
+
+	/* Attach. */
+	signal(SIGINT, handle_signal_cc);
+	while ( ((ring = shmring_attach (name, oldest)) == NULL) && wait_for_ring && !terminate_loop){
+		usleep (ATTACH_RETRY_US);
+	}
+	if (ring == NULL){
+		feprintf ("Error: can't attach to the shared-memory ring '%s': %s. (Is the writer running, with -M?)\n", name, strerror(errno));
+	}
+	deprintf ("Attached to '%s' (writer pid %d), at message %llu.\n", name, (int)ring->hdr->pid, (unsigned long long)ring->next);
+	signal(SIGUSR1, handle_signal_usr1);
+
+	/* Follow it. */
+	while (!terminate_loop){
+		if (!shmring_get (ring, &msg)){
+			fflush (stdout);
+			usleep (POLL_US);
+			continue;
+		}
+		if (ring->overruns != overruns){
+			eprintf ("Overrun: lost %llu messages (total %llu). Reader is too slow.\n", (unsigned long long)(ring->overruns - overruns), (unsigned long long)ring->overruns);
+			overruns = ring->overruns;
+		}
+		if (msg.type == SHM_END){
+			deprintf ("Writer finished.\n");
+			break;
+		}
+		if ( (want_frames != (msg.type == SHM_FRAME)) || ( (msg.type != SHM_FRAME) && (msg.channels == 0) ) ){	/* (Raw data without channels can't be tuples.) */
+			continue;
+		}
+		messages++;
+
+		if (want_frames){		/* Binary frames: header (once), then the records. */
+			if (!header_done){
+				fwrite (ring->hdr->info, ring->hdr->info_bytes, 1, stdout);
+				header_done = 1;
+			}
+			fwrite (msg.data, msg.bytes, 1, stdout);
+		}else if (binary){		/* Binary raw data: as read */
+			fwrite (msg.data, msg.bytes, 1, stdout);
+			tuples += msg.bytes / (msg.channels * ((msg.type == SHM_RAW_I32) ? sizeof (int32_t) : sizeof (double)));
+		}else if (msg.type == SHM_RAW_F64){
+			n = msg.bytes / (msg.channels * sizeof (double));
+			for (i=0; i < n * (int)msg.channels; i++){
+				printf ( ((i + 1) % msg.channels) ? "%f\t" : "%f\n", d[i]);
+			}
+			tuples += n;
+		}else if (msg.type == SHM_RAW_I32){
+			n = msg.bytes / (msg.channels * sizeof (int32_t));
+			for (i=0; i < n * (int)msg.channels; i++){
+				printf ( ((i + 1) % msg.channels) ? "%d\t" : "%d\n", (int)di[i]);
+			}
+			tuples += n;
+		}
+		if (ferror (stdout)){
+			feprintf ("Error writing output: %s\n", strerror(errno));
+		}
+	}
+
+	/* Done. */
+	fflush (stdout);
+	overruns = ring->overruns;
+	eprintf ("Read %llu messages (%llu tuples); overruns: %llu messages lost.\n", (unsigned long long)messages, (unsigned long long)tuples, (unsigned long long)overruns);
+	shmring_close (ring);
+	return (overruns ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,191 @@
+/* Shared-memory ring, for zero-copy fan-out of the acquired data to any number of readers. (#included by ni4462_test.c, ni4462_capture.c and ni4462_shmread.c)
+   The writer (acquisition) publishes messages into a POSIX shared-memory object, /dev/shm/NAME, as a ring of fixed-size slots; it never waits for the readers.
+   Each reader maps the ring read-only, and follows it at its own pace: a reader that falls more than a ring's length behind just loses the oldest messages,
+   and counts them as overruns. There's no locking: each slot is a seqlock. The writer marks the slot odd (busy), copies the data, then marks it even (done);
+   the reader copies the slot out, and then checks that its sequence number didn't change meanwhile (i.e. the writer didn't lap it).
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define SHM_MAGIC		"NI4462SR"				/* 8 bytes, no NUL */
+#define SHM_VERSION		1
+#define SHM_DEFAULT_NAME	"/ni4462"				/* i.e. /dev/shm/ni4462 */
+#define SHM_SLOTS		256					/* Slots in the ring. (Power of 2) */
+#define SHM_SLOT_BYTES		65536					/* Max payload per slot: 2048 tuples of 4 float64. Bigger messages are split. */
+#define SHM_INFO_BYTES		512					/* Writer's description of the stream (eg ni4462_capture's struct bin_header) */
+
+/* Message types */
+#define SHM_RAW_F64		1					/* Raw data, as read: tuples of 'channels' float64 (GroupByScanNumber) */
+#define SHM_RAW_I32		2					/* ... as int32 ADC values */
+#define SHM_FRAME		3					/* Per-frame results (ni4462_capture's struct bin_record) */
+#define SHM_END			4					/* The writer has finished. */
+
+struct shm_slot {
+	uint64_t seq;				/* 2k+1 while message k is being written; 2k+2 once it's complete. (0: never used) */
+	uint32_t type, channels;		/* Message type; values per tuple (for raw data) */
+	uint32_t bytes;				/* Payload size */
+	int32_t  frame;				/* Frame number (ni4462_capture), or 0 */
+	uint64_t sample;			/* Index of the first tuple in the payload (raw data), counted from the trigger that started its task. (Each group restarts it.) */
+	unsigned char data[SHM_SLOT_BYTES] __attribute__ ((aligned (64)));
+};
+
+struct shm_header {
+	char     magic[8];			/* SHM_MAGIC */
+	uint32_t version, header_size, slot_size, num_slots;	/* SHM_VERSION, sizeof (struct shm_header), sizeof (struct shm_slot), SHM_SLOTS */
+	uint32_t pid;				/* The writer */
+	uint32_t info_bytes;
+	unsigned char info[SHM_INFO_BYTES];
+	uint64_t write_seq __attribute__ ((aligned (64)));	/* Number of messages published so far. (On its own cache line) */
+};
+
+struct shmring {
+	struct   shm_header *hdr;
+	struct   shm_slot *slot;
+	size_t   size;
+	char     name[256];
+	int      writer;
+	uint64_t next;				/* Reader: the next message to read */
+	uint64_t overruns;			/* Reader: messages lost, because the writer lapped us */
+};
+
+
+/* Writer: create (or replace) the ring NAME, and write its header. 'info' is copied into the header, for the readers. Return NULL on failure (see errno). */
+struct shmring *shmring_create (const char *name, const void *info, int info_bytes){
+	struct shmring *r;
+	int    fd;
+	if ( (info_bytes > SHM_INFO_BYTES) || ((r = calloc (1, sizeof (*r))) == NULL) ){
+		errno = ENOMEM;
+		return NULL;
+	}
+	strncpy (r->name, name, sizeof (r->name) - 1);
+	r->size = sizeof (struct shm_header) + SHM_SLOTS * sizeof (struct shm_slot);
+	shm_unlink (name);			/* Readers still attached to a previous ring keep it, and see its SHM_END. */
+	fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if ( (fd < 0) || (ftruncate (fd, r->size) < 0) ){
+		free (r);
+		return NULL;
+	}
+	r->hdr = mmap (NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (r->hdr == MAP_FAILED){
+		shm_unlink (name);
+		free (r);
+		return NULL;
+	}
+	r->slot = (struct shm_slot *)(r->hdr + 1);
+	r->writer = 1;
+	r->hdr->version = SHM_VERSION;	r->hdr->header_size = sizeof (struct shm_header);	r->hdr->slot_size = sizeof (struct shm_slot);
+	r->hdr->num_slots = SHM_SLOTS;	r->hdr->pid = getpid();					r->hdr->info_bytes = info_bytes;
+	memcpy (r->hdr->info, info, info_bytes);
+	__atomic_store_n (&r->hdr->write_seq, 0, __ATOMIC_RELEASE);
+	memcpy (r->hdr->magic, SHM_MAGIC, sizeof (r->hdr->magic));	/* Last: now it's valid. */
+	return r;
+}
+
+/* Writer: publish one message, into the next slot. Never blocks. */
+void shmring_put (struct shmring *r, uint32_t type, uint32_t channels, int32_t frame, uint64_t sample, const void *data, uint32_t bytes){
+	uint64_t k = r->hdr->write_seq;		/* (only we write it) */
+	struct   shm_slot *s = &r->slot[k % SHM_SLOTS];
+	__atomic_store_n (&s->seq, 2*k + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);	/* Busy, before the data changes. */
+	s->type = type;  s->channels = channels;  s->frame = frame;  s->sample = sample;  s->bytes = bytes;
+	if (bytes){
+		memcpy (s->data, data, bytes);
+	}
+	__atomic_store_n (&s->seq, 2*k + 2, __ATOMIC_RELEASE);
+	__atomic_store_n (&r->hdr->write_seq, k + 1, __ATOMIC_RELEASE);
+}
+
+/* Writer: publish 'count' tuples of raw data (each of 'channels' values, of 'value_bytes'), splitting them over as many slots as needed. */
+void shmring_put_raw (struct shmring *r, uint32_t type, uint32_t channels, int32_t frame, uint64_t sample, const void *data, int count, int value_bytes){
+	int tuple = channels * value_bytes, per_slot = SHM_SLOT_BYTES / tuple, len;
+	for ( ; count > 0; count -= len, sample += len, data = (const char *)data + len * tuple){
+		len = (count < per_slot) ? count : per_slot;
+		shmring_put (r, type, channels, frame, sample, data, len * tuple);
+	}
+}
+
+/* Reader: attach to the ring NAME, read-only. Start at the newest message (or, if 'oldest', at the oldest one still in the ring). Return NULL on failure. */
+struct shmring *shmring_attach (const char *name, int oldest){
+	struct shmring *r;
+	struct stat st;
+	int    fd;
+	uint64_t w;
+	if ( (r = calloc (1, sizeof (*r))) == NULL){
+		return NULL;
+	}
+	strncpy (r->name, name, sizeof (r->name) - 1);
+	fd = shm_open (name, O_RDONLY, 0);
+	if ( (fd < 0) || (fstat (fd, &st) < 0) || ((size_t)st.st_size < sizeof (struct shm_header)) ){
+		free (r);
+		return NULL;
+	}
+	r->size = st.st_size;
+	r->hdr = mmap (NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (r->hdr == MAP_FAILED){
+		free (r);
+		return NULL;
+	}
+	if ( memcmp (r->hdr->magic, SHM_MAGIC, sizeof (r->hdr->magic)) || (r->hdr->version != SHM_VERSION) || (r->hdr->header_size != sizeof (struct shm_header))
+	     || (r->hdr->slot_size != sizeof (struct shm_slot)) || (r->size < sizeof (struct shm_header) + (size_t)r->hdr->num_slots * sizeof (struct shm_slot)) ){
+		munmap (r->hdr, r->size);
+		free (r);
+		errno = EPROTO;
+		return NULL;
+	}
+	r->slot = (struct shm_slot *)(r->hdr + 1);
+	w = __atomic_load_n (&r->hdr->write_seq, __ATOMIC_ACQUIRE);
+	r->next = (oldest && (w > r->hdr->num_slots)) ? (w - r->hdr->num_slots) : (oldest ? 0 : w);
+	return r;
+}
+
+/* Reader: copy the next message into *out (its header fields, and data). Return 1 if there was one, 0 if we're up to date. If the writer has lapped us, */
+/* skip to the oldest message still in the ring, and add the number lost to r->overruns. */
+int shmring_get (struct shmring *r, struct shm_slot *out){
+	uint64_t w, seq;
+	struct   shm_slot *s;
+	while (1){
+		w = __atomic_load_n (&r->hdr->write_seq, __ATOMIC_ACQUIRE);
+		if (r->next >= w){
+			return 0;
+		}
+		if (w - r->next > r->hdr->num_slots){	/* Lapped: these are gone. */
+			r->overruns += w - r->next - r->hdr->num_slots;
+			r->next = w - r->hdr->num_slots;
+		}
+		s = &r->slot[r->next % r->hdr->num_slots];
+		seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE);
+		if (seq == 2*r->next + 2){
+			out->type = s->type;  out->channels = s->channels;  out->frame = s->frame;  out->sample = s->sample;  out->bytes = s->bytes;
+			if (out->bytes > SHM_SLOT_BYTES){
+				out->bytes = 0;
+			}
+			memcpy (out->data, s->data, out->bytes);
+			__atomic_thread_fence (__ATOMIC_ACQUIRE);	/* The copy, before the re-check. */
+			if (__atomic_load_n (&s->seq, __ATOMIC_RELAXED) == seq){
+				out->seq = r->next++;
+				return 1;
+			}
+		}
+		r->overruns++;				/* Overwritten while (or before) we copied it. */
+		r->next++;
+	}
+}
+
+/* Writer: publish SHM_END, and remove the name. (Readers still attached keep their mapping.) Reader: detach. */
+void shmring_close (struct shmring *r){
+	if (r->writer){
+		shmring_put (r, SHM_END, 0, 0, 0, NULL, 0);
+		shm_unlink (r->name);
+	}
+	munmap (r->hdr, r->size);
+	free (r);
+}
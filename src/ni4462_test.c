@@ -9,6 +9,8 @@
 */
 
 /* Headers */
+#define _GNU_SOURCE							/* For sched_setaffinity() (--realtime) */
+#define _FILE_OFFSET_BITS 64						/* Capture files > 2 GB, on 32-bit. (Especially -w) */
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
@@ -18,6 +20,7 @@
 #include <time.h>
 #include <math.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <signal.h>
@@ -29,6 +32,13 @@
 #else
   #include <NIDAQmx.h>							/* NI's library. Also '-lnidaqmx' */
 #endif
+#include "ni4462_shmring.c"						/* Shared-memory ring (-M). Also '-lrt' */
+#include "ni4462_readsched.c"						/* Read scheduler */
+#include "ni4462_realtime.c"						/* Real-time profile (--realtime) */
+#include "ni4462_mapfile.c"						/* Memory-mapped binary capture file (-w) */
+#include "ni4462_fmt.c"							/* Fast ASCII formatting of the data values */
+#include "ni4462_codec.c"						/* Compressed stream of the int32 codes (-Z) */
+#include "ni4462_flight.c"						/* Flight recorder (-F) */
 
 #define LIBDAQMX_TMPDIR		"/tmp/natinst/"				/* Temp dir for NI's lock files. We clean this up below. Caution. */
 #ifndef OnboardClock							/* Bugfix: defined in docs, not in header */
@@ -123,10 +133,10 @@
 #define teprintf(...)   if (do_triggerready_delete){ eprintf ( __VA_ARGS__ ); unlink (triggerready_filename); };   /* Clean up trigger file with message. Useful before feprintf(). */
 
 #define outprintf(...)	fprintf(outfile, __VA_ARGS__)				/* Write to output file. */
-#define output_1f(...)	fprintf (outfile, "%f\n", __VA_ARGS__);			/* Write 1 formatted data value to output file (as float) */
-#define output_4f(...)	fprintf (outfile, "%f\t%f\t%f\t%f\n", __VA_ARGS__);	/* Write 4 columns of data to output file (as float) */
-#define output_1d(...)	fprintf (outfile, "%d\n", __VA_ARGS__);			/* Write 1 formatted data value to output file (as int) */
-#define output_4d(...)	fprintf (outfile, "%d\t%d\t%d\t%d\n", __VA_ARGS__);	/* Write 4 columns of data to output file (as int) */
+#define output_1f(x)		fmt_f (out, (x), 6, '\n');					/* Write 1 formatted data value to the output buffer (as float: "%f\n") */
+#define output_4f(a, b, c, d)	fmt_f (out, (a), 6, '\t'); fmt_f (out, (b), 6, '\t'); fmt_f (out, (c), 6, '\t'); fmt_f (out, (d), 6, '\n');	/* 4 columns ("%f\t%f\t%f\t%f\n") */
+#define output_1d(x)		fmt_d (out, (x), '\n');					/* Write 1 formatted data value to the output buffer (as int: "%d\n") */
+#define output_4d(a, b, c, d)	fmt_d (out, (a), '\t'); fmt_d (out, (b), '\t'); fmt_d (out, (c), '\t'); fmt_d (out, (d), '\n');		/* 4 columns ("%d\t%d\t%d\t%d\n") */
 
 
 /* Globals */
@@ -134,6 +144,7 @@ int debug = 0, do_syslog=0;
 int stay_alive = 0, survived_count = 0;
 int vdebugc = 0;  		/* verbosity limiting debug counter */
 int terminate_loop = 0;
+int flight_signal = 0;		/* -F: SIGUSR2 received: an event */
 char *state = "Initialising";
 TaskHandle taskHandle = 0;
 
@@ -159,9 +170,23 @@ void print_help(char *argv0){
 		"       -j  N, auto              Junk samples: acquire/discard N extra initial samples. Can compensate for ADC Filter Delay pre-capturing. [default: %d].\n"
 		"       -g                       Gain is new/Preamp was saturated. Sleep after setting the gain, to allow a (possibly saturated) preamp to settle.\n"
 		"       -o  floatV, int32adc     Set output format: ASCII floating-point-64 in Volts, ASCII int32 in raw ADC-levels. [default: %s].\n"
+		"       -w                       Write a binary capture file (float64 or int32, as -o), preallocated and memory-mapped: the reads go straight into it.\n"
+		"                                For long continuous runs at full rate, where ASCII can't keep up. (Not with -c sum, -C, or outfile '-'.) See NOTES below.\n"
+		"       -Z                       Write a losslessly compressed stream of the int32 ADC codes (implies -o int32adc), rather than ASCII. Typically a\n"
+		"                                quarter to a half of the raw size, and it keeps up at full rate. ni4462_decode turns it back into the ASCII. (Not with -c sum, -w.)\n"
+		"       -r  size, time           Rotate the output file after size bytes (eg 500M, 2G) or time of data (eg 30s, 15m, 1h, 1d); give -r twice for both.\n"
+		"                                Without stopping the task, or losing a sample: files run.000000.dat, run.000001.dat, ... (Not with outfile '-'.) See NOTES.\n"
+		"       -F  pre[,post]    (s)    Flight recorder: keep the last pre seconds in memory; on each event, write them and post more [default: pre] to the\n"
+		"                                next file (run.000000.dat, ...). Events: SIGUSR2, -K, -L. Disk use follows the events, not the uptime. (Not with -c sum, -C, -w, -r.)\n"
+		"       -K  socket               (-F) Control socket: a Unix datagram socket, eg %s. Each datagram 'event' is an event.\n"
+		"       -L  N,level              (-F) An event when channel N crosses |level|: a sample at or above it, after one below (V; ADC codes with -o int32adc).\n"
 		"       -l  on, off              Enable NI's 'Low Frequency Enhanced Alias Rejection'. Recommended. [default: %s].\n"
 		"       -e  fe, re               Sample on the this edge of the internal clock. Negligible effect. [default: %s]\n"
 		"       -T  triggerready_file    When ready for ext-trigger, delete this (pre-created) empty file. Other processes can inotifywait() on it.\n"
+		"       -C                       Read channel-major (GroupByChannel): each channel's samples are contiguous, so the stats are unit-stride loops.\n"
+		"       -M  name                 Also publish the data, as read, to the shared-memory ring 'name' (eg %s), for any number of ni4462_shmread readers.\n"
+		"       --realtime[=CPU][,poll]  Real-time profile: mlockall, pre-fault buffers, pin to CPU [default: last], SCHED_FIFO; 'poll': busy-poll between reads.\n"
+		"                                Replaces 'nice -n -20' and 'nice yes >/dev/null' (see NOTES.txt). Reports which parts took effect (most need root).\n"
 		"\n"
 		"       -s                       Calculate summary statistics after running (or after Ctrl-C interrupt). Print to stderr.\n"
 		"       -b                       Brief output on last-line: rounded std-dev(s), in uV (or ADC-levels, depending on -o). Useful for speech-synth.\n"
@@ -182,6 +207,16 @@ void print_help(char *argv0){
 		"            support other input types (IEPE / TEDS sensors), and can use analog level/window triggers.\n"
 		"         * The output format is suitable for python's numpy.loadtxt(): multiple columns (Channel 0 on left), of ASCII int/float data, with\n"
 		"            comment lines prepended by '#'. Useful for fftplot/linregplot. If outfile is '-', it will be stdout.\n"
+		"         * With -w, the file is a header (struct mapfile_header in ni4462_mapfile.c: magic '%s', rate, range, gain, int32 scaling, start\n"
+		"            timestamp, number of samples, first sample), padded to %d bytes, then the tuples as read. Eg numpy.fromfile(f, offset=%d, dtype=...).reshape(-1, channels).\n"
+		"         * With -r, outfile names the run: run.dat is written as run.000000.dat, run.000001.dat, ... Each file stands alone (its own header; -Z, its own\n"
+		"            stream), with '#first_sample: N' (the index of its first sample in the run) and '#start_time: s.us' (when the task started) after the header.\n"
+		"            A time limit is counted in samples, so the files split exactly; a size limit splits at the end of the read that reaches it (-w: exactly).\n"
+		"         * With -F, each event's file is the header, then '#first_sample: N' (the history's start), '#start_time', '#event_sample: N' (-L: the sample\n"
+		"            that crossed the level; SIGUSR2, -K: the end of the read it arrived in) and '#event: signal, socket or level'; then the data. An event while\n"
+		"            a file is still being written is ignored. Eg: 'kill -USR2 $(pidof ni4462_test)' or 'echo event | socat - UNIX-SENDTO:socket'.\n"
+		"         * With -Z, the '#' header lines are kept, in the stream: 'ni4462_decode run.z > run.dat' gives exactly the ASCII that -o int32adc would have.\n"
+		"            The stream is independently decodable blocks of %d samples, each with a CRC: damage loses only the damaged blocks. See ni4462_codec.c.\n"
 		"         * The frequency of the sampling rate is coerced to the nearest %s. Use -d to show actual value.\n"
 		"         * The voltage range is coerced to [-x,+x] where x={%s}. Use -d to show actual value. (Max safe input is %.1f V).\n"
 		"         * The %s doesn't support configuration of the input impedance; it is fixed at %s.\n"
@@ -206,6 +241,7 @@ void print_help(char *argv0){
 		"\n"
 		"SIGNALS: * SigINT (Ctrl-C) cleanly stops sampling at end of loop; SigQUIT (Ctrl-\\) quits immediately\n"
 		"         * SigUSR1 prints state to stderr: Initialising, Calibrating, Configuring, Committing, Committed, Ready/Running, Running, Stopping, Stopped.\n"
+		"         * SigUSR2 (-F) is an event: the flight recorder writes its history, and what follows, to the next file.\n"
 		"         * IPC: external process should create empty tempfile, use -T. Then wait for deletion ('inotifywait -e delete'), before sending trigger pulse'.\n"
 		"\n"
 		"ERRORS:  * The following errors are detected and handled: invalid/out-of-range configuration, input voltage overload (pre+post digitisation),\n"
@@ -216,8 +252,8 @@ void print_help(char *argv0){
 		"         * NOTES.txt ( /usr/local/share/doc/ni4462 ).\n"
 		"\n"
 		,DEV_NAME, argv0, DEV_NUM_CH, DEV_NUM_CH, DEFAULT_CHANNEL, DEV_VALID_FREQ_RANGE, DEFAULT_SAMPLE_HZ, DEFAULT_COUNT, DEFAULT_COUPLING_STR,
-		DEFAULT_TERMINAL_MODE_STR, DEFAULT_V_LIMIT, DEFAULT_TRIGGERING_STR, DEFAULT_ADCFD_DISCARD_SAMPS, DEFAULT_REFTRIGGER_SAMPS, DEFAULT_FORMAT_STR,
-		DEFAULT_ENABLE_ADC_LF_EAR_STR, DEFAULT_INT_CLOCK_EDGE_STR, DEV_DEV, SYSLOG_IDENTIFIER, DEV_FREQ_QUANTISATION, DEV_VALID_VOLTAGE_RANGES, DEV_VOLTAGE_MAX, DEV_NAME, DEV_INPUT_IMPEDANCE,
+		DEFAULT_TERMINAL_MODE_STR, DEFAULT_V_LIMIT, DEFAULT_TRIGGERING_STR, DEFAULT_ADCFD_DISCARD_SAMPS, DEFAULT_REFTRIGGER_SAMPS, DEFAULT_FORMAT_STR, FLIGHT_SOCKET,
+		DEFAULT_ENABLE_ADC_LF_EAR_STR, DEFAULT_INT_CLOCK_EDGE_STR, SHM_DEFAULT_NAME, DEV_DEV, SYSLOG_IDENTIFIER, MAPFILE_MAGIC, MAPFILE_HEADER_BYTES, MAPFILE_HEADER_BYTES, CODEC_BLOCK_TUPLES, DEV_FREQ_QUANTISATION, DEV_VALID_VOLTAGE_RANGES, DEV_VOLTAGE_MAX, DEV_NAME, DEV_INPUT_IMPEDANCE,
 		DEV_DCAC_SETTLETIME_S, DEV_PREAMP_NEWGAIN_SETTLETIME_S, DEV_SAMPLES_MAX, DEV_ADC_FILTER_DELAY_SAMPLES, DEFAULT_ENABLE_ADC_LF_EAR_STR, DEV_TRIGGER_INPUT, 
 		DEFAULT_SAMPLE_HZ, 0, DEV_ADC_FILTER_DELAY_SAMPLES, 2, (2+DEV_ADC_FILTER_DELAY_SAMPLES),  RTSI2, RTSI3, RTSI6, RTSI8, RTSI9, RTSI6, DEV_TRIGGER_INPUT);
 }
@@ -331,6 +367,126 @@ void handle_signal_usr1(int signum __attribute__ ((unused)) ){
 	eprintf ("%s\n", state);  //global.
 }
 
+/* Signal handler: handle SIGUSR2 (-F): an event. The loop deals with it after the current read. */
+void handle_signal_usr2(int signum __attribute__ ((unused)) ){
+	flight_signal = 1;
+}
+
+/* Processing kernels: write out the 'count' samples of one read, and add them into sum[], sum_squares[] (for the stats). One is generated, at compile time, */
+/* for each channel layout (N channels, separate or summed) and each sample type (float64 volts, int32 codes); main() picks the right one once, before the loop. */
+/* So the per-sample loops have no branches, and the channel loops have constant bounds (the single-channel voltmeter case is just one plain loop). */
+/* Sample i of channel c is d[ss*i + cs*c]: (N, 1) for tuples; (1, count) for channel-major (-C). The sums go channel by channel, over each one's samples. */
+/* The text goes into the buffer 'out' (see ni4462_fmt.c): main() hands it to the file once per read. */
+#define output_row_1f(d, cs)	output_1f ( (d)[0] )
+#define output_row_4f(d, cs)	output_4f ( (d)[0], (d)[cs], (d)[2*(cs)], (d)[3*(cs)] )
+#define output_row_1d(d, cs)	output_1d ( (int)(d)[0] )
+#define output_row_4d(d, cs)	output_4d ( (int)(d)[0], (int)(d)[cs], (int)(d)[2*(cs)], (int)(d)[3*(cs)] )
+#define output_val_1d(x)	output_1d ( (int)(x) )
+#define output_row_none(d, cs)	(void)out				/* -w: nothing to write, the data is in the mapped file already */
+
+#define KERNEL_SEPARATE(name, type, N, output_row)											\
+void name (struct fmtbuf *out, const type *d, int count, int ss, int cs, float64 *sum, float64 *sum_squares){				\
+	int i, c;															\
+	for (i=0; i < count; i++){													\
+		output_row (d + ss*i, cs);												\
+	}																\
+	for (c=0; c < N; c++){														\
+		for (i=0; i < count; i++){												\
+			sum[c] += d[ss*i+cs*c];												\
+			sum_squares[c] += (float64)d[ss*i+cs*c] * d[ss*i+cs*c];								\
+		}															\
+	}																\
+}
+
+#define KERNEL_SUMMED(name, type, N, output_1)												\
+void name (struct fmtbuf *out, const type *d, int count, int ss, int cs, float64 *sum, float64 *sum_squares){				\
+	int  i, c;															\
+	type t;																\
+	for (i=0; i < count; i++){													\
+		for (t = d[ss*i], c=1; c < N; c++){											\
+			t += d[ss*i+cs*c];												\
+		}															\
+		output_1 (t);														\
+		sum[0] += t;														\
+		sum_squares[0] += (float64)t * t;											\
+	}																\
+}
+
+KERNEL_SEPARATE (process_1f,    float64, 1,         output_row_1f)
+KERNEL_SEPARATE (process_4f,    float64, DEV_NUM_CH, output_row_4f)
+KERNEL_SUMMED   (process_sumf,  float64, DEV_NUM_CH, output_1f)
+KERNEL_SEPARATE (process_1d,    int32,   1,         output_row_1d)
+KERNEL_SEPARATE (process_4d,    int32,   DEV_NUM_CH, output_row_4d)
+KERNEL_SUMMED   (process_sumd,  int32,   DEV_NUM_CH, output_val_1d)
+KERNEL_SEPARATE (stats_1f,      float64, 1,         output_row_none)
+KERNEL_SEPARATE (stats_4f,      float64, DEV_NUM_CH, output_row_none)
+KERNEL_SEPARATE (stats_1d,      int32,   1,         output_row_none)
+KERNEL_SEPARATE (stats_4d,      int32,   DEV_NUM_CH, output_row_none)
+
+/* Special case of a large, finite number of samples, promoted to "cont": on the final read, discard any surplus data. Return how many of this read's samples to keep. */
+int keep_samples (uInt64 num_samples, int continuous, int32 read_thistime, uInt64 *read_total){
+	uInt64 before = *read_total - read_thistime;		/* (Read before this one) */
+	if (num_samples && continuous && (*read_total > num_samples)){
+		deprintf ("Large, finite samples in continuous mode; discarding %d surplus samples from end.\n", (int)(*read_total - num_samples));
+		*read_total = num_samples;
+		return num_samples - before;
+	}
+	return read_thistime;
+}
+
+/* Rotation (-r): parse a limit, a size in bytes (suffix K, M, G: powers of 1024, as split(1)), or a duration (suffix s, m, h, d). Returns 0, or -1 if it's neither. */
+int rotate_limit (const char *arg, uint64_t *bytes, double *secs){
+	char  *end;
+	double x = strtod (arg, &end);
+	if ( (end == arg) || !(x > 0) || (end[0] && end[1]) ){
+		return -1;
+	}
+	switch (*end){
+		case '\0': *bytes = x;				break;
+		case 'K':  *bytes = x * 1024;			break;
+		case 'M':  *bytes = x * 1024 * 1024;		break;
+		case 'G':  *bytes = x * 1024 * 1024 * 1024;	break;
+		case 's':  *secs = x;				break;
+		case 'm':  *secs = x * 60;			break;
+		case 'h':  *secs = x * 3600;			break;
+		case 'd':  *secs = x * 86400;			break;
+		default:   return -1;
+	}
+	return 0;
+}
+
+/* Rotation (-r): the name of file k of the run: the index goes before the extension, so run.dat gives run.000000.dat, run.000001.dat, ... */
+void segment_name (char *buf, size_t len, const char *filename, unsigned k){
+	const char *base = strrchr (filename, '/'), *dot;
+	base = base ? base + 1 : filename;
+	dot = strrchr (base, '.');
+	if (dot && (dot != base)){
+		snprintf (buf, len, "%.*s.%06u%s", (int)(dot - filename), filename, k, dot);
+	}else{
+		snprintf (buf, len, "%s.%06u", filename, k);
+	}
+}
+
+/* Rotation (-r): how many samples the file starting at sample first will hold: rotate_samples, or the rest of the run, if that's less. (num_samples 0: unlimited) */
+uint64_t segment_samples (uint64_t first, uint64_t rotate_samples, uint64_t num_samples){
+	return ( (num_samples == 0) || (num_samples - first > rotate_samples) ) ? rotate_samples : num_samples - first;
+}
+
+/* Start an output file (-Z, -r) with its '#' lines: -Z, the stream's header, then the text as text blocks; else, the text. The text is in 3 pieces (any may be empty). */
+/* Returns 0, or -1 if a write failed. */
+int output_begin (FILE *f, struct codec *z, int num_channels, float64 scale[][MAPFILE_SCALE_COEFFS], const char *t0, size_t n0, const char *t1, size_t n1, const char *t2, size_t n2){
+	int ret = z ? codec_start (z, f, num_channels, 0, scale) : 0;
+	const char *t[3] = { t0, t1, t2 };
+	size_t      n[3] = { n0, n1, n2 };
+	int i;
+	for (i=0; i < 3; i++){
+		if (n[i] && ( z ? codec_text (z, t[i], n[i]) : (fwrite (t[i], n[i], 1, f) != 1) )){
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
 /* Do it... */
 int main(int argc, char* argv[]){
 
@@ -367,8 +523,16 @@ int main(int argc, char* argv[]){
 	int32   num_samples_read_thistime;		/* Number of samples (per channel) that were actually read in this pass */
 	int     num_samples_printed = 0;
 	uInt64  num_samples_read_total = 0;		/* Number of samples (per channel) that have been read so far in total */
-	float64 data[BUFFER_SIZE], data_tmp;		/* Our read data buffer. Multiple of 4. Needn't have room for num_samples all at once */
-	int32   data_i[BUFFER_SIZE], data_i_tmp;	/* Equvalent, when reading as int32 in ADC levels. [todo: could save some RAM by using a union of (data,datai)]. */
+	uInt64  num_samples_wanted;			/* How many to read this time (from the read scheduler) */
+	struct  readsched rsched;			/* Read scheduler: how much to read, and when */
+	struct  realtime rt;				/* Real-time profile (--realtime) */
+	float64 data[BUFFER_SIZE];			/* Our read data buffer. Multiple of 4. Needn't have room for num_samples all at once */
+	int32   data_i[BUFFER_SIZE];			/* Equvalent, when reading as int32 in ADC levels. [todo: could save some RAM by using a union of (data,datai)]. */
+	void  (*process_f) (struct fmtbuf *, const float64 *, int, int, int, float64 *, float64 *);	/* The processing kernels for this channel layout (see KERNEL_SEPARATE) */
+	void  (*process_d) (struct fmtbuf *, const int32 *, int, int, int, float64 *, float64 *);
+	void  (*output_f) (struct fmtbuf *, const float64 *, int, int, int, float64 *, float64 *);	/* (-F) ... and the ones that write the events out */
+	void  (*output_d) (struct fmtbuf *, const int32 *, int, int, int, float64 *, float64 *);
+	struct  fmtbuf fb;				/* The kernels' ASCII output, one read's worth at a time */
 	int     i, j, uvx, mvx, ret, tmp, n, m;
 	float64	sum[DEV_NUM_CH]={0,0,0,0}, sum_squares[DEV_NUM_CH]={0,0,0,0}, mean[DEV_NUM_CH], mean_s, var[DEV_NUM_CH], stddev[DEV_NUM_CH], stddev_s;
 	struct  stat stat_p;            		/* pointer to stat structure */
@@ -378,6 +542,48 @@ int main(int argc, char* argv[]){
 	char    *mv, *uv;
 	char    error_buf[2048]="\0";
 	struct  timeval	then, now;
+	char   *shm_name = NULL;			/* Shared-memory ring (-M) */
+	struct  shmring *ring = NULL;
+	int     chan_major = 0;				/* -C: read with DAQmx_Val_GroupByChannel, rather than GroupByScanNumber */
+	int     ss = DEV_NUM_CH, cs = 1, c, k;		/* Layout of this chunk: sample i of channel c is data[ss*i + cs*c]. (Tuples: ss = num_channels; -C: ss = 1, cs = the chunk's length) */
+	void   *ring_buf = NULL;			/* (-C with -M) The chunk, interleaved for the ring */
+	int     mapped = 0;				/* -w: binary capture file, memory-mapped */
+	struct  mapfile mf;
+	float64 *rdata = data;				/* Where this read goes: data[], or (-w) the mapped file. (Likewise rdata_i, for int32) */
+	int32   *rdata_i = data_i;
+	uInt32  rsize = BUFFER_SIZE;			/* ... and its size, in values */
+	void   *rbuf;
+	uint64_t space, remaining, kept;
+	float64 coeff[MAPFILE_SCALE_COEFFS];
+	float64 scale[DEV_NUM_CH][MAPFILE_SCALE_COEFFS];	/* (-w, -Z) Each channel's scaling polynomial, code to volts */
+	int     compressed = 0;				/* -Z: compressed stream of the int32 codes */
+	struct  codec zc;
+	FILE   *hfile = NULL;				/* (-Z, -r) The real output file. Until the loop starts, outfile collects the '#' lines, in htext */
+	char   *htext = NULL;
+	size_t  hsize = 0, hdr_bytes = 0;		/* (... of which the first hdr_bytes are the header: the rest is -j's discarded samples) */
+	uint64_t rotate_bytes = 0, r_bytes;		/* -r: start the next file after this many bytes, */
+	double  rotate_secs = 0, r_secs;		/*     or this much data. (As samples: rotate_samples) */
+	uInt64  rotate_samples = 0, seg_first = 0;	/* (... and the index of this file's first sample) */
+	unsigned segment = 0;
+	char    segment_filename[PATH_MAX], seg_text[256];
+	int     seg_len = 0;
+	struct  mapfile_header mhdr;			/* (-w with -r) The header, for the next file */
+	struct  timeval start_tv;			/* When the task was started */
+	int     header_later = 0;			/* (-Z, -r, -F) The '#' lines are collected in htext, and written at the start of each file */
+	int     flight = 0, recording = 0;		/* -F: flight recorder. (Writing an event's file, now?) */
+	float64 flight_pre = 0, flight_post = 0;	/*     Seconds of data before and after each event */
+	char   *flight_socket = NULL;			/* -K: control socket */
+	int     level_chan = -1, level_col = 0;		/* -L: event when a sample on this channel (the data's column level_col) reaches |level| */
+	float64 level = 0, level_prev = NAN;		/*     (|The last sample|, from the read before: an event is a crossing) */
+	int     ev_failed = 0;				/*     (A write to this event's file failed) */
+	struct  flight fr;
+	uInt64  pre_samples = 0, post_samples = 0, ev_sample, ev_next = 0, ev_end = 0, n64;
+	unsigned events = 0;
+	const char *ev_source;
+	const void *ev_p;
+	float64 ev_sum[DEV_NUM_CH], ev_sum_squares[DEV_NUM_CH];	/* (The events' kernels add these up too: they're not the stats) */
+	char   *endp;
+	char    chan_name[64];
 
 	/* Set handler for SIGUSR1: print state to stderr. */
 	signal(SIGUSR1, handle_signal_usr1);
@@ -387,8 +593,11 @@ int main(int argc, char* argv[]){
                 print_help(argv[0]);
                 exit (EXIT_SUCCESS);
         }
+	if (realtime_args (&argc, argv, &rt)){			/* Likewise --realtime[=CPU][,poll]; remove it before getopt */
+		feprintf ("Invalid --realtime. Use --realtime, --realtime=CPU, --realtime=poll, or --realtime=CPU,poll.\n");
+	}
 
-        while ((opt = getopt(argc, argv, "sdbghxABDIQRSc:e:f:i:j:l:m:n:o:p:t:v:T:")) != -1) {  /* Getopt */
+        while ((opt = getopt(argc, argv, "sdbghwxABCDIQRSZc:e:f:i:j:l:m:n:o:p:r:t:v:F:K:L:M:T:")) != -1) {  /* Getopt */
                 switch (opt) {
                         case 'h':                               /* Help */
 				print_help(argv[0]);
@@ -397,6 +606,9 @@ int main(int argc, char* argv[]){
 			case 'A':				/* Stay alive, even with fatal errors.*/
 				stay_alive = 1;
 				break;
+			case 'C':				/* Read channel-major */
+				chan_major = 1;
+				break;
 			case 'I':				/* Get info */
 				do_getinfo = 1;
 				break;
@@ -430,6 +642,13 @@ int main(int argc, char* argv[]){
 			case 'x':				/* Allow output file to be overwritten if it exists */
 				allow_overwrite = 1;
 				break;
+			case 'w':				/* Binary, memory-mapped capture file */
+				mapped = 1;
+				break;
+
+			case 'Z':				/* Compressed stream of the int32 codes */
+				compressed = 1;
+				break;
 
 			case 'c':				/* Input Channel: 0,1,2,3,all,sum */
 				channel_arg = optarg;
@@ -577,6 +796,37 @@ int main(int argc, char* argv[]){
 				do_triggerready_delete = 1;
 				triggerready_filename = optarg;
 				break;
+
+			case 'M':				/* Shared-memory ring */
+				shm_name = optarg;
+				break;
+
+			case 'F':				/* Flight recorder: pre[,post] seconds, around each event */
+				flight = 1;
+				flight_pre = strtod (optarg, &endp);
+				flight_post = (*endp == ',') ? strtod (endp + 1, &endp) : flight_pre;
+				if ( (*endp != '\0') || (flight_pre < 0) || (flight_post < 0) ){
+					feprintf ("Fatal Error: flight recorder (-F) needs pre[,post], in seconds, each >= 0.\n");
+				}
+				break;
+			case 'K':				/* Flight recorder: control socket */
+				flight_socket = optarg;
+				break;
+			case 'L':				/* Flight recorder: level on a channel */
+				if ( (sscanf (optarg, "%d,%lf", &level_chan, &level) != 2) || (level_chan < 0) || (level_chan >= DEV_NUM_CH) || (level <= 0) ){
+					feprintf ("Fatal Error: level (-L) must be channel,level, eg 0,0.5 (channel 0-%d; level > 0, in the units of -o).\n", DEV_NUM_CH - 1);
+				}
+				break;
+			case 'r':				/* Rotate the output file, after a size or a duration. (Given twice, whichever comes first) */
+				r_bytes = 0;  r_secs = 0;
+				if (rotate_limit (optarg, &r_bytes, &r_secs)){
+					feprintf ("Fatal Error: rotation limit (-r) must be a size, eg 500M, or a duration, eg 1h.\n");
+				}else if ( (r_bytes && rotate_bytes) || (r_secs && rotate_secs) ){
+					feprintf ("Fatal Error: rotation limit (-r) given twice as a %s. Give at most one size and one duration.\n", r_bytes ? "size" : "duration");
+				}
+				rotate_bytes = r_bytes ? r_bytes : rotate_bytes;
+				rotate_secs  = r_secs  ? r_secs  : rotate_secs;
+				break;
 				
 			default:
 				feprintf ("Unrecognised argument %c. Use -h for help.\n", opt);
@@ -615,13 +865,50 @@ int main(int argc, char* argv[]){
 	}
 	output_filename = argv[optind];
 
+	if (mapped && ( (!strcmp(output_filename, "-")) || sum_channels || chan_major) ){
+		ffeprintf ("Binary capture file (-w) must be a real file, of the channels as read: not '-', nor with -c sum or -C.\n");
+	}
+	if (compressed && (sum_channels || mapped) ){
+		ffeprintf ("Compressed stream (-Z) is of the channels as read: not with -c sum, nor with -w.\n");
+	}else if (compressed){			/* (It's the int32 codes that compress losslessly) */
+		format_floatv = 0;
+		format_arg = "int32adc";
+	}
+	if (flight && ( (!strcmp(output_filename, "-")) || (!strcmp(output_filename, "/dev/null")) || sum_channels || chan_major || mapped || rotate_bytes || rotate_secs) ){
+		ffeprintf ("Flight recorder (-F) writes a file per event, of the channels as read: not to '-', nor with -c sum, -C, -w or -r.\n");
+	}else if ( (flight_socket || (level_chan >= 0)) && !flight ){
+		ffeprintf ("The control socket (-K) and the level (-L) are for the flight recorder: use them with -F.\n");
+	}else if ( (level_chan >= 0) && (num_channels == 1) && (level_chan != atoi (channel_arg)) ){
+		ffeprintf ("The level (-L) must be on a channel that's captured (-c %s).\n", channel_arg);
+	}
+	level_col = (num_channels == 1) ? 0 : level_chan;
+	if ( (rotate_bytes || rotate_secs) && ( (!strcmp(output_filename, "-")) || (!strcmp(output_filename, "/dev/null")) ) ){
+		ffeprintf ("Rotation (-r) needs a real output file, not '-' or /dev/null.\n");
+	}else if (rotate_bytes || rotate_secs || flight){	/* -r, -F: outfile is the name of the run: the files are numbered. See segment_name(). */
+		segment_name (segment_filename, sizeof (segment_filename), argv[optind], 0);
+		output_filename = segment_filename;
+	}
 	if (!strcmp(output_filename, "-")){
 		outfile = stdout;
 	}else if ( (!allow_overwrite) && (strcmp(output_filename, "/dev/null")) && (stat (output_filename, &stat_p) != -1) ){	/* check we can't stat, i.e. doesn't exist. */
 		ffeprintf ("Output file '%s' already exists, and -x was not specified. Will not overwrite.\n", output_filename);
+	}else if (flight){			/* -F: each event opens its own file (below). (Checked now, for the first: not at the first event) */
+		outfile = NULL;
+	}else if (mapped){			/* (The header is written below, once it's known) */
+		outfile = NULL;
+		if (mapfile_open (&mf, output_filename, num_channels, (format_floatv ? sizeof (float64) : sizeof (int32)), (rotate_bytes || rotate_secs) ? 0 : num_samples)){
+			ffeprintf ("Could not create (and preallocate) %s: %s\n", output_filename, strerror ( errno ) );
+		}
 	}else if ( ( outfile = fopen ( output_filename, "w" ) ) == NULL ) {   /* open for writing and truncate */
 		ffeprintf ("Could not open %s for writing: %s\n", output_filename, strerror ( errno ) );
 	}
+	header_later = compressed || ( (rotate_bytes || rotate_secs) && !mapped ) || flight;
+	if (header_later){			/* -Z: the '#' lines go into the stream as text; -r, -F: each file repeats them. Collect them until then. */
+		hfile = outfile;
+		if ( (outfile = open_memstream (&htext, &hsize)) == NULL){
+			ffeprintf ("Fatal Error: couldn't open a memory stream for the header: %s\n", strerror ( errno ) );
+		}
+	}
 	
  	if (do_triggerready_delete){		/* Trigger Ready file must pre-exist, and be empty. */
  		if (stat (triggerready_filename, &stat_p) == -1){
@@ -797,6 +1084,7 @@ int main(int argc, char* argv[]){
 		deprintf ("DAQmxSetReadReadAllAvailSamp: setting to true, to enable DAQmxReadAnalogF64() with DAQmx_Val_Auto to be non-blocking even when num_samples is finite...\n");
 		handleErr( DAQmxSetReadReadAllAvailSamp (taskHandle, TRUE) );
 	}
+	readsched_init (&rsched, readback_hz, BUFFER_SIZE_TUPLES);	/* The reads below ask for an exact number, so the above only matters for DAQmx_Val_Auto. */
 
 	/* Get the size of the onboard and input buffer. Just for interest, atm. */
 	/* Documented at:  /usr/local/natinst/nidaqmx/docs/mxcprop.chm/func230a.html , /usr/local/natinst/nidaqmx/docs/mxcprop.chm/func186c.html */
@@ -815,14 +1103,31 @@ int main(int argc, char* argv[]){
 	deprintf ("EnhancedAliasRejectionEnable: readback %d.\n", (int)enh_alias_reject );
 
 
-	/* Write out header to file (use the readback values where they might differ from the requested ones). */
-	outprintf ("#Data from %s (%s):\n", DEV_NAME, DEV_DEV);
-	outprintf ("#timestamp: %ld\n", then.tv_sec); 
-	outprintf ("#freq_hz:  %.3f\n", readback_hz);	outprintf ("#samples:  %s\n", samplenum_arg); 	outprintf ("#pretrigger_samples: %d\n", (unsigned int)pretrigger_samples);
-	outprintf ("#channel:  %s\n", channel_arg);	outprintf ("#voltage:  %.3f\n", readback_v2);	outprintf ("#gain:     %.1f\n", readback_g);
-	outprintf ("#coupling: %s\n", coupling_arg); 	outprintf ("#terminal: %s\n", terminal_arg);	outprintf ("#trigger:  %s\n", triggering_arg);
-	outprintf ("#clk_edge: %s\n", edge_arg); 	outprintf ("#format:   %s\n", format_arg);	outprintf ("#lf_ear:   %s\n", enable_adc_lf_ear_arg);
-	outprintf ("#initial_discard: %d\n", adcdelay_discard_samples);  
+	/* Write out header to file (use the readback values where they might differ from the requested ones). -w: the binary header, with the int32 scaling. */
+	memset (scale, 0, sizeof (scale));
+	for (c=0; (mapped || compressed) && !format_floatv && (c < num_channels); c++){
+		snprintf (chan_name, sizeof (chan_name), "/"DEV_DEV"/ai%d", (num_channels == 1) ? atoi (channel_arg) : c);
+		handleErr( DAQmxGetAIDevScalingCoeff (taskHandle, chan_name, coeff, MAPFILE_SCALE_COEFFS) );
+		memcpy (scale[c], coeff, sizeof (coeff));
+	}
+	if (mapped){
+		mf.hdr.freq_hz = readback_hz;	mf.hdr.voltage = readback_v2;	mf.hdr.gain = readback_g;
+		mf.hdr.pretrigger_samples = pretrigger_samples;		mf.hdr.initial_discard = adcdelay_discard_samples;
+		strncpy (mf.hdr.channel, channel_arg, sizeof (mf.hdr.channel) - 1);
+		memcpy (mf.hdr.scale, scale, sizeof (mf.hdr.scale));
+		if (mapfile_header (&mf)){
+			ffeprintf ("Could not write the header of %s: %s\n", output_filename, strerror ( errno ) );
+		}
+	}else{
+		outprintf ("#Data from %s (%s):\n", DEV_NAME, DEV_DEV);
+		outprintf ("#timestamp: %ld\n", then.tv_sec); 
+		outprintf ("#freq_hz:  %.3f\n", readback_hz);	outprintf ("#samples:  %s\n", samplenum_arg); 	outprintf ("#pretrigger_samples: %d\n", (unsigned int)pretrigger_samples);
+		outprintf ("#channel:  %s\n", channel_arg);	outprintf ("#voltage:  %.3f\n", readback_v2);	outprintf ("#gain:     %.1f\n", readback_g);
+		outprintf ("#coupling: %s\n", coupling_arg); 	outprintf ("#terminal: %s\n", terminal_arg);	outprintf ("#trigger:  %s\n", triggering_arg);
+		outprintf ("#clk_edge: %s\n", edge_arg); 	outprintf ("#format:   %s\n", format_arg);	outprintf ("#lf_ear:   %s\n", enable_adc_lf_ear_arg);
+		outprintf ("#initial_discard: %d\n", adcdelay_discard_samples);  
+		hdr_bytes = header_later ? ftell (outfile) : 0;
+	}
 
 
 	/* Commit the task (make sure all hardware is configured and ready). [This is also implicit in StartTask() if it hasn't been done]. Useful if we want to repeat the sampling task in a loop. Function call takes ~ 390 ms. */
@@ -847,12 +1152,42 @@ int main(int argc, char* argv[]){
 	deprintf("Setup time (for CreateTask...CommitTask) was: %.3g s.\n", (now.tv_sec - then.tv_sec + 1e-6 * (now.tv_usec - then.tv_usec)) );
 
 
+	/* -F: the ring holds the pre-event history, plus a read. Events: SIGUSR2, the control socket, the level. */
+	if (flight){
+		pre_samples = ceil (flight_pre * readback_hz);
+		post_samples = ceil (flight_post * readback_hz);
+		if (flight_init (&fr, num_channels * (format_floatv ? sizeof (float64) : sizeof (int32)), pre_samples + BUFFER_SIZE_TUPLES)){
+			ffeprintf ("Fatal Error: couldn't allocate the flight recorder's ring, for %llu samples.\n", (unsigned long long)(pre_samples + BUFFER_SIZE_TUPLES));
+		}
+		if (flight_socket && flight_listen (&fr, flight_socket)){
+			ffeprintf ("Fatal Error: can't listen on the control socket '%s': %s\n", flight_socket, strerror(errno));
+		}
+		signal(SIGUSR2, handle_signal_usr2);
+		deprintf ("Flight recorder: %llu samples before each event, %llu after (ring of %llu MB). Events: SIGUSR2%s%s.\n", (unsigned long long)pre_samples,
+			(unsigned long long)post_samples, (unsigned long long)((fr.cap * fr.tuple_bytes) >> 20), flight_socket ? ", control socket" : "", (level_chan >= 0) ? ", level" : "");
+	}
+
+	/* Real-time profile (--realtime): lock and pre-fault the memory, pin to a CPU, SCHED_FIFO. Reports what took effect. */
+	realtime_prefault (&rt, data, sizeof(data));
+	realtime_prefault (&rt, data_i, sizeof(data_i));
+	realtime_prefault (&rt, fb.buf, sizeof(fb.buf));
+	if (flight){
+		realtime_prefault (&rt, fr.buf, fr.cap * fr.tuple_bytes);
+	}
+	realtime_start (&rt);
+	rsched.busy_poll = rt.busy_poll;
+
 	/* Start the task. Sampling starts now, unless we defined an external trigger (with DAQmxCfgDigEdgeStartTrig() above). Function call takes ~ 1.6 ms (if already committed). */
         /* At this point, IFF we are in Reference trigger mode and IF PFI0 is not already held in the active state, RTSI6 will start to be clocked */
 	/* WARNING: it can take up to 2 seconds to get here (occasionally more); triggers received before now will be ignored. Hence the implementation of -T. */
 	/* Documented at: /usr/local/natinst/nidaqmx/docs/daqmxcfunc.chm/daqmxstarttask.html */
 	deprintf ("DAQmxStartTask: Starting task...\n");
 	handleErr( DAQmxStartTask(taskHandle) );
+	readsched_start (&rsched);
+	gettimeofday (&start_tv, NULL);
+	if (mapped){
+		mf.hdr.start_sec = start_tv.tv_sec;  mf.hdr.start_usec = start_tv.tv_usec;
+	}
 	if (trigger_ext){		/* Make it explicit, especially if we have just received a trigger and failed to respond to it because we were not ready! */
 		eprintf ("NI4462 waiting for trigger.\n");
 		state = "Ready/Running"; /* Best we can do: can't distinguish "waiting for trigger" from "triggered and sampling". */
@@ -872,14 +1207,16 @@ int main(int argc, char* argv[]){
 	if (adcdelay_discard_samples > 0){
 		n = adcdelay_discard_samples;  j = 0;
 		deprintf ("Discarding the first %d samples as junk...\n", adcdelay_discard_samples);
-		outprintf("#preserving the initial discarded samples (invoked with '-j %d'); at most %d will be kept:\n", adcdelay_discard_samples, MAX_COMMENTED_DISCARDED_SAMPS);
+		if (!mapped){
+			outprintf("#preserving the initial discarded samples (invoked with '-j %d'); at most %d will be kept:\n", adcdelay_discard_samples, MAX_COMMENTED_DISCARDED_SAMPS);
+		}
 		while (n > 0){
 			m =  (n > BUFFER_SIZE_TUPLES) ? BUFFER_SIZE_TUPLES : n ;	/* discard in chunks of m; n may be too large for the buffer. */
 			deprintf ("DAQmxReadAnalogF64: Blocking read of %d samples (out of %d) to be discarded as junk...\n", m, adcdelay_discard_samples);
 			handleErr( DAQmxReadAnalogF64(taskHandle, m, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &num_samples_read_thistime, NULL) );
 			deprintf ("    ...acquired %d points, discarding the data.\n",(int)num_samples_read_thistime);
 			n -= num_samples_read_thistime;
-			for (i=0; i < num_samples_read_thistime; i++, j++){  /* include the junk data as comments, just in case */
+			for (i=0; !mapped && (i < num_samples_read_thistime); i++, j++){  /* include the junk data as comments, just in case (not in the binary file) */
 				if (j > MAX_COMMENTED_DISCARDED_SAMPS){	     /* (skip after the first 1k, or file can get very large) */
 					break;
 				}else if (num_channels == 1){
@@ -893,138 +1230,226 @@ int main(int argc, char* argv[]){
 		}
 	}	
 
+	/* Create the shared-memory ring, if wanted. Readers attach to it by name; we never wait for them. */
+	if (shm_name){
+		ring = shmring_create (shm_name, "", 0);
+		if (ring == NULL){
+			ffeprintf ("Fatal Error: couldn't create shared-memory ring '%s': %s\n", shm_name, strerror(errno));
+		}
+		deprintf ("Publishing to shared-memory ring '%s'.\n", shm_name);
+		if (chan_major && ( (ring_buf = malloc (sizeof (data))) == NULL) ){
+			ffeprintf ("Fatal Error: couldn't malloc() the buffer to interleave channel-major chunks for the ring.\n");
+		}
+	}
+
+	/* -r: each file holds rotate_samples (or fewer: see rotate_bytes), and its header says where it starts. (-w: its size is known, so that's a number of samples too) */
+	if (rotate_secs){
+		rotate_samples = ceil (rotate_secs * readback_hz);
+	}
+	if (mapped && rotate_bytes){
+		space = (rotate_bytes > MAPFILE_HEADER_BYTES + mf.tuple_bytes) ? (rotate_bytes - MAPFILE_HEADER_BYTES) / mf.tuple_bytes : 1;
+		rotate_samples = (rotate_samples && (rotate_samples < space)) ? rotate_samples : space;
+		rotate_bytes = 0;
+	}
+	if (mapped && rotate_samples && mapfile_reserve (&mf, segment_samples (seg_first, rotate_samples, num_samples))){	/* (Opened with no preallocation: the size of each file wasn't known yet) */
+		ffeprintf ("Could not preallocate %s: %s\n", output_filename, strerror ( errno ) );
+	}
+	if (rotate_bytes || rotate_samples){
+		seg_len = snprintf (seg_text, sizeof (seg_text), "#first_sample: %llu\n#start_time: %ld.%06ld\n", (unsigned long long)seg_first, (long)start_tv.tv_sec, (long)start_tv.tv_usec);
+		deprintf ("Rotating the output: files of %llu samples, or %llu bytes (0: no limit). The first is %s.\n", (unsigned long long)rotate_samples, (unsigned long long)rotate_bytes, output_filename);
+	}
+
+	/* -Z, -r: start the file, with the '#' lines so far (-r: and where it starts, after the header). -Z: as text, in the stream. Then outfile is the real file again. */
+	if (header_later){
+		fclose (outfile);
+		outfile = hfile;
+		if (outfile && output_begin (outfile, compressed ? &zc : NULL, num_channels, scale, htext, hdr_bytes, seg_text, seg_len, htext + hdr_bytes, hsize - hdr_bytes)){
+			ffeprintf ("Could not write the header of %s: %s\n", output_filename, strerror ( errno ) );
+		}
+	}
+
+	/* Choose the processing kernels, once: 1 channel, 4 summed, or 4 separate. (-w: the data is already in the file; -Z: it's compressed below; -F: only the events */
+	/* are written, by output_f/d, from the ring: just the stats.) */
+	process_f = output_f = (num_channels == 1) ? process_1f : ( sum_channels ? process_sumf : process_4f );
+	process_d = output_d = (num_channels == 1) ? process_1d : ( sum_channels ? process_sumd : process_4d );
+	if (mapped || compressed || flight){
+		process_f = (num_channels == 1) ? stats_1f : stats_4f;
+		process_d = (num_channels == 1) ? stats_1d : stats_4d;
+	}
+	fmt_init (&fb, outfile);
+
 	//Set handler for Ctrl-C. Within the following while loop only, Ctrl-C must break out of the loop, not kill the program */
 	signal(SIGINT, handle_signal_cc);
 
 	/* Loop, reading data and writing it to file. We might be reading continuously, or might have a finite number of samples which is too large for any buffer. */
 	/* We WANT to do select(), i.e. block until there is at least 1 sample available, then read as much as there is. One might expect that using:
 	 *    DAQmxReadAnalogF64(DAQmx_Val_Auto, DAQmx_Val_WaitInfinitely) would achieve this (documentation is unclear), but in fact, it returns immediately if there are no reads.
-	 * So, first do a blocking read of exactly 1 data point, then do a non-blocking read of as many samples are available. Rather ugly, but it does work!
-	 * Actually, slightly more efficient: do a non-blocking read, then (iff we got zero samples), do the blocking read. */
+	 * This used to do a non-blocking read, then (iff we got zero samples), a blocking read of 1 sample: that works, but at low rates it's many tiny reads.
+	 * Instead, the read scheduler (ni4462_readsched.c) knows the sample rate: it sleeps until a worthwhile chunk should be ready, then we read exactly that many. */
 	while (1){
 
-		/* First, let the device actually do some sampling! We'll block if there is nothing to read. */
+		/* First, let the device actually do some sampling! We'll block if there is nothing to read (eg waiting for the external trigger). */
+		if ( (num_samples_read_total == 0) && (trigger_ext == 1) ){
+			deprintf ("Waiting for external trigger (blocking read)...\n");
+		}
+		remaining = (continuous && (num_samples == 0)) ? BUFFER_SIZE_TUPLES : (num_samples - num_samples_read_total);
+		if (rotate_samples && (seg_first + rotate_samples - num_samples_read_total < remaining)){	/* -r: stop at the end of this file. (The next read starts the next) */
+			remaining = seg_first + rotate_samples - num_samples_read_total;
+		}
+		if (mapped){		/* -w: read straight into the mapped file, up to the end of its window. */
+			if ( (rbuf = mapfile_next (&mf, &space)) == NULL ){
+				ffeprintf ("Fatal Error: couldn't extend or map %s: %s\n", output_filename, strerror ( errno ) );
+			}
+			rdata = rbuf;  rdata_i = rbuf;
+			remaining = (space < remaining) ? space : remaining;
+			rsize = remaining * num_channels;
+		}
+		num_samples_wanted = readsched_next (&rsched, remaining);
 
 		if (format_floatv){   /* Read data in floatV format (default) */
 
-			/* Non-blocking read of all the samples that are available. May return 0 or more samples (automatically safely limited by size of buffer). */
-			/* Note that DAQmx_Val_Auto works the same way for both finite and continuous sampling, thanks to DAQmxSetReadReadAllAvailSamp(TRUE) above */
-			/* Given the other settings, the 3rd parameter of DAQmxReadAnalogF64() can be either "0" or DAQmx_Val_WaitInfinitely. The effect is identical [except in Reference-trigger mode, where the latter is fine, but 0 causes error -200281.] */
+			/* Blocking read of exactly the samples that the scheduler expects to be ready. (Limited by the size of the buffer.) */
+			/* Given the other settings, the 3rd parameter of DAQmxReadAnalogF64() could be a timeout, but DAQmx_Val_WaitInfinitely is what we want: the first read waits for the trigger. */
 			/* Documented at: /usr/local/natinst/nidaqmx/docs/daqmxcfunc.chm/daqmxreadanalogf64.html */
-			vdeprintf("DAQmxReadAnalogF64: Non-blocking read of as many samples as available, immediate timeout...\n");
-			handleErr( DAQmxReadAnalogF64(taskHandle, DAQmx_Val_Auto, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &num_samples_read_thistime, NULL) );
+			vdeprintf("DAQmxReadAnalogF64: Blocking read of %lld samples, infinite timeout...\n", (long long)num_samples_wanted);
+			handleErr( DAQmxReadAnalogF64(taskHandle, num_samples_wanted, DAQmx_Val_WaitInfinitely, (chan_major ? DAQmx_Val_GroupByChannel : DAQmx_Val_GroupByScanNumber), rdata, rsize, &num_samples_read_thistime, NULL) );
+			readsched_done (&rsched, num_samples_read_thistime);
 			num_samples_read_total += num_samples_read_thistime;
 			vdeprintf("    ...acquired %d points this time; total is: %lld.\n",(int)num_samples_read_thistime, (long long)num_samples_read_total);
-
-			/* IFF we got zero samples, now do a blocking read, and wait. Otherwise, optimise: guess that it won't block, so wait for the next iteration. */
-			/* NB, because we got ZERO samples last time, we can start writing at data, not data+n. */
-			if (num_samples_read_thistime == 0){
-				/* Blocking read of 1 sample. */
-				vdeprintf("DAQmxReadAnalogF64: Blocking read of 1 sample, infinite timeout...\n");
-				/* This is where we block, if waiting for an external trigger input */
-				if ( (num_samples_read_total == 0) && (trigger_ext == 1) ){
-					deprintf ("Waiting for external trigger (blocking read)...\n");
-				}
-				handleErr( DAQmxReadAnalogF64(taskHandle, 1, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, (sizeof(data)/sizeof(data[0])), &num_samples_read_thistime, NULL) );
-				num_samples_read_total += num_samples_read_thistime;
-				vdeprintf("    ...acquired %d points this time; total is: %lld.\n",(int)num_samples_read_thistime, (long long)num_samples_read_total);
-				if (num_samples_read_thistime != 1){  /* sanity check. */
-					feprintf ("This shouldn't be possible: blocking read of 1 sample with infinite timeout returned %d samples, expected 1.\n", (int)num_samples_read_thistime);
+			ss = chan_major ? 1 : num_channels;  cs = chan_major ? num_samples_read_thistime : 1;
+			if (ring){		/* Publish the chunk, as read. (The ring's messages are tuples: interleave a channel-major chunk first.) */
+				for (k=0; chan_major && (num_channels > 1) && (k < num_samples_read_thistime); k++){
+					for (c=0; c < DEV_NUM_CH; c++){
+						((float64 *)ring_buf)[DEV_NUM_CH*k + c] = rdata[ss*k+cs*c];
+					}
 				}
+				shmring_put_raw (ring, SHM_RAW_F64, num_channels, 0, num_samples_read_total - num_samples_read_thistime, (chan_major && (num_channels > 1)) ? ring_buf : (void *)rdata, num_samples_read_thistime, sizeof (float64));
 			}
 
-			/* Now write out the data to file in the right format. At the same time, add up sum[],sum_squares[] for the stats. */
-			for (i=0; i < num_samples_read_thistime; i++){
-				if ((num_samples && continuous) && (i >= abs(num_samples + num_samples_read_thistime - num_samples_read_total))){ /* Special case of large, finite number of samples, promoted to "cont", on the final read: discard any surplus data. */
-					deprintf ("Large, finite samples in continuous mode; discarding %d surplus samples from end.\n", (int)num_samples_read_thistime - i);
-					num_samples_read_total = num_samples;
-					break;
-				}
-				if (num_channels == 1){		/* 1 channel only */
-					output_1f ( data[i] );
-					sum[0] += data[i];
-					sum_squares[0] += data[i]*data[i];
-				}else if (sum_channels == 1){  /*  4 channels, summed */
-					data_tmp = data[DEV_NUM_CH*i] + data[DEV_NUM_CH*i+1] + data[DEV_NUM_CH*i+2] + data[DEV_NUM_CH*i+3];
-					output_1f (data_tmp);
-					sum[0] += data_tmp;
-					sum_squares[0] += data_tmp * data_tmp;
-				}else{				/* 4 channnels, separate */
-					output_4f ( data[DEV_NUM_CH*i], data[DEV_NUM_CH*i+1], data[DEV_NUM_CH*i+2], data[DEV_NUM_CH*i+3] );
-					sum[0] += data[DEV_NUM_CH*i]; sum[1] += data[DEV_NUM_CH*i+1]; sum[2] += data[DEV_NUM_CH*i+2]; sum[3] += data[DEV_NUM_CH*i+3];
-					sum_squares[0] += data[DEV_NUM_CH*i] * data[DEV_NUM_CH*i]; sum_squares[1] += data[DEV_NUM_CH*i+1] * data[DEV_NUM_CH*i+1]; sum_squares[2] += data[DEV_NUM_CH*i+2] * data[DEV_NUM_CH*i+2]; sum_squares[3] += data[DEV_NUM_CH*i+3] * data[DEV_NUM_CH*i+3];
-				}
-			}
+			/* Now write out the data to file in the right format. At the same time, add up sum[],sum_squares[] for the stats. (The kernel was chosen before the loop.) */
+			kept = keep_samples (num_samples, continuous, num_samples_read_thistime, &num_samples_read_total);
+			process_f (&fb, rdata, kept, ss, cs, sum, sum_squares);
 
 			/* Print some sample data points for debugging: the first 10. */
 			for (i=0; ( (i < num_samples_read_thistime) && (num_samples_printed < 10) ); i++, num_samples_printed++){
 				if (num_channels == 1){		/* 1 channel only */
-					deprintf("Data value %d is: %f\n",num_samples_printed,data[i]);
+					deprintf("Data value %d is: %f\n",num_samples_printed,rdata[i]);
 				}else if (sum_channels == 1){  /*  4 channels, summed */
-					deprintf("Data value %d is: %f\n",num_samples_printed,  (data[DEV_NUM_CH*i] + data[DEV_NUM_CH*i+1] + data[DEV_NUM_CH*i+2] + data[DEV_NUM_CH*i+3]) );
+					deprintf("Data value %d is: %f\n",num_samples_printed,  (rdata[ss*i] + rdata[ss*i+cs*1] + rdata[ss*i+cs*2] + rdata[ss*i+cs*3]) );
 				}else{				/* 4 channnels, separate */
-					deprintf("Data value %d is: %f, %f, %f, %f\n",num_samples_printed, data[DEV_NUM_CH*i], data[DEV_NUM_CH*i+1], data[DEV_NUM_CH*i+2], data[DEV_NUM_CH*i+3]);
+					deprintf("Data value %d is: %f, %f, %f, %f\n",num_samples_printed, rdata[ss*i], rdata[ss*i+cs*1], rdata[ss*i+cs*2], rdata[ss*i+cs*3]);
 				}
 			}
 
 		}else{	/* Read data in int32ADC format. Otherwise, as above. Rather ugly to duplicate so much code, just to change type of data vs data_i. We could do it with function pointers, but that would make it less readable. */
 
 			/* Documented at: /usr/local/natinst/nidaqmx/docs/daqmxcfunc.chm/daqmxreadbinaryi32.html */
-			vdeprintf  ("DAQmxReadBinaryI32: Non-blocking integer read of as many samples as available, immediate timeout...\n");
-			handleErr( DAQmxReadBinaryI32(taskHandle, DAQmx_Val_Auto, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data_i, (sizeof(data_i)/sizeof(data_i[0])), &num_samples_read_thistime, NULL) );
+			vdeprintf  ("DAQmxReadBinaryI32: Blocking integer read of %lld samples, infinite timeout...\n", (long long)num_samples_wanted);
+			handleErr( DAQmxReadBinaryI32(taskHandle, num_samples_wanted, DAQmx_Val_WaitInfinitely, (chan_major ? DAQmx_Val_GroupByChannel : DAQmx_Val_GroupByScanNumber), rdata_i, rsize, &num_samples_read_thistime, NULL) );
+			readsched_done (&rsched, num_samples_read_thistime);
 			num_samples_read_total += num_samples_read_thistime;
 			vdeprintf("    ...acquired %d points this time; total is: %lld.\n",(int)num_samples_read_thistime, (long long)num_samples_read_total);
 
-			if (num_samples_read_thistime == 0){
-				vdeprintf  ("DAQmxReadBinaryI32: Blocking integer read of 1 sample, infinite timeout...\n");
-				/* This is where we block, if waiting for an external trigger input */
-				if ( (num_samples_read_total == 0) && (trigger_ext == 1) ){
-					deprintf ("Waiting for external trigger (blocking read)...\n");
-				}
-				handleErr( DAQmxReadBinaryI32(taskHandle, 1, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data_i, (sizeof(data_i)/sizeof(data_i[0])), &num_samples_read_thistime, NULL) );
-				num_samples_read_total += num_samples_read_thistime;
-				vdeprintf("    ...acquired %d points this time; total is: %lld.\n",(int)num_samples_read_thistime, (long long)num_samples_read_total);
-				if (num_samples_read_thistime != 1){  /* sanity check. */
-					feprintf ("Fatal Error: blocking read of 1 sample with infinite timeout returned %d samples, expected 1.\n", (int)num_samples_read_thistime);
+			ss = chan_major ? 1 : num_channels;  cs = chan_major ? num_samples_read_thistime : 1;
+			if (ring){
+				for (k=0; chan_major && (num_channels > 1) && (k < num_samples_read_thistime); k++){
+					for (c=0; c < DEV_NUM_CH; c++){
+						((int32 *)ring_buf)[DEV_NUM_CH*k + c] = rdata_i[ss*k+cs*c];
+					}
 				}
+				shmring_put_raw (ring, SHM_RAW_I32, num_channels, 0, num_samples_read_total - num_samples_read_thistime, (chan_major && (num_channels > 1)) ? ring_buf : (void *)rdata_i, num_samples_read_thistime, sizeof (int32));
 			}
 
-			for (i=0; i < num_samples_read_thistime; i++){
-				if ((num_samples && continuous) && (i >= abs(num_samples + num_samples_read_thistime - num_samples_read_total))){ /* Special case of large, finite number of samples, promoted to "cont", on the final read: discard any surplus data. */
-					deprintf ("Large, finite samples in continuous mode; discarding %d surplus samples from end.\n", (int)num_samples_read_thistime - i);
-					num_samples_read_total = num_samples;
-					break;
-				}
-				if (num_channels == 1){
-					output_1d ( (int)data_i[i] );
-					sum[0] += data_i[i];
-					sum_squares[0] += (float64)data_i[i] * data_i[i];
-				}else if (sum_channels == 1){
-					data_i_tmp = data_i[DEV_NUM_CH*i] + data_i[DEV_NUM_CH*i+1] + data_i[DEV_NUM_CH*i+2] + data_i[DEV_NUM_CH*i+3];
-					output_1d ((int)data_i_tmp);
-					sum[0] += data_i_tmp;
-					sum_squares[0] += (float64)data_i_tmp * data_i_tmp;
-				}else{
-					output_4d ( (int)data_i[DEV_NUM_CH*i], (int)data_i[DEV_NUM_CH*i+1], (int)data_i[DEV_NUM_CH*i+2], (int)data_i[DEV_NUM_CH*i+3] );
-					sum[0] += data_i[DEV_NUM_CH*i]; sum[1] += data_i[DEV_NUM_CH*i+1]; sum[2] += data_i[DEV_NUM_CH*i+2]; sum[3] += data_i[DEV_NUM_CH*i+3];
-					sum_squares[0] += (float64)data_i[DEV_NUM_CH*i] * data_i[DEV_NUM_CH*i]; sum_squares[1] += (float64)data_i[DEV_NUM_CH*i+1] * data_i[DEV_NUM_CH*i+1]; sum_squares[2] += (float64)data_i[DEV_NUM_CH*i+2] * data_i[DEV_NUM_CH*i+2]; sum_squares[3] += (float64)data_i[DEV_NUM_CH*i+3] * data_i[DEV_NUM_CH*i+3];
-				}
+			kept = keep_samples (num_samples, continuous, num_samples_read_thistime, &num_samples_read_total);
+			process_d (&fb, rdata_i, kept, ss, cs, sum, sum_squares);
+			if (compressed && !flight && codec_put (&zc, rdata_i, kept, ss, cs)){
+				ffeprintf ("Fatal Error: couldn't write to %s: %s\n", output_filename, strerror ( errno ) );
 			}
 
 			for (i=0; ( (i < num_samples_read_thistime) && (num_samples_printed < 10) ); i++, num_samples_printed++){
 				if (num_channels == 1){		/* 1 channel only */
-					deprintf("Data value %d is: %d\n",num_samples_printed,(int)data_i[i]);
+					deprintf("Data value %d is: %d\n",num_samples_printed,(int)rdata_i[i]);
 				}else if (sum_channels == 1){  /*  4 channels, summed */
-					deprintf("Data value %d is: %d\n",num_samples_printed,  ((int)data_i[DEV_NUM_CH*i] + (int)data_i[DEV_NUM_CH*i+1] + (int)data_i[DEV_NUM_CH*i+2] + (int)data_i[DEV_NUM_CH*i+3]) );
+					deprintf("Data value %d is: %d\n",num_samples_printed,  ((int)rdata_i[ss*i] + (int)rdata_i[ss*i+cs*1] + (int)rdata_i[ss*i+cs*2] + (int)rdata_i[ss*i+cs*3]) );
 				}else{				/* 4 channnels, separate */
-					deprintf("Data value %d is: %d, %d, %d, %d\n",num_samples_printed, (int)data_i[DEV_NUM_CH*i], (int)data_i[DEV_NUM_CH*i+1], (int)data_i[DEV_NUM_CH*i+2], (int)data_i[DEV_NUM_CH*i+3]);
+					deprintf("Data value %d is: %d, %d, %d, %d\n",num_samples_printed, (int)rdata_i[ss*i], (int)rdata_i[ss*i+cs*1], (int)rdata_i[ss*i+cs*2], (int)rdata_i[ss*i+cs*3]);
 				}
 			}
 		}
 
 
-		/* Flush data to file (useful if we are waiting for slooow sampling) */
-		fflush (outfile);
+		/* -F: keep this read in the ring. On an event (unless one is being written already), start the next file, with the history from the ring; */
+		/* then, read by read, the post-event data, till it's done. The level is the most precise: its event is the sample itself; the others, this read's end. */
+		if (flight){
+			flight_put (&fr, format_floatv ? (void *)rdata : (void *)rdata_i, kept);
+			ev_source = NULL;
+			ev_sample = num_samples_read_total;
+			if (flight_signal){
+				flight_signal = 0;
+				ev_source = "signal";
+			}
+			if (flight_poll (&fr)){
+				ev_source = "socket";
+			}
+			if ( (level_chan >= 0) && ( (i = format_floatv ? flight_level_f (rdata, kept, num_channels, level_col, level, &level_prev) :
+									flight_level_d (rdata_i, kept, num_channels, level_col, level, &level_prev)) >= 0) ){
+				ev_sample = num_samples_read_total - kept + i;
+				ev_source = "level";
+			}
+			if (ev_source && recording){
+				deprintf ("Event (%s) at sample %llu, while writing the last one: ignored.\n", ev_source, (unsigned long long)ev_sample);
+			}else if (ev_source){
+				ev_next = (ev_sample > pre_samples + flight_oldest (&fr)) ? ev_sample - pre_samples : flight_oldest (&fr);
+				ev_end = ev_sample + post_samples;
+				segment_name (segment_filename, sizeof (segment_filename), argv[optind], events++);
+				output_filename = segment_filename;
+				seg_len = snprintf (seg_text, sizeof (seg_text), "#first_sample: %llu\n#start_time: %ld.%06ld\n#event_sample: %llu\n#event: %s\n", (unsigned long long)ev_next,
+					(long)start_tv.tv_sec, (long)start_tv.tv_usec, (unsigned long long)ev_sample, ev_source);
+				if ( (!allow_overwrite) && (stat (output_filename, &stat_p) != -1) ){	/* (An unattended run mustn't die here: drop the event, and stay armed) */
+					eprintf ("Error: event (%s) at sample %llu dropped: '%s' already exists, and -x was not specified.\n", ev_source, (unsigned long long)ev_sample, output_filename);
+				}else if ( (outfile = fopen (output_filename, "w")) == NULL ){
+					eprintf ("Error: event (%s) at sample %llu dropped: could not open %s for writing: %s\n", ev_source, (unsigned long long)ev_sample, output_filename, strerror ( errno ) );
+				}else{
+					fmt_init (&fb, outfile);
+					recording = 1;
+					eprintf ("Event (%s) at sample %llu: writing %s.\n", ev_source, (unsigned long long)ev_sample, output_filename);
+					ev_failed = output_begin (outfile, compressed ? &zc : NULL, num_channels, scale, htext, hdr_bytes, seg_text, seg_len, NULL, 0);
+				}
+			}
+			while ( recording && (ev_next < num_samples_read_total) && (ev_next < ev_end) ){	/* (At most 2 pieces: the ring wraps) */
+				ev_p = flight_at (&fr, ev_next, &n64);
+				n64 = (ev_end - ev_next < n64) ? ev_end - ev_next : n64;
+				if (compressed){
+					ev_failed |= codec_put (&zc, ev_p, n64, num_channels, 1);
+				}else if (format_floatv){
+					output_f (&fb, ev_p, n64, num_channels, 1, ev_sum, ev_sum_squares);
+				}else{
+					output_d (&fb, ev_p, n64, num_channels, 1, ev_sum, ev_sum_squares);
+				}
+				ev_next += n64;
+			}
+			if ( recording && (!ev_failed) && ( fmt_flush (&fb) || fflush (outfile) ) ){
+				ev_failed = -1;
+			}
+			if ( recording && ( (ev_next >= ev_end) || ev_failed ) ){	/* Done; or, a write failed (eg the disk is full): give up on this event's file, and re-arm. */
+				recording = 0;
+				ev_failed |= (compressed && codec_finish (&zc)) ? -1 : 0;
+				ev_failed |= fclose (outfile);
+				if (ev_failed){
+					eprintf ("Error: couldn't write %s (the event is incomplete): %s\n", output_filename, strerror ( errno ) );
+				}
+				outfile = NULL;
+				ev_failed = 0;
+			}
+		}
+
+		/* Flush data to file (useful if we are waiting for slooow sampling): one write for the whole read. -w: the tuples are in the mapped file already. */
+		if (mapped){
+			mapfile_advance (&mf, kept);
+		}else if (outfile){
+			fmt_flush (&fb);
+			fflush (outfile);
+		}
 
 		/* Have we now got all the samples we need? */
 		if ( ( (!continuous) || (continuous && (num_samples != 0)) ) && (num_samples_read_total >= num_samples) ){  	/* '>=' is for safety; '==' is correct. */
@@ -1038,10 +1463,63 @@ int main(int argc, char* argv[]){
 			num_samples = num_samples_read_total;  /* set num_samples to what we actually got, not what we wanted. (also important for continuous mode) */
 			break;
 		}
+
+		/* -r: is this file full? Then finish it, and start the next, with the header and its first sample's index. Between reads: no sample is lost, or written twice. */
+		if ( (rotate_samples && (num_samples_read_total - seg_first >= rotate_samples)) ||
+		     (rotate_bytes && ( (uint64_t)(compressed ? (off_t)codec_size (&zc) : ftello (outfile)) >= rotate_bytes)) ){
+			if (mapped){
+				mhdr = mf.hdr;
+				ret = mapfile_close (&mf);
+			}else{
+				ret = (compressed && codec_finish (&zc)) ? -1 : 0;
+				ret = fclose (outfile) ? -1 : ret;
+			}
+			if (ret){
+				ffeprintf ("Fatal Error: couldn't finish writing %s: %s\n", output_filename, strerror ( errno ) );
+			}
+			seg_first = num_samples_read_total;
+			segment_name (segment_filename, sizeof (segment_filename), argv[optind], ++segment);
+			if ( (!allow_overwrite) && (stat (output_filename, &stat_p) != -1) ){
+				ffeprintf ("Output file '%s' already exists, and -x was not specified. Will not overwrite.\n", output_filename);
+			}
+			if (mapped){
+				ret = mapfile_open (&mf, output_filename, num_channels, mhdr.value_bytes, segment_samples (seg_first, rotate_samples, num_samples));
+				mf.hdr = mhdr;
+				mf.hdr.num_samples = 0;
+				mf.hdr.first_sample = seg_first;
+				ret = ret || mapfile_header (&mf);
+			}else if ( (outfile = fopen (output_filename, "w")) == NULL ){
+				ret = -1;
+			}else{
+				seg_len = snprintf (seg_text, sizeof (seg_text), "#first_sample: %llu\n#start_time: %ld.%06ld\n", (unsigned long long)seg_first, (long)start_tv.tv_sec, (long)start_tv.tv_usec);
+				ret = output_begin (outfile, compressed ? &zc : NULL, num_channels, scale, htext, hdr_bytes, seg_text, seg_len, NULL, 0);
+				fmt_init (&fb, outfile);
+			}
+			if (ret){
+				ffeprintf ("Fatal Error: couldn't start the next file, %s: %s\n", output_filename, strerror ( errno ) );
+			}
+			deprintf ("Rotated the output to %s, at sample %llu.\n", output_filename, (unsigned long long)seg_first);
+		}
+	}
+
+	/* -F: an event still being written is cut short. */
+	if (recording){
+		deprintf ("Stopped while writing %s: it has %llu of its samples after the event.\n", output_filename, (unsigned long long)(ev_next + post_samples - ev_end));
+		ret = ( fmt_flush (&fb) || (compressed && codec_finish (&zc)) ) ? -1 : 0;
+		if ( (fclose (outfile) != 0) || ret ){
+			feprintf ("Error: couldn't finish writing %s: %s\n", output_filename, strerror ( errno ) );
+		}
+		outfile = NULL;
+	}
+	if (flight){
+		deprintf ("Flight recorder: %u events written.\n", events);
+		flight_close (&fr);
 	}
 
 	/* Reset signal handler to default ? Maybe better to leave it. */
 	// signal(SIGINT, SIG_DFL);
+	deprintf ("Read scheduler: %llu reads (%llu blocked, %llu after a sleep); read call overhead %.1f us; target chunk %llu samples.\n", (unsigned long long)rsched.calls,
+		(unsigned long long)rsched.blocks, (unsigned long long)rsched.sleeps, rsched.overhead * 1e6, (unsigned long long)readsched_target (&rsched));
 
 
 	/* Check whether an overload (either digital or analog) occurred during this task. Must do this before stopping the task. */
@@ -1065,6 +1543,10 @@ int main(int argc, char* argv[]){
 	handleErr( DAQmxStopTask(taskHandle) );	 /* After stopping, we could start() again, without needing to repeat the configuration. */
 	handleErr( DAQmxClearTask(taskHandle) ); /* Clearing the task discards its configuration. [even if we omit these calls, they are is implicit when this program exits. */
 	state = "Stopped";
+	if (ring){		/* Tell the ring's readers that we're done. */
+		shmring_close (ring);
+		free (ring_buf);
+	}
 
 	/* Calculate and print statistics */
 	if (format_floatv){  /* units and multipliers */
@@ -1124,7 +1606,21 @@ int main(int argc, char* argv[]){
 	if (ret != 0){
 		deprintf ("Problem cleaning up.\n")
 	}
-        fclose ( outfile );
+	if (mapped){
+		if (mapfile_close (&mf)){
+			feprintf ("Error: couldn't finish writing %s: %s\n", output_filename, strerror ( errno ) );
+		}
+	}else if (outfile){
+		if (compressed){
+			if (codec_finish (&zc)){
+				feprintf ("Error: couldn't finish writing %s: %s\n", output_filename, strerror ( errno ) );
+			}
+			deprintf ("Compressed stream: %llu bytes, for %llu samples (%.2f bits/sample).\n", (unsigned long long)zc.written, (unsigned long long)zc.tuples,
+				zc.tuples ? (8.0 * zc.written / (zc.tuples * num_channels)) : 0.0);
+		}
+		fclose ( outfile );
+	}
+	free (htext);
 	if (do_syslog){
 		closelog();
 	}
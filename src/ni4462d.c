@@ -0,0 +1,614 @@
+/* Acquisition daemon for the NI 4462. Configuring a task is slow (DAQmxCreateAIVoltageChan ~ 750 ms, TaskCommit ~ 400 ms), and every run of ni4462_test
+   pays this again. Instead, ni4462d owns the device, keeps its configured tasks alive, and serves capture requests over a Unix socket. A repeated request,
+   with the same configuration, re-uses the cached task, and starts within milliseconds. The same binary is also the client (-q).
+
+ * Copyright (C) Richard Neill 2011-2013, <ni4462 at REMOVE.ME.richardneill.org>. This program is Free Software. You can
+ * redistribute and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.  An exception is granted to link against
+ * the National Instruments proprietary libraries, such as libnidaqmx. There is NO WARRANTY, neither express nor implied.
+ * For the details, please see: http://www.gnu.org/licenses/gpl.html
+*/
+
+/* Headers */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <libgen.h>
+
+#ifdef  USE_DUMMY_LIBDAQMX						/* Option to compile in dummy mode, without actually using the real libnidaqm */
+  #include "daqmx_dummy.c"
+#else
+  #include <NIDAQmx.h>							/* NI's library. Also '-lnidaqmx' */
+#endif
+
+#define LIBDAQMX_TMPDIR		"/tmp/natinst/"				/* Temp dir for NI's lock files. We clean this up below. Caution. */
+#ifndef OnboardClock							/* Bugfix: defined in docs, not in header */
+#define OnboardClock NULL
+#endif
+
+/* Device properties */
+#define DEV_NAME			"NI 4462"			/* Product name */
+#define DEV_DEV				"Dev1"				/* Which PCI device to use. (Can change with PCI slot, even if only 1 NI card is installed) */
+#define DEV_TRIGGER_INPUT		"PFI0"				/* Name of the Digital trigger input */
+#define DEV_NUM_CH			4				/* Number of input channels on this one. Avoids (some) hardcoded "4"s. */
+#define DEV_VOLTAGE_MAX			42.4				/* Max safe input voltage for circut */
+#define DEV_FREQ_MIN			31.25				/*    Min freq */
+#define DEV_FREQ_MAX			204800.0			/*    Max freq */
+#define DEV_SAMPLES_MIN			2				/* Min number of samples at a time. (experimentally) */
+#define DEV_SAMPLES_MAX			16777215			/* 2^24 - 1, measured experimentally */
+#define DEV_DCAC_SETTLETIME_S		0.782				/* time for the AC coupling to settle: see manual in section: Analog Input Channel Configurations -> Input Coupling */
+#define DEV_LOOPED_COMMIT_MIN_HZ	2000				/* Below this, a committed task, looped (Start, Read, Stop), reads fail at random. See NOTES.txt: "Beware of looped task commit" */
+
+/* Default values. (For a request, these are the same as ni4462_test's defaults) */
+#define DEFAULT_SOCKET			"/tmp/ni4462d.socket"		/* Where to listen */
+#define DEFAULT_CACHE_SIZE		8				/* Number of configured tasks to keep */
+#define DEFAULT_CHANNEL			"0"
+#define DEFAULT_SAMPLE_HZ		200000
+#define DEFAULT_COUNT			10000
+#define DEFAULT_V_LIMIT			10.0
+#define DEFAULT_ENABLE_ADC_LF_EAR	0				/* Bool: Enable low frequency enhanced alias rejection */
+#define INT_CLOCK_EDGE  		DAQmx_Val_Rising		/* Sample on the RE of the Internal clock. (Probably doesn't matter). */
+
+/* Buffer sizes */
+#define BUFFER_SIZE_TUPLES		25000				/* Max number of data tuples read at a time. */
+#define BUFFER_SIZE			(BUFFER_SIZE_TUPLES * DEV_NUM_CH) /* Size of the data buffer for all channels (4 channels wide) */
+#define REQUEST_MAX			1024				/* Max length of a request line */
+#define REQUEST_TIMEOUT_S		5				/* A client must send its request within this time (else, it would block the daemon) */
+#define CACHE_MAX			64				/* Upper limit for -k */
+
+/* Macros */
+#define eprintf(...)	fprintf(stderr, __VA_ARGS__)				/* Error printf: send to stderr  */
+
+#define deprintf(...)	if (debug) { fprintf(stderr, __VA_ARGS__); }		/* Debug error printf: print to stderr iff debug is set */
+
+#define feprintf(...)	fprintf(stderr, __VA_ARGS__); exit (EXIT_FAILURE)	/* Fatal error printf: send to stderr and exit */
+
+#define tryErr(functionCall) if (check_err ( (functionCall), client)){ goto daqmx_fail; }	/* For each DAQmx call, if it fails, tell the client, and abandon this request. */
+
+
+/* Globals */
+int debug = 0;
+int terminate_loop = 0;		/* for Ctrl-C / SIGTERM */
+char *state = "Initialising";
+
+
+/* The configuration of a task: this is the key for the cache. (Everything that's set up before TaskCommit; 'sum' is only the output, not the task.) */
+struct config {
+	char    channels[32];			/* Physical channel(s), eg Dev1/ai0 or Dev1/ai0:3 */
+	float64 freq;
+	uInt64  count;
+	float64 v_limit;
+	int32   coupling, terminal_mode, trigger_edge;	/* trigger_edge is 0 for "now" */
+	int     lf_ear;
+};
+
+/* A cached task. At most one is committed (reserved on the device) at a time; the rest are left verified. */
+struct cached_task {
+	struct  config cfg;
+	TaskHandle task;
+	int     valid;
+	unsigned long uses;
+	struct  timeval last_used;
+	float64 readback_hz, readback_v;
+};
+
+
+/* Show help */
+void print_help(char *argv0){
+	argv0 = basename(argv0);
+	eprintf("INTRO: %s is a daemon that owns the National Instruments %s PCI device, and serves capture requests over a Unix socket.\n"
+		"Configuring a DAQmx task is slow (~1.2 s), so each configuration is kept as a configured task, and re-used by later requests.\n"
+		"Only one task can be committed (reserved on the device) at a time; switching configuration costs a TaskCommit, not a CreateTask.\n"
+		"(Below %d Hz, tasks are not committed: re-running a committed finite task fails at random there. Each start then costs ~ 45 ms.)\n"
+		"\n"
+		"USAGE:  %s  [OPTIONS]                (run the daemon)\n"
+		"        %s  -q 'REQUEST'  [OPTIONS]  (client: send one request, copy the reply to stdout)\n"
+		"\n"
+		"OPTIONS:\n"
+		"   -h                print help and exit\n"
+		"   -d                debug: be much more verbose.\n"
+		"   -S   SOCKET       path of the Unix socket. [default: %s].\n"
+		"   -k   NUM          number of configured tasks to cache (least-recently used are cleared). [default: %d; max: %d].\n"
+		"   -q   REQUEST      client mode: send REQUEST to the daemon, and write its reply to stdout. Exit status is 0 iff it succeeded.\n"
+		"\n"
+		"REQUESTS are a single line. Keys (and defaults) follow ni4462_test's options:\n"
+		"   capture [c=0|1|2|3|all|sum] [f=FREQ] [n=COUNT] [v=V_LIMIT] [i=dc|ac] [m=diff|pdiff] [t=now|fe|re] [l=on|off] [o=data|stats]\n"
+		"                     acquire COUNT samples. [defaults: c=%s, f=%d, n=%d, v=%.1f, i=dc, m=diff, t=now, l=off, o=data].\n"
+		"   status            list the cached tasks.\n"
+		"   quit              clear all the tasks, and exit.\n"
+		"\n"
+		"REPLIES are in ni4462_test's output format: '#' header lines, then the data (one tab-separated line per sample; o=stats omits it),\n"
+		"then the mean and standard deviation of each channel, then a final line of either '#ok' or '#error: message'.\n"
+		"\n"
+		"EXAMPLE:  ni4462d &  ni4462d -q 'capture c=all f=200000 n=200000 v=10 o=stats'   (the 2nd and later requests start within ms).\n"
+		"\n"
+		"A client must send its request within %d s of connecting.\n"
+		"\n"
+		"SIGNALS: SigINT/SigTERM clear the tasks and exit (after the current request). SigUSR1 prints state to stderr.\n"
+		"SEE ALSO: ni4462_test, ni4462_capture\n"
+		"\n"
+		,argv0, DEV_NAME, DEV_LOOPED_COMMIT_MIN_HZ, argv0, argv0, DEFAULT_SOCKET, DEFAULT_CACHE_SIZE, CACHE_MAX, DEFAULT_CHANNEL, DEFAULT_SAMPLE_HZ, DEFAULT_COUNT, DEFAULT_V_LIMIT, REQUEST_TIMEOUT_S);
+}
+
+
+/* Error handling: a failed DAQmx call abandons the request (not the daemon). Tell the client and stderr. Warnings are printed, and ignored. Return 1 on failure. */
+int check_err (int32 error, FILE *client){
+	char  error_buf[2048]="\0", error_buf2[2048]="\0";
+	if (error == 0){	/* 0 is no error */
+		return 0;
+	}
+	DAQmxGetErrorString(error, error_buf, sizeof(error_buf));  /* Get long error msg */
+	DAQmxGetExtendedErrorInfo (error_buf2, sizeof(error_buf)); /* Get longer error msg */
+	if( DAQmxFailed(error) ){ /* i.e. (error < 0), rather than a warning */
+		eprintf ("DAQmx Error (%d): %s\n\n%s\n\n", error, error_buf, error_buf2);
+		fprintf (client, "#error: DAQmx error %d: %s\n", error, error_buf);
+		return 1;
+	}
+	eprintf ("DAQmx Warning: %s\n\n%s\n\n", error_buf, error_buf2);
+	return 0;
+}
+
+/* Return the difference of two timestamps, now - then, (in seconds, as double) */
+double timestamp_diff (struct timeval now, struct timeval then){
+	return (now.tv_sec - then.tv_sec + 1e-6 * (now.tv_usec - then.tv_usec));
+}
+
+/* Signal handler: SIGINT/SIGTERM: exit once the current request is done. */
+void handle_signal_term(int signum){
+	eprintf ("Signal %d, stopping after this request.\n", signum);
+	terminate_loop = 1;
+}
+
+/* Signal handler: handle SIGUSR1: print current state. */
+void handle_signal_usr1(int signum __attribute__ ((unused)) ){
+	eprintf ("%s\n", state);  //global.
+}
+
+
+/* Parse a capture request, "capture key=value ...", into cfg (and the output options). Return NULL if ok, else an error message. */
+char *parse_request (char *request, struct config *cfg, int *sum_channels, int *stats_only){
+	char   *tok, *val;
+	memset (cfg, 0, sizeof (*cfg));		/* (the whole struct is compared, padding and all) */
+	snprintf (cfg->channels, sizeof (cfg->channels), DEV_DEV"/ai%s", DEFAULT_CHANNEL);
+	cfg->freq = DEFAULT_SAMPLE_HZ;  cfg->count = DEFAULT_COUNT;  cfg->v_limit = DEFAULT_V_LIMIT;
+	cfg->coupling = DAQmx_Val_DC;  cfg->terminal_mode = DAQmx_Val_Diff;  cfg->trigger_edge = 0;  cfg->lf_ear = DEFAULT_ENABLE_ADC_LF_EAR;
+	*sum_channels = 0;  *stats_only = 0;
+
+	strtok (request, " \t\r\n");		/* the command itself */
+	while ( (tok = strtok (NULL, " \t\r\n")) ){
+		if ( (val = strchr (tok, '=')) == NULL){
+			return "expected key=value";
+		}
+		*val++ = '\0';
+		if (!strcmp (tok, "c")){
+			if (!strcasecmp (val, "all") || !strcasecmp (val, "sum")){
+				snprintf (cfg->channels, sizeof (cfg->channels), DEV_DEV"/ai0:%d", DEV_NUM_CH - 1);
+				*sum_channels = !strcasecmp (val, "sum");
+			}else if ( (strlen (val) == 1) && (val[0] >= '0') && (val[0] < '0' + DEV_NUM_CH) ){
+				snprintf (cfg->channels, sizeof (cfg->channels), DEV_DEV"/ai%s", val);
+			}else{
+				return "c must be 0-3, all or sum";
+			}
+		}else if (!strcmp (tok, "f")){
+			cfg->freq = strtod (val, NULL);
+			if ( (cfg->freq < DEV_FREQ_MIN) || (cfg->freq > DEV_FREQ_MAX) ){
+				return "f is out of range";
+			}
+		}else if (!strcmp (tok, "n")){
+			cfg->count = strtoll (val, NULL, 10);
+			if ( (cfg->count < DEV_SAMPLES_MIN) || (cfg->count > DEV_SAMPLES_MAX) ){
+				return "n is out of range";
+			}
+		}else if (!strcmp (tok, "v")){
+			cfg->v_limit = strtod (val, NULL);
+			if ( (cfg->v_limit <= 0) || (cfg->v_limit > DEV_VOLTAGE_MAX) ){
+				return "v is out of range";
+			}
+		}else if (!strcmp (tok, "i")){
+			if (!strcasecmp (val, "dc")){
+				cfg->coupling = DAQmx_Val_DC;
+			}else if (!strcasecmp (val, "ac")){
+				cfg->coupling = DAQmx_Val_AC;
+			}else{
+				return "i must be dc or ac";
+			}
+		}else if (!strcmp (tok, "m")){
+			if (!strcasecmp (val, "diff")){
+				cfg->terminal_mode = DAQmx_Val_Diff;
+			}else if (!strcasecmp (val, "pdiff")){
+				cfg->terminal_mode = DAQmx_Val_PseudoDiff;
+			}else{
+				return "m must be diff or pdiff";
+			}
+		}else if (!strcmp (tok, "t")){
+			if (!strcasecmp (val, "now")){
+				cfg->trigger_edge = 0;
+			}else if (!strcasecmp (val, "fe")){
+				cfg->trigger_edge = DAQmx_Val_Falling;
+			}else if (!strcasecmp (val, "re")){
+				cfg->trigger_edge = DAQmx_Val_Rising;
+			}else{
+				return "t must be now, fe or re";
+			}
+		}else if (!strcmp (tok, "l")){
+			if (!strcasecmp (val, "on") || !strcasecmp (val, "off")){
+				cfg->lf_ear = !strcasecmp (val, "on");
+			}else{
+				return "l must be on or off";
+			}
+		}else if (!strcmp (tok, "o")){
+			if (!strcasecmp (val, "data") || !strcasecmp (val, "stats")){
+				*stats_only = !strcasecmp (val, "stats");
+			}else{
+				return "o must be data or stats";
+			}
+		}else{
+			return "unknown key";
+		}
+	}
+	return NULL;
+}
+
+
+/* Create and configure a task for cfg (the slow part: ~1.2 s). Leave it verified, but not committed. Return 0 on success. */
+int configure_task (struct cached_task *ct, FILE *client){
+	float64 readback_v2;
+	struct  config *cfg = &ct->cfg;
+
+	ct->task = 0;
+	tryErr( DAQmxCreateTask ("", &ct->task) );
+	tryErr( DAQmxCreateAIVoltageChan (ct->task, cfg->channels, "VoltageInput", cfg->terminal_mode, -cfg->v_limit, cfg->v_limit, DAQmx_Val_Volts, NULL) );
+	tryErr( DAQmxGetAIMax (ct->task, cfg->channels, &readback_v2) );
+	tryErr( DAQmxSetAICoupling (ct->task, cfg->channels, cfg->coupling) );
+	if (cfg->trigger_edge){
+		tryErr( DAQmxCfgDigEdgeStartTrig (ct->task, "/"DEV_DEV"/"DEV_TRIGGER_INPUT, cfg->trigger_edge) );
+	}
+	tryErr( DAQmxCfgSampClkTiming (ct->task, OnboardClock, cfg->freq, INT_CLOCK_EDGE, DAQmx_Val_FiniteSamps, cfg->count) );
+	tryErr( DAQmxGetSampClkRate (ct->task, &ct->readback_hz) );
+	tryErr( DAQmxSetAIEnhancedAliasRejectionEnable (ct->task, cfg->channels, cfg->lf_ear) );
+	ct->readback_v = readback_v2;
+	ct->valid = 1;
+	ct->uses = 0;
+	return 0;
+
+daqmx_fail:
+	if (ct->task){
+		DAQmxClearTask (ct->task);
+	}
+	ct->valid = 0;
+	return -1;
+}
+
+
+/* Handle a capture request. Find (or configure) the task in the cache, make it the committed one, run it, and send the data. Return 0 on success. */
+int do_capture (char *request, FILE *client, struct cached_task *cache, int cache_size, struct cached_task **committed){
+	struct  config cfg;
+	struct  cached_task *ct = NULL;
+	int     i, c, nch, sum_channels, stats_only, hit = 0;
+	int32   samples_read;
+	uInt64  remaining, total = 0;
+	bool32  overload = 0;
+	char   *error;
+	static  float64 data[BUFFER_SIZE];
+	float64 S_y[DEV_NUM_CH] = {0}, S_yy[DEV_NUM_CH] = {0}, v;
+	struct  timeval t_request, t_ready, t_done;
+
+	gettimeofday (&t_request, NULL);
+	if ( (error = parse_request (request, &cfg, &sum_channels, &stats_only)) ){
+		fprintf (client, "#error: bad request: %s\n", error);
+		return -1;
+	}
+	nch = strchr (cfg.channels, ':') ? DEV_NUM_CH : 1;
+
+	/* Look it up in the cache. On a miss, evict the least-recently used (or an empty) entry. */
+	for (i=0; i < cache_size; i++){
+		if (cache[i].valid && !memcmp (&cache[i].cfg, &cfg, sizeof (cfg))){
+			ct = &cache[i];
+			hit = 1;
+			break;
+		}
+	}
+	if (!ct){
+		ct = &cache[0];
+		for (i=0; i < cache_size; i++){
+			if (!cache[i].valid){
+				ct = &cache[i];
+				break;
+			}else if (timestamp_diff (cache[i].last_used, ct->last_used) < 0){
+				ct = &cache[i];
+			}
+		}
+		if (ct->valid){
+			deprintf ("Cache full: clearing the least-recently used task (%s, %.1f Hz, %lld samples).\n", ct->cfg.channels, ct->cfg.freq, (long long)ct->cfg.count);
+			if (*committed == ct){
+				*committed = NULL;
+			}
+			DAQmxClearTask (ct->task);
+			ct->valid = 0;
+		}
+		state = "Configuring";
+		ct->cfg = cfg;
+		if (configure_task (ct, client)){
+			state = "Idle";
+			return -1;
+		}
+	}
+
+	/* Make it the committed task. Unreserve the previous one first: only one task can reserve the device. [Unreserving leaves it verified: re-commit is quick.] */
+	/* Below DEV_LOOPED_COMMIT_MIN_HZ, don't commit it: a committed finite task, re-run, is the bug in ni4462_bug_dont_use_task_commit.c. StartTask commits */
+	/* it implicitly instead (slower, ~ 45 ms), and StopTask leaves it verified again. */
+	if (*committed != ct){
+		if (*committed){
+			deprintf ("Unreserving the previously committed task.\n");
+			tryErr( DAQmxTaskControl ((*committed)->task, DAQmx_Val_Task_Unreserve) );
+			*committed = NULL;
+		}
+		if (ct->cfg.freq >= DEV_LOOPED_COMMIT_MIN_HZ){
+			state = "Committing";
+			tryErr( DAQmxTaskControl (ct->task, DAQmx_Val_Task_Commit) );
+			*committed = ct;
+		}else{
+			deprintf ("Below %d Hz: not committing the task (StartTask will, each time). See NOTES.txt.\n", DEV_LOOPED_COMMIT_MIN_HZ);
+		}
+		if ( (ct->cfg.coupling == DAQmx_Val_AC) && !hit){	/* Allow the AC coupling to settle, the first time. */
+			usleep ( (int)(DEV_DCAC_SETTLETIME_S * 1e6) );
+		}
+	}
+	ct->uses++;
+	gettimeofday (&ct->last_used, NULL);
+	gettimeofday (&t_ready, NULL);
+
+	/* Header. */
+	fprintf (client, "#Data from %s, via ni4462d\n", DEV_NAME);
+	fprintf (client, "#channels:  %s%s\n", ct->cfg.channels, sum_channels ? " (sum)" : "");
+	fprintf (client, "#freq_hz:   %.3f\n", ct->readback_hz);
+	fprintf (client, "#samples:   %lld\n", (long long)ct->cfg.count);
+	fprintf (client, "#voltage:   %.3f\n", ct->readback_v);
+	fprintf (client, "#cache:     %s, uses: %lu, setup_ms: %.3f\n", hit ? "hit" : "miss", ct->uses, timestamp_diff (t_ready, t_request) * 1e3);
+
+	/* Run it. Read in chunks, and send each chunk on. */
+	state = "Running";
+	tryErr( DAQmxStartTask (ct->task) );
+	for (remaining = ct->cfg.count; remaining > 0; remaining -= samples_read){
+		tryErr( DAQmxReadAnalogF64 (ct->task, (remaining > BUFFER_SIZE_TUPLES) ? BUFFER_SIZE_TUPLES : remaining, DAQmx_Val_WaitInfinitely, DAQmx_Val_GroupByScanNumber, data, BUFFER_SIZE, &samples_read, NULL) );
+		for (i=0; i < samples_read; i++){
+			for (c=0, v=0; c < nch; c++){
+				S_y [c] += data[nch*i + c];
+				S_yy[c] += data[nch*i + c] * data[nch*i + c];
+				v       += data[nch*i + c];
+			}
+			if (stats_only){
+				continue;
+			}else if (sum_channels || nch == 1){
+				fprintf (client, "%f\n", sum_channels ? v : data[i]);
+			}else{
+				fprintf (client, "%f\t%f\t%f\t%f\n", data[nch*i+0], data[nch*i+1], data[nch*i+2], data[nch*i+3]);
+			}
+		}
+		total += samples_read;
+		if (ferror (client)){		/* Client went away: abandon this. */
+			eprintf ("Client disconnected.\n");
+			DAQmxStopTask (ct->task);
+			state = "Idle";
+			return -1;
+		}
+	}
+	tryErr( DAQmxGetReadOverloadedChansExist (ct->task, &overload) );
+	tryErr( DAQmxStopTask (ct->task) );		/* Back to committed (below DEV_LOOPED_COMMIT_MIN_HZ, verified): ready to start again. */
+	gettimeofday (&t_done, NULL);
+	state = "Idle";
+
+	/* Trailer: statistics. */
+	for (c=0; c < nch; c++){
+		fprintf (client, "#mean_%d:    %f\t#stdev_%d: %f\n", c, S_y[c] / total, c, sqrt(fabs( (1.0/(total-1)) * (S_yy[c] - (pow(S_y[c],2) / total)) )));
+	}
+	fprintf (client, "#overload:  %s\n", overload ? "OVL" : "OK");
+	fprintf (client, "#total_ms:  %.3f\n", timestamp_diff (t_done, t_request) * 1e3);
+	fprintf (client, "#ok\n");
+	deprintf ("Capture: %s, %lld samples; cache %s; setup %.3f ms.\n", ct->cfg.channels, (long long)total, hit ? "hit" : "miss", timestamp_diff (t_ready, t_request) * 1e3);
+	return 0;
+
+daqmx_fail:			/* The task is in an unknown state. Discard it. */
+	DAQmxStopTask (ct->task);
+	DAQmxClearTask (ct->task);
+	ct->valid = 0;
+	if (*committed == ct){
+		*committed = NULL;
+	}
+	state = "Idle";
+	return -1;
+}
+
+
+/* Client: send the request, copy the reply to stdout. Return 0 iff the last line of the reply is '#ok'. */
+int client (char *socket_path, char *request){
+	struct  sockaddr_un addr;
+	int     fd;
+	char    line[REQUEST_MAX], last[REQUEST_MAX] = "";
+	FILE   *f;
+
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strncpy (addr.sun_path, socket_path, sizeof (addr.sun_path) - 1);
+	if ( (fd < 0) || (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) ){
+		feprintf ("Error: can't connect to ni4462d at '%s': %s. (Is the daemon running?)\n", socket_path, strerror(errno));
+	}
+	if ( (write (fd, request, strlen (request)) < 0) || (write (fd, "\n", 1) < 0) ){
+		feprintf ("Error: can't send request: %s\n", strerror(errno));
+	}
+	f = fdopen (fd, "r");
+	while (fgets (line, sizeof (line), f)){
+		fputs (line, stdout);
+		strcpy (last, line);
+	}
+	fclose (f);
+	return strncmp (last, "#ok", 3) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* Do it... */
+int main(int argc, char* argv[]){
+
+	int	opt; extern char *optarg; extern int optind, opterr, optopt;       /* getopt */
+	char   *socket_path = DEFAULT_SOCKET;
+	char   *request = NULL;
+	int     cache_size = DEFAULT_CACHE_SIZE;
+	struct  cached_task cache[CACHE_MAX], *committed = NULL;
+	struct  sockaddr_un addr;
+	int     i, ret, listen_fd, fd, len;
+	char    line[REQUEST_MAX];
+	FILE   *client_f;
+	struct  timeval timeout = { REQUEST_TIMEOUT_S, 0 };
+	struct  sigaction sa;
+
+	/* Parse options and check for validity */
+        if ((argc > 1) && (!strcmp (argv[1], "--help"))) {      /* Support --help, without the full getopt_long */
+                print_help(argv[0]);
+                exit (EXIT_SUCCESS);
+        }
+
+        while ((opt = getopt(argc, argv, "dhk:q:S:")) != -1) {  /* Getopt */
+                switch (opt) {
+			case 'd':				/* Debugging */
+				debug = 1;
+				break;
+
+			case 'h':                               /* Help */
+				print_help(argv[0]);
+				exit (EXIT_SUCCESS);
+				break;
+
+			case 'k':				/* Cache size */
+				cache_size = atoi(optarg);
+				if ( (cache_size < 1) || (cache_size > CACHE_MAX) ){
+					feprintf ("Fatal Error: cache size (-k) must be between 1 and %d.\n", CACHE_MAX);
+				}
+				break;
+
+			case 'q':				/* Client mode */
+				request = optarg;
+				break;
+
+			case 'S':				/* Socket path */
+				socket_path = optarg;
+				break;
+
+			default:
+				feprintf ("Unrecognised argument %c. Use -h for help.\n", opt);
+				break;
+		}
+	}
+	if (argc - optind != 0){
+		feprintf ("This takes no non-option arguments. Use -h for help.\n");
+	}
+	if (strlen (socket_path) >= sizeof (addr.sun_path)){
+		feprintf ("Fatal Error: socket path '%s' is too long.\n", socket_path);
+	}
+
+	/* Client? */
+	if (request){
+		return client (socket_path, request);
+	}
+
+	/* Daemon. Listen on the socket. (Remove a stale socket; but don't steal one that's in use.) */
+	memset (cache, 0, sizeof (cache));
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strncpy (addr.sun_path, socket_path, sizeof (addr.sun_path) - 1);
+	listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0){
+		feprintf ("Fatal Error: can't create socket: %s\n", strerror(errno));
+	}
+	if (connect (listen_fd, (struct sockaddr *)&addr, sizeof (addr)) == 0){
+		feprintf ("Fatal Error: another ni4462d is already listening on '%s'.\n", socket_path);
+	}
+	close (listen_fd);
+	unlink (socket_path);
+	listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if ( (listen_fd < 0) || (bind (listen_fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) || (listen (listen_fd, 4) < 0) ){
+		feprintf ("Fatal Error: can't listen on '%s': %s\n", socket_path, strerror(errno));
+	}
+
+	/* Signals: SIGINT/SIGTERM stop cleanly (without SA_RESTART, so that accept() returns); ignore SIGPIPE from departed clients. */
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_handler = handle_signal_term;
+	sigaction (SIGINT, &sa, NULL);
+	sigaction (SIGTERM, &sa, NULL);
+	signal(SIGUSR1, handle_signal_usr1);
+	signal(SIGPIPE, SIG_IGN);
+	eprintf ("ni4462d: listening on '%s', caching up to %d tasks.\n", socket_path, cache_size);
+	state = "Idle";
+
+	/* Serve requests, one at a time (there's only one device). */
+	while (!terminate_loop){
+		fd = accept (listen_fd, NULL, NULL);
+		if (fd < 0){
+			if (errno != EINTR){
+				eprintf ("accept() failed: %s\n", strerror(errno));
+			}
+			continue;
+		}
+		setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));	/* Don't wait for ever on a silent client. */
+		for (len = 0; len < REQUEST_MAX - 1; len += ret){	/* Read one line. */
+			ret = read (fd, line + len, REQUEST_MAX - 1 - len);
+			if ( (ret <= 0) || memchr (line + len, '\n', ret) ){
+				len += (ret > 0) ? ret : 0;
+				break;
+			}
+		}
+		line[len] = '\0';
+		client_f = fdopen (fd, "w");
+		if (len){
+			deprintf ("Request: %s", line);
+		}
+
+		if ( (ret < 0) && ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) ){
+			eprintf ("Client sent no request within %d s: dropped.\n", REQUEST_TIMEOUT_S);
+			fprintf (client_f, "#error: no request within %d s.\n", REQUEST_TIMEOUT_S);
+		}else if (!strncmp (line, "capture", 7)){
+			do_capture (line, client_f, cache, cache_size, &committed);
+		}else if (!strncmp (line, "status", 6)){
+			fprintf (client_f, "#state: %s\n", state);
+			for (i=0; i < cache_size; i++){
+				if (cache[i].valid){
+					fprintf (client_f, "#task %d: %s%s, %.3f Hz, %lld samples, +/-%.3f V, uses: %lu\n", i, cache[i].cfg.channels, (committed == &cache[i]) ? " [committed]" : "",
+						cache[i].readback_hz, (long long)cache[i].cfg.count, cache[i].readback_v, cache[i].uses);
+				}
+			}
+			fprintf (client_f, "#ok\n");
+		}else if (!strncmp (line, "quit", 4)){
+			fprintf (client_f, "#ok\n");
+			terminate_loop = 1;
+		}else{
+			fprintf (client_f, "#error: unknown request. (capture, status, quit)\n");
+		}
+		fclose (client_f);
+	}
+
+	/* Done. Clear all the tasks. */
+	eprintf ("ni4462d: exiting.\n");
+	for (i=0; i < cache_size; i++){
+		if (cache[i].valid){
+			DAQmxClearTask (cache[i].task);
+		}
+	}
+	close (listen_fd);
+	unlink (socket_path);
+	deprintf ("Cleaning up after libnidaqmx: removing lockfiles from NI tempdir, %s .\n", LIBDAQMX_TMPDIR)   /* libdaqmx should clean up its own lockfiles, but doesn't. */
+	ret = system ( "rm -f "LIBDAQMX_TMPDIR"ni_dsc_osdep_*" );   /* Risky. Part of the path is hardcoded here, as a slight safety measure. */
+	if (ret != 0){
+		deprintf ("Problem cleaning up.\n")
+	}
+	return 0;
+}
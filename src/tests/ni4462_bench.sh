@@ -0,0 +1,57 @@
+#!/bin/bash
+
+#Throughput benchmark for ni4462_capture: run each analysis mode over a fixed synthetic workload, and report how fast it was processed.
+#Copyright 2013 Richard Neill <ni4462 at richardneill dot org>. This is Free Software, Licensed under the GNU GPL v3+.
+
+#This needs no hardware: the binary should be built against the dummy libdaqmx (which 'make bench' does), which is silenced here with DAQMX_DUMMY_QUIET=1,
+#and is not in real-time mode, so the samples arrive as fast as they can be read. Thus this measures the capture pipeline: read, analysis, formatting and output.
+#Output is tab-separated, one line per (mode, format), after a '#' header line. ns/sample is per tuple (one sample on each of the 4 channels); times are the
+#best of $REPEATS runs. Output is counted (not kept). Use this to catch performance regressions: compare with the results from a known-good version.
+
+BINARY=${1:-src/tests/ni4462_capture_bench}
+REPEATS=3
+FREQ=204800
+
+#Workloads, per mode:  "mode  frames  options". Each frame is -n samples (per channel); the image modes need -p to match -n, -x, -y.
+WORKLOADS=(
+	"raw          100   -n 10000"
+	"raw_stream   100   -n 10000"
+	"lin_reg      2000  -n 10000 -x 1 -y 1"
+	"cds_multiple 2000  -n 10000 -x 1 -y 1 -c 1000"
+	"image        400   -n 4100 -p 4096 -x 2 -y 2 -z 0"
+	"image_diff   400   -n 4100 -p 4096 -x 2 -y 2 -z 0"
+)
+FORMATS="ascii binary"
+
+if [ "$1" == -h ] || [ "$1" == --help ]; then
+	echo "Usage: $(basename $0) [CAPTURE_BINARY]     (default: $BINARY). Normally, run via 'make bench'."
+	exit 0
+fi
+if [ ! -x "$BINARY" ]; then
+	echo "Error: can't run '$BINARY'. Build it with 'make bench' (against the dummy libdaqmx)." >&2 ; exit 1
+fi
+export DAQMX_DUMMY_QUIET=1
+unset DAQMX_DUMMY_REALTIME
+
+echo -e "#mode\tformat\tframes\tsamples\tns_per_sample\tframes_per_s\tbytes_per_s\toutput_bytes"
+for workload in "${WORKLOADS[@]}"; do
+	read MODE FRAMES OPTS <<< "$workload"
+	NUM=$(echo "$OPTS" | sed -E 's/.*-n ([0-9]+).*/\1/')
+	SAMPLES=$((NUM * FRAMES))
+	for FORMAT in $FORMATS; do
+		BEST=
+		for ((i=0; i<REPEATS; i++)); do
+			START=$(date +%s%N)
+			BYTES=$("$BINARY" -a $MODE -f $FREQ -m $FRAMES -o $FORMAT $OPTS 2>/dev/null | wc -c)
+			STATUS=${PIPESTATUS[0]}
+			NS=$(( $(date +%s%N) - START ))
+			if [ $STATUS != 0 ]; then
+				echo "Error: '$BINARY -a $MODE -f $FREQ -m $FRAMES -o $FORMAT $OPTS' failed (exit $STATUS)." >&2 ; exit 1
+			fi
+			if [ -z "$BEST" ] || [ $NS -lt $BEST ]; then
+				BEST=$NS
+			fi
+		done
+		awk -v m=$MODE -v f=$FORMAT -v fr=$FRAMES -v s=$SAMPLES -v ns=$BEST -v b=$BYTES 'BEGIN { printf "%s\t%s\t%d\t%d\t%.3f\t%.1f\t%.0f\t%d\n", m, f, fr, s, ns/s, fr*1e9/ns, b*1e9/ns, b }'
+	done
+done